@@ -42,28 +42,31 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 #include <string.h> // CBC mode, for memset
 #include "aes.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <emmintrin.h>
+#include <wmmintrin.h> // AES-NI
+#endif
+
 /*****************************************************************************/
 /* Defines:                                                                  */
 /*****************************************************************************/
 // The number of columns comprising a state in AES. This is a constant in AES. Value=4
 #define Nb 4
-#define BLOCKLEN 16 //Block length in bytes AES is 128b block only
+#define BLOCKLEN AES_BLOCKLEN
+#define keyExpSize AES_keyExpSize
 
 #if defined(AES256) && (AES256 == 1)
     #define Nk 8
     #define KEYLEN 32
     #define Nr 14
-    #define keyExpSize 240
 #elif defined(AES192) && (AES192 == 1)
     #define Nk 6
     #define KEYLEN 24
     #define Nr 12
-    #define keyExpSize 208
 #else
     #define Nk 4        // The number of 32 bit words in a key.
     #define KEYLEN 16   // Key length in bytes
     #define Nr 10       // The number of rounds in AES Cipher.
-    #define keyExpSize 176
 #endif
 
 // jcallan@github points out that declaring Multiply as a function
@@ -77,19 +80,22 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 /*****************************************************************************/
 /* Private variables:                                                        */
 /*****************************************************************************/
+// The private variables are thread local, since telegrams can be
+// decrypted by several decode worker threads at the same time.
+
 // state - array holding the intermediate results during decryption.
 typedef uint8_t state_t[4][4];
-static state_t* state;
+static thread_local state_t* state;
 
-// The array that stores the round keys.
-static uint8_t RoundKey[keyExpSize];
+// The round keys used by the current operation, they belong to a prepared context.
+static thread_local const uint8_t* RoundKey;
 
-// The Key input to the AES Program
-static const uint8_t* Key;
+// The context prepared by the functions that are given the key itself.
+static thread_local struct AES_ctx KeyCtx;
 
 #if defined(CBC) && CBC
   // Initial Vector used only for CBC mode
-  static uint8_t* Iv;
+  static thread_local uint8_t* Iv;
 #endif
 
 // The lookup-tables are marked const so they can be placed in read-only storage instead of RAM
@@ -182,7 +188,7 @@ static uint8_t getSBoxInvert(uint8_t num)
 }
 
 // This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states.
-static void KeyExpansion(void)
+static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
 {
   uint32_t i, k;
   uint8_t tempa[4]; // Used for the column/row operations
@@ -471,104 +477,375 @@ static void InvCipher(void)
 
 
 /*****************************************************************************/
-/* Public functions:                                                         */
+/* Portable kernels:                                                         */
 /*****************************************************************************/
-#if defined(ECB) && (ECB == 1)
+// The kernels encrypt/decrypt with a prepared context. The portable kernels
+// work on the state in memory, one byte at a time.
 
+#if defined(CBC) && CBC
+static void XorWithIv(uint8_t* buf)
+{
+  uint8_t i;
+  for (i = 0; i < BLOCKLEN; ++i) //WAS for(i = 0; i < KEYLEN; ++i) but the block in AES is always 128bit so 16 bytes!
+  {
+    buf[i] ^= Iv[i];
+  }
+}
+#endif
 
-void AES_ECB_encrypt(const uint8_t* input, const uint8_t* key, uint8_t* output, const uint32_t length)
+// Increment the counter block as a 128 bit big endian number.
+static void IncrementCounter(uint8_t* ctr)
+{
+  int i;
+  for (i = BLOCKLEN - 1; i >= 0; --i)
+  {
+    if (++ctr[i] != 0) break;
+  }
+}
+
+static void ECB_encrypt_portable(const struct AES_ctx* ctx, const uint8_t* input, uint8_t* output)
 {
   // Copy input to output, and work in-memory on output
-  memcpy(output, input, length);
+  memcpy(output, input, BLOCKLEN);
   state = (state_t*)output;
-
-  Key = key;
-  KeyExpansion();
+  RoundKey = ctx->RoundKey;
 
   // The next function call encrypts the PlainText with the Key using AES algorithm.
   Cipher();
 }
 
-void AES_ECB_decrypt(const uint8_t* input, const uint8_t* key, uint8_t *output, const uint32_t length)
+static void ECB_decrypt_portable(const struct AES_ctx* ctx, const uint8_t* input, uint8_t* output)
 {
   // Copy input to output, and work in-memory on output
-  memcpy(output, input, length);
+  memcpy(output, input, BLOCKLEN);
   state = (state_t*)output;
-
-  // The KeyExpansion routine must be called before encryption.
-  Key = key;
-  KeyExpansion();
+  RoundKey = ctx->RoundKey;
 
   InvCipher();
 }
 
+static void CBC_decrypt_portable(const struct AES_ctx* ctx, uint8_t* output, uint8_t* input, uint32_t length)
+{
+  uintptr_t i;
 
-#endif // #if defined(ECB) && (ECB == 1)
+  RoundKey = ctx->RoundKey;
 
+  for (i = 0; i < length; i += BLOCKLEN)
+  {
+    memcpy(output, input, BLOCKLEN);
+    state = (state_t*)output;
+    InvCipher();
+    XorWithIv(output);
+    Iv = input;
+    input += BLOCKLEN;
+    output += BLOCKLEN;
+  }
+}
 
+static void CTR_xcrypt_portable(const struct AES_ctx* ctx, uint8_t* iv, uint8_t* buf, uint32_t length)
+{
+  uint8_t stream[BLOCKLEN];
+  uint32_t i, j, n;
 
+  for (i = 0; i < length; i += BLOCKLEN)
+  {
+    ECB_encrypt_portable(ctx, iv, stream);
+    IncrementCounter(iv);
+    n = length - i < BLOCKLEN ? length - i : BLOCKLEN;
+    for (j = 0; j < n; ++j)
+    {
+      buf[i + j] ^= stream[j];
+    }
+  }
+}
 
 
-#if defined(CBC) && (CBC == 1)
+/*****************************************************************************/
+/* AES-NI kernels:                                                           */
+/*****************************************************************************/
+#if defined(__x86_64__) && defined(__GNUC__)
 
+#define AESNI __attribute__((target("aes,sse2")))
 
-static void XorWithIv(uint8_t* buf)
+AESNI static inline void LoadKeys_aesni(const uint8_t* keys, __m128i* k)
 {
-  uint8_t i;
-  for (i = 0; i < BLOCKLEN; ++i) //WAS for(i = 0; i < KEYLEN; ++i) but the block in AES is always 128bit so 16 bytes!
+  int r;
+  for (r = 0; r <= Nr; ++r)
   {
-    buf[i] ^= Iv[i];
+    k[r] = _mm_loadu_si128((const __m128i*)(keys + r * BLOCKLEN));
   }
 }
 
-void AES_CBC_encrypt_buffer(uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* key, const uint8_t* iv)
+// The AES-NI decryption uses the equivalent inverse cipher. It needs the round keys
+// in reverse order with InvMixColumns applied to all but the first and the last.
+AESNI static void InvKeyExpansion_aesni(struct AES_ctx* ctx)
 {
-  uintptr_t i;
-//  uint8_t extra = length % BLOCKLEN; /* Remaining bytes in the last non-full block */
-
-  // Skip the key expansion if key is passed as 0
-  if (0 != key)
+  __m128i k[Nr + 1];
+  int r;
+  LoadKeys_aesni(ctx->RoundKey, k);
+  _mm_storeu_si128((__m128i*)ctx->InvRoundKey, k[Nr]);
+  for (r = 1; r < Nr; ++r)
   {
-    Key = key;
-    KeyExpansion();
+    _mm_storeu_si128((__m128i*)(ctx->InvRoundKey + r * BLOCKLEN), _mm_aesimc_si128(k[Nr - r]));
   }
+  _mm_storeu_si128((__m128i*)(ctx->InvRoundKey + Nr * BLOCKLEN), k[0]);
+}
 
-  if (iv != 0)
+AESNI static inline __m128i Cipher_aesni(const __m128i* k, __m128i b)
+{
+  int r;
+  b = _mm_xor_si128(b, k[0]);
+  for (r = 1; r < Nr; ++r)
   {
-    Iv = (uint8_t*)iv;
+    b = _mm_aesenc_si128(b, k[r]);
   }
+  return _mm_aesenclast_si128(b, k[Nr]);
+}
 
-  for (i = 0; i < length; i += BLOCKLEN)
+AESNI static inline __m128i InvCipher_aesni(const __m128i* k, __m128i b)
+{
+  int r;
+  b = _mm_xor_si128(b, k[0]);
+  for (r = 1; r < Nr; ++r)
   {
-    XorWithIv(input);
-    memcpy(output, input, BLOCKLEN);
-    state = (state_t*)output;
-    Cipher();
-    Iv = output;
-    input += BLOCKLEN;
-    output += BLOCKLEN;
-    //printf("Step %d - %d", i/16, i);
+    b = _mm_aesdec_si128(b, k[r]);
   }
+  return _mm_aesdeclast_si128(b, k[Nr]);
+}
 
-/*  if (extra)
+AESNI static void ECB_encrypt_aesni(const struct AES_ctx* ctx, const uint8_t* input, uint8_t* output)
+{
+  __m128i k[Nr + 1];
+  LoadKeys_aesni(ctx->RoundKey, k);
+  _mm_storeu_si128((__m128i*)output, Cipher_aesni(k, _mm_loadu_si128((const __m128i*)input)));
+}
+
+AESNI static void ECB_decrypt_aesni(const struct AES_ctx* ctx, const uint8_t* input, uint8_t* output)
+{
+  __m128i k[Nr + 1];
+  LoadKeys_aesni(ctx->InvRoundKey, k);
+  _mm_storeu_si128((__m128i*)output, InvCipher_aesni(k, _mm_loadu_si128((const __m128i*)input)));
+}
+
+AESNI static void CBC_decrypt_aesni(const struct AES_ctx* ctx, uint8_t* output, uint8_t* input, uint32_t length)
+{
+  __m128i k[Nr + 1];
+  __m128i iv, c0, c1, c2, c3, b0, b1, b2, b3;
+  uint32_t i = 0;
+  int r;
+
+  if (length == 0) return;
+  LoadKeys_aesni(ctx->InvRoundKey, k);
+  iv = _mm_loadu_si128((const __m128i*)Iv);
+
+  // Each block only depends on its own and the previous cipher text,
+  // thus four blocks are decrypted at the same time.
+  for (; i + 4 * BLOCKLEN <= length; i += 4 * BLOCKLEN)
   {
-    memcpy(output, input, extra);
-    state = (state_t*)output;
-    Cipher();
-    } */
+    c0 = _mm_loadu_si128((const __m128i*)(input + i));
+    c1 = _mm_loadu_si128((const __m128i*)(input + i + BLOCKLEN));
+    c2 = _mm_loadu_si128((const __m128i*)(input + i + 2 * BLOCKLEN));
+    c3 = _mm_loadu_si128((const __m128i*)(input + i + 3 * BLOCKLEN));
+    b0 = _mm_xor_si128(c0, k[0]);
+    b1 = _mm_xor_si128(c1, k[0]);
+    b2 = _mm_xor_si128(c2, k[0]);
+    b3 = _mm_xor_si128(c3, k[0]);
+    for (r = 1; r < Nr; ++r)
+    {
+      b0 = _mm_aesdec_si128(b0, k[r]);
+      b1 = _mm_aesdec_si128(b1, k[r]);
+      b2 = _mm_aesdec_si128(b2, k[r]);
+      b3 = _mm_aesdec_si128(b3, k[r]);
+    }
+    b0 = _mm_aesdeclast_si128(b0, k[Nr]);
+    b1 = _mm_aesdeclast_si128(b1, k[Nr]);
+    b2 = _mm_aesdeclast_si128(b2, k[Nr]);
+    b3 = _mm_aesdeclast_si128(b3, k[Nr]);
+    _mm_storeu_si128((__m128i*)(output + i), _mm_xor_si128(b0, iv));
+    _mm_storeu_si128((__m128i*)(output + i + BLOCKLEN), _mm_xor_si128(b1, c0));
+    _mm_storeu_si128((__m128i*)(output + i + 2 * BLOCKLEN), _mm_xor_si128(b2, c1));
+    _mm_storeu_si128((__m128i*)(output + i + 3 * BLOCKLEN), _mm_xor_si128(b3, c2));
+    iv = c3;
+  }
+  for (; i < length; i += BLOCKLEN)
+  {
+    c0 = _mm_loadu_si128((const __m128i*)(input + i));
+    _mm_storeu_si128((__m128i*)(output + i), _mm_xor_si128(InvCipher_aesni(k, c0), iv));
+    iv = c0;
+  }
+  // Continue from the last cipher text block, just like the portable kernel.
+  Iv = input + length - BLOCKLEN;
 }
 
-void AES_CBC_decrypt_buffer(uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* key, const uint8_t* iv)
+AESNI static void CTR_xcrypt_aesni(const struct AES_ctx* ctx, uint8_t* iv, uint8_t* buf, uint32_t length)
 {
-  uintptr_t i;
-//  uint8_t extra = length % BLOCKLEN; /* Remaining bytes in the last non-full block */
+  __m128i k[Nr + 1];
+  __m128i b0, b1, b2, b3;
+  uint8_t stream[BLOCKLEN];
+  uint32_t i = 0, j, n;
+  int r;
 
-  // Skip the key expansion if key is passed as 0
-  if (0 != key)
+  LoadKeys_aesni(ctx->RoundKey, k);
+
+  // The counter blocks are independent, four of them are encrypted at the same time.
+  for (; i + 4 * BLOCKLEN <= length; i += 4 * BLOCKLEN)
+  {
+    b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)iv), k[0]);
+    IncrementCounter(iv);
+    b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)iv), k[0]);
+    IncrementCounter(iv);
+    b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)iv), k[0]);
+    IncrementCounter(iv);
+    b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)iv), k[0]);
+    IncrementCounter(iv);
+    for (r = 1; r < Nr; ++r)
+    {
+      b0 = _mm_aesenc_si128(b0, k[r]);
+      b1 = _mm_aesenc_si128(b1, k[r]);
+      b2 = _mm_aesenc_si128(b2, k[r]);
+      b3 = _mm_aesenc_si128(b3, k[r]);
+    }
+    b0 = _mm_aesenclast_si128(b0, k[Nr]);
+    b1 = _mm_aesenclast_si128(b1, k[Nr]);
+    b2 = _mm_aesenclast_si128(b2, k[Nr]);
+    b3 = _mm_aesenclast_si128(b3, k[Nr]);
+    _mm_storeu_si128((__m128i*)(buf + i), _mm_xor_si128(b0, _mm_loadu_si128((const __m128i*)(buf + i))));
+    _mm_storeu_si128((__m128i*)(buf + i + BLOCKLEN), _mm_xor_si128(b1, _mm_loadu_si128((const __m128i*)(buf + i + BLOCKLEN))));
+    _mm_storeu_si128((__m128i*)(buf + i + 2 * BLOCKLEN), _mm_xor_si128(b2, _mm_loadu_si128((const __m128i*)(buf + i + 2 * BLOCKLEN))));
+    _mm_storeu_si128((__m128i*)(buf + i + 3 * BLOCKLEN), _mm_xor_si128(b3, _mm_loadu_si128((const __m128i*)(buf + i + 3 * BLOCKLEN))));
+  }
+  for (; i < length; i += BLOCKLEN)
   {
-    Key = key;
-    KeyExpansion();
+    _mm_storeu_si128((__m128i*)stream, Cipher_aesni(k, _mm_loadu_si128((const __m128i*)iv)));
+    IncrementCounter(iv);
+    n = length - i < BLOCKLEN ? length - i : BLOCKLEN;
+    for (j = 0; j < n; ++j)
+    {
+      buf[i + j] ^= stream[j];
+    }
   }
+}
+
+#endif // #if defined(__x86_64__) && defined(__GNUC__)
+
+
+/*****************************************************************************/
+/* Kernel selection:                                                         */
+/*****************************************************************************/
+struct AES_kernels
+{
+  const char* name;
+  void (*ecb_encrypt)(const struct AES_ctx* ctx, const uint8_t* input, uint8_t* output);
+  void (*ecb_decrypt)(const struct AES_ctx* ctx, const uint8_t* input, uint8_t* output);
+  void (*cbc_decrypt)(const struct AES_ctx* ctx, uint8_t* output, uint8_t* input, uint32_t length);
+  void (*ctr_xcrypt)(const struct AES_ctx* ctx, uint8_t* iv, uint8_t* buf, uint32_t length);
+};
+
+static const struct AES_kernels portable_kernels = {
+  "portable", ECB_encrypt_portable, ECB_decrypt_portable, CBC_decrypt_portable, CTR_xcrypt_portable };
+
+static bool use_portable_kernels = false;
+
+static bool DetectAESNI(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+  // Contexts might be prepared by static initializers, before the cpu features are known.
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("aes");
+#else
+  return false;
+#endif
+}
+
+static bool HasAESNI(void)
+{
+  static bool has_aesni = DetectAESNI();
+  return has_aesni;
+}
+
+static const struct AES_kernels* Kernels(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+  static const struct AES_kernels aesni_kernels = {
+    "aesni", ECB_encrypt_aesni, ECB_decrypt_aesni, CBC_decrypt_aesni, CTR_xcrypt_aesni };
+  if (!use_portable_kernels && HasAESNI()) return &aesni_kernels;
+#endif
+  return &portable_kernels;
+}
+
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key)
+{
+  KeyExpansion(ctx->RoundKey, key);
+#if defined(__x86_64__) && defined(__GNUC__)
+  // The inverse keys are always prepared, the kernels can be switched at any time.
+  if (HasAESNI()) InvKeyExpansion_aesni(ctx);
+#endif
+}
+
+const char* AES_kernels_name(void)
+{
+  return Kernels()->name;
+}
+
+void AES_use_portable_kernels(bool b)
+{
+  use_portable_kernels = b;
+}
+
+#if defined(ECB) && (ECB == 1)
+
+
+void AES_ECB_encrypt_ctx(const struct AES_ctx* ctx, const uint8_t* input, uint8_t* output)
+{
+  Kernels()->ecb_encrypt(ctx, input, output);
+}
+
+void AES_ECB_decrypt_ctx(const struct AES_ctx* ctx, const uint8_t* input, uint8_t* output)
+{
+  Kernels()->ecb_decrypt(ctx, input, output);
+}
+
+void AES_ECB_encrypt(const uint8_t* input, const uint8_t* key, uint8_t* output, const uint32_t length)
+{
+  // The KeyExpansion routine must be called before encryption.
+  AES_init_ctx(&KeyCtx, key);
+  AES_ECB_encrypt_ctx(&KeyCtx, input, output);
+  // Only the first block is processed, the rest is copied as is.
+  if (length > BLOCKLEN) memcpy(output+BLOCKLEN, input+BLOCKLEN, length-BLOCKLEN);
+}
+
+void AES_ECB_decrypt(const uint8_t* input, const uint8_t* key, uint8_t *output, const uint32_t length)
+{
+  // The KeyExpansion routine must be called before decryption.
+  AES_init_ctx(&KeyCtx, key);
+  AES_ECB_decrypt_ctx(&KeyCtx, input, output);
+  // Only the first block is processed, the rest is copied as is.
+  if (length > BLOCKLEN) memcpy(output+BLOCKLEN, input+BLOCKLEN, length-BLOCKLEN);
+}
+
+
+#endif // #if defined(ECB) && (ECB == 1)
+
+
+
+void AES_CTR_xcrypt_buffer_ctx(const struct AES_ctx* ctx, uint8_t* iv, uint8_t* buf, uint32_t length)
+{
+  Kernels()->ctr_xcrypt(ctx, iv, buf, length);
+}
+
+
+
+#if defined(CBC) && (CBC == 1)
+
+
+void AES_CBC_encrypt_buffer_ctx(const struct AES_ctx* ctx, uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* iv)
+{
+  uintptr_t i;
+  const struct AES_kernels* kernels = Kernels();
 
   // If iv is passed as 0, we continue to encrypt without re-setting the Iv
   if (iv != 0)
@@ -576,23 +853,46 @@ void AES_CBC_decrypt_buffer(uint8_t* output, uint8_t* input, uint32_t length, co
     Iv = (uint8_t*)iv;
   }
 
+  // Each block depends on the previous one, so the blocks are encrypted one at a time.
   for (i = 0; i < length; i += BLOCKLEN)
   {
-    memcpy(output, input, BLOCKLEN);
-    state = (state_t*)output;
-    InvCipher();
-    XorWithIv(output);
-    Iv = input;
+    XorWithIv(input);
+    kernels->ecb_encrypt(ctx, input, output);
+    Iv = output;
     input += BLOCKLEN;
     output += BLOCKLEN;
   }
+}
 
-/*  if (extra)
+void AES_CBC_decrypt_buffer_ctx(const struct AES_ctx* ctx, uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* iv)
+{
+  // If iv is passed as 0, we continue to decrypt without re-setting the Iv
+  if (iv != 0)
   {
-    memcpy(output, input, extra);
-    state = (state_t*)output;
-    InvCipher();
-    }*/
+    Iv = (uint8_t*)iv;
+  }
+
+  Kernels()->cbc_decrypt(ctx, output, input, length);
+}
+
+void AES_CBC_encrypt_buffer(uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* key, const uint8_t* iv)
+{
+  // Skip the key expansion if key is passed as 0
+  if (0 != key)
+  {
+    AES_init_ctx(&KeyCtx, key);
+  }
+  AES_CBC_encrypt_buffer_ctx(&KeyCtx, output, input, length, iv);
+}
+
+void AES_CBC_decrypt_buffer(uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* key, const uint8_t* iv)
+{
+  // Skip the key expansion if key is passed as 0
+  if (0 != key)
+  {
+    AES_init_ctx(&KeyCtx, key);
+  }
+  AES_CBC_decrypt_buffer_ctx(&KeyCtx, output, input, length, iv);
 }
 
 #endif // #if defined(CBC) && (CBC == 1)
@@ -25,11 +25,47 @@
 //#define AES192 1
 //#define AES256 1
 
+#define AES_BLOCKLEN 16 // Block length in bytes, AES is 128b block only
+
+#if defined(AES256) && (AES256 == 1)
+    #define AES_keyExpSize 240
+#elif defined(AES192) && (AES192 == 1)
+    #define AES_keyExpSize 208
+#else
+    #define AES_keyExpSize 176
+#endif
+
+// The expanded round keys of an aes key. Prepare the context once with
+// AES_init_ctx and reuse it, then each block only costs the rounds.
+struct AES_ctx
+{
+  uint8_t RoundKey[AES_keyExpSize];
+  // The round keys for the equivalent inverse cipher, used by the AES-NI kernels.
+  uint8_t InvRoundKey[AES_keyExpSize];
+};
+
+void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key);
+
+// The kernels that do the work are picked at startup, AES-NI when the cpu
+// supports it, otherwise the portable byte oriented code.
+const char* AES_kernels_name(void);
+// Force the portable kernels, used for testing and benchmarking.
+void AES_use_portable_kernels(bool b);
+
+// Xor the ctr keystream for the counter block iv into buf. The counter is
+// incremented as a 128 bit big endian number for every block, also the last
+// partial one, and is left at the next unused counter.
+void AES_CTR_xcrypt_buffer_ctx(const struct AES_ctx* ctx, uint8_t* iv, uint8_t* buf, uint32_t length);
+
 #if defined(ECB) && (ECB == 1)
 
 void AES_ECB_encrypt(const uint8_t* input, const uint8_t* key, uint8_t *output, const uint32_t length);
 void AES_ECB_decrypt(const uint8_t* input, const uint8_t* key, uint8_t *output, const uint32_t length);
 
+// Encrypt/decrypt a single block with a prepared context.
+void AES_ECB_encrypt_ctx(const struct AES_ctx* ctx, const uint8_t* input, uint8_t *output);
+void AES_ECB_decrypt_ctx(const struct AES_ctx* ctx, const uint8_t* input, uint8_t *output);
+
 #endif // #if defined(ECB) && (ECB == !)
 
 
@@ -38,6 +74,9 @@ void AES_ECB_decrypt(const uint8_t* input, const uint8_t* key, uint8_t *output,
 void AES_CBC_encrypt_buffer(uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* key, const uint8_t* iv);
 void AES_CBC_decrypt_buffer(uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* key, const uint8_t* iv);
 
+void AES_CBC_encrypt_buffer_ctx(const struct AES_ctx* ctx, uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* iv);
+void AES_CBC_decrypt_buffer_ctx(const struct AES_ctx* ctx, uint8_t* output, uint8_t* input, uint32_t length, const uint8_t* iv);
+
 #endif // #if defined(CBC) && (CBC == 1)
 
 
@@ -26,7 +26,7 @@ uchar vec87[16] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x87
 };
 
-void generateSubkeys(uchar *key, uchar *K1, uchar *K2)
+void generateSubkeys(const AES_ctx *aes, uchar *K1, uchar *K2)
 {
     uchar L[16];
     uchar Z[16];
@@ -34,7 +34,7 @@ void generateSubkeys(uchar *key, uchar *K1, uchar *K2)
 
     memset(Z, 0, 16);
 
-    AES_ECB_encrypt(Z, key, L, 16);
+    AES_ECB_encrypt_ctx(aes, Z, L);
 
     if (!(L[0] & 0x80))
     {
@@ -76,15 +76,18 @@ void pad(uchar *in, uchar *out, int len)
     }
 }
 
-void AES_CMAC(uchar *key, uchar *input, int len, uchar *mac)
+void AES_CMAC_init_ctx(AES_CMAC_ctx *ctx, const uchar *key)
+{
+    AES_init_ctx(&ctx->aes, key);
+    generateSubkeys(&ctx->aes, ctx->K1, ctx->K2);
+}
+
+void AES_CMAC(const AES_CMAC_ctx *ctx, uchar *input, int len, uchar *mac)
 {
     bool len_is_multiple_of_block;
     uchar X[16], Y[16];
-    uchar K1[16], K2[16];
     uchar M_last[16], padded[16];
 
-    generateSubkeys(key, K1, K2);
-
     int num_blocks = (len+15)/16;
 
     if (!num_blocks)
@@ -99,12 +102,12 @@ void AES_CMAC(uchar *key, uchar *input, int len, uchar *mac)
 
     if (len_is_multiple_of_block)
     {
-        xorit(input+(16*(num_blocks-1)), K1, M_last, 16);
+        xorit(input+(16*(num_blocks-1)), (uchar*)ctx->K1, M_last, 16);
     }
     else
     {
         pad(input+(16*(num_blocks-1)), padded, len%16);
-        xorit(padded, K2, M_last, 16);
+        xorit(padded, (uchar*)ctx->K2, M_last, 16);
     }
 
     memset(X, 0, 16);
@@ -112,11 +115,18 @@ void AES_CMAC(uchar *key, uchar *input, int len, uchar *mac)
     for (int i=0; i<num_blocks-1; i++)
     {
         xorit(X, input+(16*i), Y, 16);
-        AES_ECB_encrypt(Y, key, X, 16);
+        AES_ECB_encrypt_ctx(&ctx->aes, Y, X);
     }
 
     xorit(X,M_last,Y, 16);
-    AES_ECB_encrypt(Y, key, X, 16);
+    AES_ECB_encrypt_ctx(&ctx->aes, Y, X);
 
     memcpy(mac, X, 16);
 }
+
+void AES_CMAC(uchar *key, uchar *input, int len, uchar *mac)
+{
+    AES_CMAC_ctx ctx;
+    AES_CMAC_init_ctx(&ctx, key);
+    AES_CMAC(&ctx, input, len, mac);
+}
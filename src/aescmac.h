@@ -18,8 +18,21 @@
 #ifndef _AESCMAC_H_
 #define _AESCMAC_H_
 
+#include"aes.h"
+
 typedef unsigned char uchar;
 
+// The expanded key and the K1/K2 subkeys of a cmac key.
+// Prepare it once per key, then a cmac only runs the data blocks.
+struct AES_CMAC_ctx
+{
+    AES_ctx aes;
+    uchar K1[16];
+    uchar K2[16];
+};
+
+void AES_CMAC_init_ctx(AES_CMAC_ctx *ctx, const uchar *key);
+void AES_CMAC (const AES_CMAC_ctx *ctx, uchar *input, int length, uchar *mac);
 void AES_CMAC (uchar *key, uchar *input, int length, uchar *mac);
 
 #endif //_AESCMAC_H_
@@ -166,7 +166,26 @@ void BusManager::openBusDeviceAndPotentiallySetLinkmodes(Configuration *config,
         debug("(main) added %s to files\n", detected->found_file.c_str());
         simulation_files_.insert(detected->specified_device.file);
     }
-    wmbus->onTelegram([&, simulated](AboutTelegram &about,vector<uchar> data){return meter_manager_->handleTelegram(about, data, simulated);});
+    TelegramMerger::Next next;
+    if (ingest_queue_size_ > 0)
+    {
+        IngestQueue *q = findIngestQueue(wmbus->hr());
+        next = [this, q, simulated](shared_ptr<ReceivedFrame> frame){return enqueueTelegram(q, frame, simulated);};
+    }
+    else
+    {
+        next = [&, simulated](shared_ptr<ReceivedFrame> frame){return meter_manager_->handleTelegram(frame, simulated);};
+    }
+    if (merger_)
+    {
+        shared_ptr<TelegramMerger::Next> n = make_shared<TelegramMerger::Next>(next);
+        TelegramMerger *m = merger_.get();
+        wmbus->onTelegram([m, n](shared_ptr<ReceivedFrame> frame){return m->add(frame, n);});
+    }
+    else
+    {
+        wmbus->onTelegram(next);
+    }
     wmbus->setTimeout(config->alarm_timeout, config->alarm_expected_activity);
 }
 
@@ -803,3 +822,294 @@ void BusManager::sendQueue()
     }
     bus_send_queue_.clear();
 }
+
+void BusManager::startIngestQueue(size_t size, IngestQueuePolicy policy)
+{
+    if (size == 0) return;
+
+    ingest_queue_size_ = size;
+    ingest_queue_policy_ = policy;
+    startIngestThread([this](){ ingestLoop(); });
+}
+
+void BusManager::stopIngestQueue()
+{
+    if (ingest_queue_size_ == 0) return;
+
+    pthread_mutex_lock(&ingest_mutex_);
+    ingest_stop_ = true;
+    pthread_cond_signal(&ingest_available_);
+    pthread_mutex_unlock(&ingest_mutex_);
+    pthread_join(getIngestThread(), NULL);
+}
+
+BusManager::IngestQueue *BusManager::findIngestQueue(string bus)
+{
+    pthread_mutex_lock(&ingest_mutex_);
+    IngestQueue *q = NULL;
+    for (auto &i : ingest_queues_)
+    {
+        if (i->bus == bus) q = i.get();
+    }
+    if (q == NULL)
+    {
+        ingest_queues_.push_back(unique_ptr<IngestQueue>(new IngestQueue()));
+        q = ingest_queues_.back().get();
+        q->bus = bus;
+    }
+    pthread_mutex_unlock(&ingest_mutex_);
+    return q;
+}
+
+bool BusManager::enqueueTelegram(IngestQueue *q, shared_ptr<ReceivedFrame> frame, bool simulated)
+{
+    pthread_mutex_lock(&ingest_mutex_);
+    bool queued = true;
+    if (q->frames.size() >= ingest_queue_size_)
+    {
+        if (q->dropped == 0)
+        {
+            warning("(bus) ingest queue for %s is full, dropping the %s telegrams!\n",
+                    q->bus.c_str(),
+                    ingest_queue_policy_ == IngestQueuePolicy::DropOldest ? "oldest" : "newest");
+        }
+        q->dropped++;
+        if (ingest_queue_policy_ == IngestQueuePolicy::DropOldest)
+        {
+            q->frames.pop_front();
+        }
+        else
+        {
+            queued = false;
+        }
+    }
+    if (queued)
+    {
+        q->frames.push_back({ frame, simulated });
+        q->enqueued++;
+        if (q->frames.size() > q->high_water_mark) q->high_water_mark = q->frames.size();
+        pthread_cond_signal(&ingest_available_);
+    }
+    pthread_mutex_unlock(&ingest_mutex_);
+    return queued;
+}
+
+void BusManager::ingestLoop()
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&ingest_mutex_);
+        IngestQueue *q = NULL;
+        for (;;)
+        {
+            // Take the telegrams from the bus devices in turn, so that a busy
+            // bus device cannot delay the telegrams from the other bus devices.
+            for (size_t i = 0; i < ingest_queues_.size() && q == NULL; ++i)
+            {
+                IngestQueue *c = ingest_queues_[(ingest_next_+i) % ingest_queues_.size()].get();
+                if (c->frames.size() > 0)
+                {
+                    q = c;
+                    ingest_next_ = (ingest_next_+i+1) % ingest_queues_.size();
+                }
+            }
+            if (q != NULL || ingest_stop_) break;
+            pthread_cond_wait(&ingest_available_, &ingest_mutex_);
+        }
+        if (q == NULL)
+        {
+            // Stop requested and all queued telegrams have been handed over.
+            pthread_mutex_unlock(&ingest_mutex_);
+            return;
+        }
+        pair<shared_ptr<ReceivedFrame>,bool> p = q->frames.front();
+        q->frames.pop_front();
+        pthread_mutex_unlock(&ingest_mutex_);
+
+        meter_manager_->handleTelegram(p.first, p.second);
+    }
+}
+
+string BusManager::ingestStatistics()
+{
+    string s;
+    pthread_mutex_lock(&ingest_mutex_);
+    for (auto &q : ingest_queues_)
+    {
+        if (s != "") s += " ";
+        s += tostrprintf("%s enqueued %zu dropped %zu high water mark %zu (of %zu)",
+                         q->bus.c_str(), q->enqueued, q->dropped, q->high_water_mark, ingest_queue_size_);
+    }
+    pthread_mutex_unlock(&ingest_mutex_);
+    return s;
+}
+
+void BusManager::startMergeStage(int window_ms)
+{
+    // Always set, the merge window might have been removed from the config before a reload.
+    setDuplicatesCheckedAfterMerge(window_ms > 0);
+    if (window_ms <= 0) return;
+
+    merger_ = unique_ptr<TelegramMerger>(new TelegramMerger(window_ms));
+    merger_->start();
+}
+
+void BusManager::stopMergeStage()
+{
+    setDuplicatesCheckedAfterMerge(false);
+    if (!merger_) return;
+
+    merger_->stop();
+}
+
+string BusManager::mergeStatistics()
+{
+    if (!merger_) return "";
+
+    return merger_->statistics();
+}
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+TelegramMerger::TelegramMerger(int window_ms) : window_ns_(((uint64_t)window_ms)*1000000)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&available_, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+TelegramMerger::~TelegramMerger()
+{
+    stop();
+    pthread_cond_destroy(&available_);
+}
+
+void TelegramMerger::start()
+{
+    started_ = true;
+    startMergeThread([this](){ mergeLoop(); });
+}
+
+void TelegramMerger::stop()
+{
+    if (!started_) return;
+    started_ = false;
+
+    pthread_mutex_lock(&mutex_);
+    stop_ = true;
+    pthread_cond_signal(&available_);
+    pthread_mutex_unlock(&mutex_);
+    pthread_join(getMergeThread(), NULL);
+}
+
+bool TelegramMerger::add(shared_ptr<ReceivedFrame> frame, const shared_ptr<Next> &next)
+{
+    uint64_t now = monotonicNs();
+    uint64_t hash = hash64(frame->bytes.data(), frame->bytes.size());
+
+    pthread_mutex_lock(&mutex_);
+    received_++;
+    // Only the telegrams received within the last few milliseconds are held,
+    // a linear search is faster than maintaining a hash table.
+    for (Pending &p : pending_)
+    {
+        if (p.hash == hash && p.best->bytes == frame->bytes)
+        {
+            if (frame->about.rssi_dbm > p.best->about.rssi_dbm)
+            {
+                p.best = frame;
+                p.next = next;
+            }
+            if (std::find(p.devices.begin(), p.devices.end(), frame->about.device) == p.devices.end())
+            {
+                p.devices.push_back(frame->about.device);
+            }
+            pthread_mutex_unlock(&mutex_);
+            return true;
+        }
+    }
+    pending_.push_back({ hash, now, frame, next, { frame->about.device } });
+    // The merge thread only has to wake up when the first window starts.
+    if (pending_.size() == 1) pthread_cond_signal(&available_);
+    pthread_mutex_unlock(&mutex_);
+    return true;
+}
+
+void TelegramMerger::mergeLoop()
+{
+    pthread_mutex_lock(&mutex_);
+    for (;;)
+    {
+        if (pending_.size() == 0)
+        {
+            if (stop_) break;
+            pthread_cond_wait(&available_, &mutex_);
+            continue;
+        }
+        uint64_t now = monotonicNs();
+        uint64_t end = pending_.front().first_ns + window_ns_;
+        if (!stop_ && now < end)
+        {
+            struct timespec ts;
+            ts.tv_sec = end / 1000000000;
+            ts.tv_nsec = end % 1000000000;
+            pthread_cond_timedwait(&available_, &mutex_, &ts);
+            continue;
+        }
+        Pending p = std::move(pending_.front());
+        pending_.pop_front();
+        uint64_t latency = now - p.first_ns;
+        forwarded_++;
+        if (p.devices.size() > 1) merged_++;
+        total_latency_ns_ += latency;
+        if (latency > max_latency_ns_) max_latency_ns_ = latency;
+        pthread_mutex_unlock(&mutex_);
+
+        forward(p, latency);
+
+        pthread_mutex_lock(&mutex_);
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+void TelegramMerger::forward(Pending &p, uint64_t latency_ns)
+{
+    shared_ptr<ReceivedFrame> frame = p.best;
+    if (p.devices.size() > 1)
+    {
+        // The frame is shared and never modified, the annotated copy is a new frame.
+        AboutTelegram about = p.best->about;
+        about.devices = about.device;
+        for (string &d : p.devices)
+        {
+            if (d != about.device) about.devices += ","+d;
+        }
+        frame = make_shared<ReceivedFrame>(about, p.best->bytes, p.best->received);
+    }
+    debug("(merge) telegram received by %zu devices, best %s rssi %d dBm, forwarded after %.1f ms\n",
+          p.devices.size(), frame->about.device.c_str(), frame->about.rssi_dbm, latency_ns/1000000.0);
+
+    if (isDuplicateTelegram(frame))
+    {
+        verbose("(wmbus) skipping already handled telegram.\n");
+        return;
+    }
+    (*p.next)(frame);
+}
+
+string TelegramMerger::statistics()
+{
+    pthread_mutex_lock(&mutex_);
+    double avg = forwarded_ > 0 ? total_latency_ns_/1000000.0/forwarded_ : 0;
+    string s = tostrprintf("received %zu forwarded %zu merged %zu added latency avg %.1f ms max %.1f ms (window %d ms)",
+                           received_, forwarded_, merged_, avg, max_latency_ns_/1000000.0, windowMs());
+    pthread_mutex_unlock(&mutex_);
+    return s;
+}
@@ -24,6 +24,7 @@
 #include"units.h"
 #include"wmbus.h"
 
+#include<deque>
 #include<memory>
 #include<set>
 #include<string>
@@ -33,6 +34,56 @@ enum class DetectionType { STDIN_FILE_SIMULATION, ALL };
 struct MeterManager;
 struct Configuration;
 
+// Holds the copies of a telegram received by several bus devices for a merge window,
+// then forwards only the copy with the best rssi, annotated with all receiving devices.
+// The window starts when the first copy is received, the added latency is measured.
+struct TelegramMerger
+{
+    // Where the forwarded copy goes, the ingest queue or the meter manager of its bus device.
+    typedef function<bool(shared_ptr<ReceivedFrame>)> Next;
+
+    TelegramMerger(int window_ms);
+    ~TelegramMerger();
+
+    // Start the merge thread.
+    void start();
+    // Forward the held telegrams without waiting for their windows, then stop the merge thread.
+    void stop();
+    // Hold the frame, or merge it with an already held copy of the same frame.
+    bool add(shared_ptr<ReceivedFrame> frame, const shared_ptr<Next> &next);
+
+    int windowMs() { return window_ns_/1000000; }
+    // The number of received copies and forwarded telegrams and the added latency.
+    string statistics();
+
+private:
+
+    struct Pending
+    {
+        uint64_t hash;
+        uint64_t first_ns; // When the first copy was received.
+        shared_ptr<ReceivedFrame> best;
+        shared_ptr<Next> next;
+        vector<string> devices; // In the order the copies were received.
+    };
+
+    void mergeLoop();
+    void forward(Pending &p, uint64_t latency_ns);
+
+    uint64_t window_ns_ {};
+    deque<Pending> pending_; // In the order received, ie ordered by the end of their windows.
+    bool started_ {};
+    bool stop_ {};
+    pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t available_; // Uses the monotonic clock for the timed waits.
+
+    size_t received_ {};
+    size_t forwarded_ {};
+    size_t merged_ {}; // Forwarded telegrams that were received by more than one bus device.
+    uint64_t total_latency_ns_ {};
+    uint64_t max_latency_ns_ {};
+};
+
 struct BusManager
 {
     BusManager(shared_ptr<SerialCommunicationManager> serial_manager,
@@ -52,6 +103,22 @@ struct BusManager
     WMBus *findBus(string bus_alias);
     void queueSendBusContent(const SendBusContent &sbc);
 
+    // Queue at most size received telegrams per bus device, the ingest thread
+    // then hands over the telegrams to the meter manager.
+    void startIngestQueue(size_t size, IngestQueuePolicy policy);
+    // Hand over the already queued telegrams, then stop the ingest thread.
+    void stopIngestQueue();
+    // The number of enqueued and dropped telegrams and the high water mark per bus device.
+    string ingestStatistics();
+
+    // Merge the copies of a telegram received by several bus devices within window_ms.
+    // Must be started before the bus devices are added.
+    void startMergeStage(int window_ms);
+    // Forward the held telegrams, then stop the merge thread.
+    void stopMergeStage();
+    // The number of merged telegrams and the added latency, empty if not merging.
+    string mergeStatistics();
+
 private:
 
     void remove_lost_serial_devices_from_ignore_list(vector<string> &devices);
@@ -99,6 +166,30 @@ private:
 
     // Set as true when the warning for no detected wmbus devices has been printed.
     bool printed_warning_ = false;
+
+    // The received telegrams from a bus device waiting for the ingest thread.
+    // The counters are kept when a bus device is lost and found again.
+    struct IngestQueue
+    {
+        string bus; // The bus device hr().
+        deque<pair<shared_ptr<ReceivedFrame>,bool>> frames; // The bool is true for simulated telegrams.
+        size_t enqueued {};
+        size_t dropped {};
+        size_t high_water_mark {};
+    };
+    IngestQueue *findIngestQueue(string bus);
+    bool enqueueTelegram(IngestQueue *q, shared_ptr<ReceivedFrame> frame, bool simulated);
+    void ingestLoop();
+
+    size_t ingest_queue_size_ {}; // Zero means that the telegrams are handled directly by the event loop thread.
+    IngestQueuePolicy ingest_queue_policy_ {};
+    vector<unique_ptr<IngestQueue>> ingest_queues_;
+    size_t ingest_next_ {}; // Round robin over the bus devices.
+    bool ingest_stop_ {};
+    pthread_mutex_t ingest_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t ingest_available_ = PTHREAD_COND_INITIALIZER;
+
+    unique_ptr<TelegramMerger> merger_; // Null unless the telegrams from the bus devices are merged.
 };
 
 shared_ptr<BusManager> createBusManager(shared_ptr<SerialCommunicationManager> serial_manager,
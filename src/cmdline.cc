@@ -157,6 +157,16 @@ static shared_ptr<Configuration> parseNormalCommandLine(Configuration *c, int ar
             continue;
         }
 
+        if (!strncmp(argv[i], "--analyzethreads=", 17) && strlen(argv[i]) > 17) {
+            string s = argv[i]+17;
+            if (!isNumber(s)) {
+                error("Not a valid number of analyze threads. \"%s\"\n", argv[i]+17);
+            }
+            c->analyze_threads = atoi(s.c_str());
+            i++;
+            continue;
+        }
+
         if (!strcmp(argv[i], "--debug")) {
             c->debug = true;
             i++;
@@ -417,9 +427,14 @@ static shared_ptr<Configuration> parseNormalCommandLine(Configuration *c, int ar
                 {
                     c->ignore_duplicate_telegrams = false;
                 }
+                else if (argv[i][18] == '=' && argv[i][19] != 0 && parseTime(argv[i]+19) > 0)
+                {
+                    c->ignore_duplicate_telegrams = true;
+                    c->ignore_duplicates_window = parseTime(argv[i]+19);
+                }
                 else
                 {
-                    error("You must specify true or false after --ignoreduplicates=\n");
+                    error("You must specify true, false or a time window like 30s after --ignoreduplicates=\n");
                 }
             }
             i++;
@@ -522,6 +537,100 @@ static shared_ptr<Configuration> parseNormalCommandLine(Configuration *c, int ar
             i++;
             continue;
         }
+        if (!strncmp(argv[i], "--maxmeters=", 12) && strlen(argv[i]) > 12) {
+            string s = argv[i]+12;
+            if (!isNumber(s) || atoi(s.c_str()) <= 0) {
+                error("Not a valid max number of meters. \"%s\"\n", argv[i]+12);
+            }
+            c->maxmeters = atoi(s.c_str());
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--meteridletimeout=", 19) && strlen(argv[i]) > 19) {
+            c->meteridletimeout = parseTime(argv[i]+19);
+            if (c->meteridletimeout <= 0) {
+                error("Not a valid meter idle timeout. \"%s\"\n", argv[i]+19);
+            }
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--ignoredmeters=", 16) && strlen(argv[i]) > 16) {
+            string s = argv[i]+16;
+            if (!isNumber(s)) {
+                error("Not a valid number of ignored meters. \"%s\"\n", argv[i]+16);
+            }
+            c->ignoredmeters = atoi(s.c_str());
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--ignoredmetersttl=", 19) && strlen(argv[i]) > 19) {
+            c->ignoredmeters_ttl = parseTime(argv[i]+19);
+            if (c->ignoredmeters_ttl <= 0) {
+                error("Not a valid ignored meters ttl. \"%s\"\n", argv[i]+19);
+            }
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--decodethreads=", 16) && strlen(argv[i]) > 16) {
+            string s = argv[i]+16;
+            if (!isNumber(s)) {
+                error("Not a valid number of decode threads. \"%s\"\n", argv[i]+16);
+            }
+            c->decodethreads = atoi(s.c_str());
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--decodequeue=", 14) && strlen(argv[i]) > 14) {
+            string s = argv[i]+14;
+            if (!isNumber(s)) {
+                error("Not a valid decode queue size. \"%s\"\n", argv[i]+14);
+            }
+            c->decodequeue = atoi(s.c_str());
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--formatcache=", 14)) {
+            if (strlen(argv[i]) == 14) {
+                error("Not a valid format cache file name.\n");
+            }
+            c->formatcache = argv[i]+14;
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--ingestqueue=", 14) && strlen(argv[i]) > 14) {
+            string s = argv[i]+14;
+            if (!isNumber(s)) {
+                error("Not a valid ingest queue size. \"%s\"\n", argv[i]+14);
+            }
+            c->ingestqueue = atoi(s.c_str());
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--mergewindow=", 14) && strlen(argv[i]) > 14) {
+            string s = argv[i]+14;
+            if (!isNumber(s)) {
+                error("Not a valid merge window. \"%s\"\n", argv[i]+14);
+            }
+            c->mergewindow = atoi(s.c_str());
+            i++;
+            continue;
+        }
+        if (!strncmp(argv[i], "--ingestqueuepolicy=", 20)) {
+            if (!strcmp(argv[i]+20, "dropoldest"))
+            {
+                c->ingestqueue_policy = IngestQueuePolicy::DropOldest;
+            }
+            else if (!strcmp(argv[i]+20, "dropnewest"))
+            {
+                c->ingestqueue_policy = IngestQueuePolicy::DropNewest;
+            }
+            else
+            {
+                error("No such ingest queue policy %s\n", argv[i]+20);
+            }
+            i++;
+            continue;
+        }
         if (!strncmp(argv[i], "--alarmtimeout=", 15)) {
             c->alarm_timeout = parseTime(argv[i]+15);
             if (c->alarm_timeout <= 0) {
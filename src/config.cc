@@ -248,8 +248,13 @@ void handleIgnoreDuplicateTelegrams(Configuration *c, string value)
     {
         c->ignore_duplicate_telegrams = false;
     }
+    else if (value != "" && parseTime(value) > 0)
+    {
+        c->ignore_duplicate_telegrams = true;
+        c->ignore_duplicates_window = parseTime(value);
+    }
     else {
-        warning("ignoreduplicates should be either true or false, not \"%s\"\n", value.c_str());
+        warning("ignoreduplicates should be either true, false or a time window like 30s, not \"%s\"\n", value.c_str());
     }
 }
 
@@ -522,6 +527,132 @@ void handleFormat(Configuration *c, string format)
     }
 }
 
+void handleMaxMeters(Configuration *c, string s)
+{
+    if (isNumber(s) && atoi(s.c_str()) > 0)
+    {
+        c->maxmeters = atoi(s.c_str());
+    }
+    else
+    {
+        warning("Max meters must be a positive number, not \"%s\"\n", s.c_str());
+    }
+}
+
+void handleMeterIdleTimeout(Configuration *c, string s)
+{
+    int timeout = s != "" ? parseTime(s) : 0;
+    if (timeout > 0)
+    {
+        c->meteridletimeout = timeout;
+    }
+    else
+    {
+        warning("Meter idle timeout must be a time like 3600s or 24h, not \"%s\"\n", s.c_str());
+    }
+}
+
+void handleIgnoredMeters(Configuration *c, string s)
+{
+    if (isNumber(s))
+    {
+        c->ignoredmeters = atoi(s.c_str());
+    }
+    else
+    {
+        warning("Ignored meters must be a number, not \"%s\"\n", s.c_str());
+    }
+}
+
+void handleIgnoredMetersTTL(Configuration *c, string s)
+{
+    int ttl = s != "" ? parseTime(s) : 0;
+    if (ttl > 0)
+    {
+        c->ignoredmeters_ttl = ttl;
+    }
+    else
+    {
+        warning("Ignored meters ttl must be a time like 3600s or 1h, not \"%s\"\n", s.c_str());
+    }
+}
+
+void handleDecodeThreads(Configuration *c, string s)
+{
+    if (isNumber(s))
+    {
+        c->decodethreads = atoi(s.c_str());
+    }
+    else
+    {
+        warning("Decode threads must be a number, not \"%s\"\n", s.c_str());
+    }
+}
+
+void handleDecodeQueue(Configuration *c, string s)
+{
+    if (isNumber(s))
+    {
+        c->decodequeue = atoi(s.c_str());
+    }
+    else
+    {
+        warning("Decode queue size must be a number, not \"%s\"\n", s.c_str());
+    }
+}
+
+void handleFormatCache(Configuration *c, string s)
+{
+    if (s.length() > 0)
+    {
+        c->formatcache = s;
+    }
+    else
+    {
+        warning("Format cache must be a file name.\n");
+    }
+}
+
+void handleIngestQueue(Configuration *c, string s)
+{
+    if (isNumber(s))
+    {
+        c->ingestqueue = atoi(s.c_str());
+    }
+    else
+    {
+        warning("Ingest queue size must be a number, not \"%s\"\n", s.c_str());
+    }
+}
+
+void handleMergeWindow(Configuration *c, string s)
+{
+    if (isNumber(s))
+    {
+        c->mergewindow = atoi(s.c_str());
+    }
+    else
+    {
+        warning("Merge window must be a number of milliseconds, not \"%s\"\n", s.c_str());
+    }
+}
+
+void handleIngestQueuePolicy(Configuration *c, string s)
+{
+    if (s == "dropoldest")
+    {
+        c->ingestqueue_policy = IngestQueuePolicy::DropOldest;
+    }
+    else if (s == "dropnewest")
+    {
+        c->ingestqueue_policy = IngestQueuePolicy::DropNewest;
+    }
+    else
+    {
+        warning("No such ingest queue policy \"%s\"\n", s.c_str());
+    }
+}
+
 void handleAlarmTimeout(Configuration *c, string s)
 {
     if (s.length() >= 1)
@@ -694,6 +825,16 @@ shared_ptr<Configuration> loadConfiguration(string root, ConfigOverrides overrid
         else if (p.first == "selectfields") handleSelectedFields(c, p.second);
         else if (p.first == "shell") handleShell(c, p.second);
         else if (p.first == "resetafter") handleResetAfter(c, p.second);
+        else if (p.first == "maxmeters") handleMaxMeters(c, p.second);
+        else if (p.first == "meteridletimeout") handleMeterIdleTimeout(c, p.second);
+        else if (p.first == "ignoredmeters") handleIgnoredMeters(c, p.second);
+        else if (p.first == "ignoredmetersttl") handleIgnoredMetersTTL(c, p.second);
+        else if (p.first == "decodethreads") handleDecodeThreads(c, p.second);
+        else if (p.first == "decodequeue") handleDecodeQueue(c, p.second);
+        else if (p.first == "formatcache") handleFormatCache(c, p.second);
+        else if (p.first == "ingestqueue") handleIngestQueue(c, p.second);
+        else if (p.first == "ingestqueuepolicy") handleIngestQueuePolicy(c, p.second);
+        else if (p.first == "mergewindow") handleMergeWindow(c, p.second);
         else if (p.first == "alarmshell") handleAlarmShell(c, p.second);
         else if (startsWith(p.first, "json_") ||
                  startsWith(p.first, "field_"))
@@ -42,6 +42,11 @@ enum class MeterFileTimestamp
     Never, Day, Hour, Minute, Micros
 };
 
+enum class IngestQueuePolicy
+{
+    DropOldest, DropNewest
+};
+
 // These values can be overridden from the command line.
 struct ConfigOverrides
 {
@@ -73,6 +78,7 @@ struct Configuration
     string analyze_driver {};
     string analyze_key {};
     bool analyze_verbose {};
+    int analyze_threads {}; // Number of threads trying the drivers, 0 means one per cpu.
     bool debug {};
     bool trace {};
     AddLogTimestamps addtimestamps {};
@@ -87,6 +93,7 @@ struct Configuration
     bool use_logfile {};
     bool use_stderr_for_log = true; // Default is to use stderr for logging.
     bool ignore_duplicate_telegrams = true; // Default is to ignore duplicates.
+    int ignore_duplicates_window = 10; // Seconds to remember a received telegram.
     std::string logfile;
     bool json {};
     bool fields {};
@@ -107,6 +114,16 @@ struct Configuration
     int  exitafter {}; // Seconds to exit.
     bool nodeviceexit {}; // If no wmbus receiver device is found, then exit immediately!
     int  resetafter {}; // Reset the wmbus devices regularly.
+    int  maxmeters {}; // Max number of meters created from templates, 0 means no limit.
+    int  meteridletimeout {}; // Remove meters created from templates not updated for this many seconds, 0 means never.
+    int  ignoredmeters = 10000; // Max number of remembered meters that nobody listens to, 0 means do not remember them.
+    int  ignoredmeters_ttl = 3600; // Seconds to remember a meter that nobody listens to.
+    int  decodethreads {}; // Number of threads decoding telegrams, 0 means decode in the event loop thread.
+    int  decodequeue = 1000; // Max number of telegrams queued per decode thread, 0 means unbounded.
+    int  ingestqueue {}; // Max number of received telegrams queued per bus device, 0 means no queue.
+    IngestQueuePolicy ingestqueue_policy {}; // Which telegram to drop when the queue is full.
+    int  mergewindow {}; // Milliseconds to hold a telegram to merge the copies from several bus devices, 0 means no merging.
+    std::string formatcache; // Remember the formats for compact frames in this file, empty means do not store them.
     std::vector<SpecifiedDevice> supplied_bus_devices; // /dev/ttyUSB0, simulation.txt, rtlwmbus, /dev/ttyUSB1:9600 /dev/ttyUSB2:mbus
     int num_wmbus_devices {};
     int num_mbus_devices {};
@@ -16,10 +16,14 @@
 */
 
 #include"dvparser.h"
+#include"threads.h"
 #include"util.h"
 
+#include<algorithm>
 #include<assert.h>
+#include<deque>
 #include<memory.h>
+#include<stdio.h>
 
 // The parser should not crash on invalid data, but yeah, when I
 // need to debug it because it crashes on invalid data, then
@@ -63,34 +67,331 @@ LIST_OF_VALUETYPES
     return ValueInformation::None;
 }
 
-map<uint16_t,string> hash_to_format_;
+DVEntry::DVEntry(MeasurementType mt, int vi, int st, int ta, int su, string &val) :
+    type(mt), value_information(vi), storagenr(st), tariff(ta), subunit(su)
+{
+    vector<uchar> bytes;
+    hex2bin(val, &bytes);
+    setValue(bytes.size() > 0 ? &bytes[0] : NULL, bytes.size());
+}
+
+void DVEntry::setValue(const uchar *data, size_t len)
+{
+    value_len_ = len;
+    if (len <= sizeof(short_value_))
+    {
+        if (len > 0) memcpy(short_value_, data, len);
+        return;
+    }
+    long_value_.assign(data, data+len);
+}
+
+string DVEntry::valueHex() const
+{
+    const uchar *v = value();
+    string hex;
+    hex.reserve(value_len_*2);
+    for (int i = 0; i < value_len_; ++i)
+    {
+        char c[3];
+        snprintf(c, 3, "%02X", v[i]);
+        hex.append(c, 2);
+    }
+    return hex;
+}
+
+bool DVKey::parse(const string &key)
+{
+    code = 0;
+    len = 0;
+    index = 1;
+    rest.clear();
+
+    size_t i = 0;
+    for (; i+1 < key.length() && key[i] != '_'; i += 2)
+    {
+        int hi = char2int(key[i]);
+        int lo = char2int(key[i+1]);
+        if (hi < 0 || lo < 0) return false;
+        uchar b = hi*16+lo;
+        if (len < 8) code |= ((uint64_t)b) << (56-8*len);
+        else rest.push_back(b);
+        len++;
+    }
+    if (i < key.length())
+    {
+        if (key[i] != '_') return false;
+        index = atoi(key.c_str()+i+1);
+    }
+    return len > 0;
+}
+
+string DVKey::str() const
+{
+    string s;
+    for (int i = 0; i < len; ++i)
+    {
+        char hex[3];
+        snprintf(hex, 3, "%02X", byte(i));
+        s.append(hex, 2);
+    }
+    if (index > 1)
+    {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "_%d", index);
+        s.append(suffix);
+    }
+    return s;
+}
+
+static bool sameDifVifBytes(const DVKey &a, const DVKey &b)
+{
+    return a.code == b.code && a.len == b.len && a.rest == b.rest;
+}
+
+// Compare the keys in the same order as their strings compare.
+static int compareKeys(const DVKey &a, const DVKey &b)
+{
+    int n = min(a.len, b.len);
+    for (int i = 0; i < n; ++i)
+    {
+        uchar ba = a.byte(i);
+        uchar bb = b.byte(i);
+        if (ba != bb) return ba < bb ? -1 : 1;
+    }
+    if (a.len == b.len)
+    {
+        if (a.index == b.index) return 0;
+        if (a.index == 1) return -1;
+        if (b.index == 1) return 1;
+        char sa[16], sb[16];
+        snprintf(sa, sizeof(sa), "%d", a.index);
+        snprintf(sb, sizeof(sb), "%d", b.index);
+        return strcmp(sa, sb) < 0 ? -1 : 1;
+    }
+    // One key is a prefix of the other. The shorter key sorts first,
+    // unless it has a suffix, since _ sorts after the hex digits.
+    const DVKey &shorter = a.len < b.len ? a : b;
+    int r = shorter.index == 1 ? -1 : 1;
+    return a.len < b.len ? r : -r;
+}
+
+// Same as extractDV on the key bytes: the dif, skip any difes, then the vif.
+static void difVifOfKey(const DVKey &key, uchar *dif, uchar *vif)
+{
+    *dif = key.byte(0);
+    *vif = 0;
+    int i = 1;
+    bool has_another_dife = (*dif & 0x80) == 0x80;
+    while (has_another_dife)
+    {
+        if (i >= key.len) return;
+        has_another_dife = (key.byte(i) & 0x80) == 0x80;
+        i++;
+    }
+    if (i < key.len) *vif = key.byte(i);
+}
+
+int DVEntries::lookup(const DVKey &key)
+{
+    size_t lo = 0, hi = sorted_.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo+hi)/2;
+        int c = compareKeys(entries_[sorted_[mid]].key, key);
+        if (c == 0) return sorted_[mid];
+        if (c < 0) lo = mid+1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+void DVEntries::insert(Entry &&e)
+{
+    size_t lo = 0, hi = sorted_.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo+hi)/2;
+        if (compareKeys(entries_[sorted_[mid]].key, e.key) < 0) lo = mid+1;
+        else hi = mid;
+    }
+    difVifOfKey(e.key, &e.dif, &e.vif);
+    sorted_.insert(sorted_.begin()+lo, entries_.size());
+    entries_.push_back(std::move(e));
+}
+
+void DVEntries::add(const vector<uchar> &difvif, int offset, const DVEntry &dve)
+{
+    Entry e;
+    for (uchar b : difvif)
+    {
+        if (e.key.len < 8) e.key.code |= ((uint64_t)b) << (56-8*e.key.len);
+        else e.key.rest.push_back(b);
+        e.key.len++;
+    }
+    for (Entry &o : entries_)
+    {
+        if (sameDifVifBytes(o.key, e.key)) e.key.index++;
+    }
+    e.value = { offset, dve };
+    insert(std::move(e));
+}
+
+void DVEntries::set(const string &key, int offset, const DVEntry &dve)
+{
+    Entry e;
+    if (!e.key.parse(key))
+    {
+        warning("(dvparser) cannot set value for invalid key \"%s\"\n", key.c_str());
+        return;
+    }
+    int i = lookup(e.key);
+    if (i >= 0)
+    {
+        entries_[i].value = { offset, dve };
+        return;
+    }
+    e.value = { offset, dve };
+    insert(std::move(e));
+}
+
+void DVEntries::layout(vector<DVKey> *keys)
+{
+    keys->clear();
+    for (uint16_t i : sorted_) keys->push_back(entries_[i].key);
+}
+
+bool DVEntries::hasLayout(const vector<DVKey> &keys)
+{
+    if (keys.size() != sorted_.size()) return false;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (!(entries_[sorted_[i]].key == keys[i])) return false;
+    }
+    return true;
+}
+
+pair<int,DVEntry> *DVEntries::find(const string &key, uchar *dif, uchar *vif)
+{
+    DVKey k;
+    if (!k.parse(key)) return NULL;
+    int i = lookup(k);
+    if (i < 0) return NULL;
+    if (dif) *dif = entries_[i].dif;
+    if (vif) *vif = entries_[i].vif;
+    return &entries_[i].value;
+}
+
+// The formats of the full frames seen, keyed by their format signature. Used to decode
+// compact frames. At most MAX_REMEMBERED_FORMATS are remembered, the oldest is forgotten first.
+#define MAX_REMEMBERED_FORMATS 1024
+map<uint16_t,vector<uchar>> hash_to_format_;
+deque<uint16_t> hash_to_format_order_;
+RecursiveMutex hash_to_format_mutex_ = { "hash_to_format_mutex" };
+#define LOCK_HASH_TO_FORMAT(where) WITH(hash_to_format_mutex_, hash_to_format_mutex, where)
 
 bool loadFormatBytesFromSignature(uint16_t format_signature, vector<uchar> *format_bytes)
 {
-    if (hash_to_format_.count(format_signature) > 0) {
+    LOCK_HASH_TO_FORMAT(load_format_bytes_from_signature);
+    auto i = hash_to_format_.find(format_signature);
+    if (i != hash_to_format_.end()) {
         debug("(dvparser) found remembered format for hash %x\n", format_signature);
         // Return the proper hash!
-        hex2bin(hash_to_format_[format_signature], format_bytes);
+        *format_bytes = i->second;
         return true;
     }
     // Unknown format signature.
     return false;
 }
 
+// Must be called with the hash to format lock taken.
+static void rememberFormat(uint16_t hash, const vector<uchar> &format_bytes)
+{
+    if (hash_to_format_.count(hash) > 0) return;
+    while (hash_to_format_order_.size() >= MAX_REMEMBERED_FORMATS)
+    {
+        hash_to_format_.erase(hash_to_format_order_.front());
+        hash_to_format_order_.pop_front();
+    }
+    hash_to_format_[hash] = format_bytes;
+    hash_to_format_order_.push_back(hash);
+}
+
+bool loadFormatSignatures(string file)
+{
+    vector<string> lines;
+    if (loadFile(file, &lines) < 0)
+    {
+        // No formats remembered yet.
+        debug("(dvparser) no format signatures file \"%s\"\n", file.c_str());
+        return false;
+    }
+
+    int n = 0;
+    LOCK_HASH_TO_FORMAT(load_format_signatures);
+    for (string &line : lines)
+    {
+        if (line == "" || line[0] == '#') continue;
+        // Each line is the hash followed by the format bytes: 7c8d 02FF2004134413615B6167
+        vector<uchar> format_bytes;
+        unsigned int hash = 0;
+        char hex[1024];
+        if (sscanf(line.c_str(), "%x %1023s", &hash, hex) == 2 &&
+            hex2bin(hex, &format_bytes) &&
+            format_bytes.size() > 0 &&
+            hash == crc16_EN13757(format_bytes.data(), format_bytes.size()))
+        {
+            rememberFormat(hash, format_bytes);
+            n++;
+        }
+        else
+        {
+            warning("(dvparser) ignoring bad line in format signatures file \"%s\": %s\n", file.c_str(), line.c_str());
+        }
+    }
+    verbose("(dvparser) loaded %d format signatures from \"%s\"\n", n, file.c_str());
+    return true;
+}
+
+bool saveFormatSignatures(string file)
+{
+    // Write a new file and rename it, so that a crash cannot leave a half written file.
+    string tmp = file+".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (f == NULL)
+    {
+        warning("(dvparser) could not store format signatures in \"%s\"\n", file.c_str());
+        return false;
+    }
+    fprintf(f, "# Formats of full frames, used to decode compact frames.\n");
+    {
+        LOCK_HASH_TO_FORMAT(save_format_signatures);
+        for (uint16_t hash : hash_to_format_order_)
+        {
+            fprintf(f, "%04x %s\n", hash, bin2hex(hash_to_format_[hash]).c_str());
+        }
+    }
+    bool ok = fclose(f) == 0;
+    if (!ok || rename(tmp.c_str(), file.c_str()) != 0)
+    {
+        warning("(dvparser) could not store format signatures in \"%s\"\n", file.c_str());
+        return false;
+    }
+    verbose("(dvparser) stored format signatures in \"%s\"\n", file.c_str());
+    return true;
+}
+
 bool parseDV(Telegram *t,
              vector<uchar> &databytes,
              vector<uchar>::iterator data,
              size_t data_len,
-             map<string,pair<int,DVEntry>> *values,
+             DVEntries *values,
              vector<uchar>::iterator *format,
              size_t format_len,
              uint16_t *format_hash)
 {
-    map<string,int> dv_count;
-    vector<uchar> format_bytes;
-    vector<uchar> id_bytes;
-    vector<uchar> data_bytes;
-    string dv, key;
+    vector<uchar> &format_bytes = t->dv_format_bytes;
+    vector<uchar> &id_bytes = t->dv_id_bytes;
     size_t start_parse_here = t->parsed.size();
     vector<uchar>::iterator data_start = data;
     vector<uchar>::iterator data_end = data+data_len;
@@ -131,7 +432,7 @@ bool parseDV(Telegram *t,
 
     // A Dif(Difes)Vif(Vifes) identifier can be for example be the 02FF20 for the Multical21
     // vendor specific status bits. The parser then uses this identifier as a key to store the
-    // data bytes in a map. The same identifier could occur several times in a telegram,
+    // data bytes in the values table. The same identifier could occur several times in a telegram,
     // even though it often don't. Since the first occurence is stored under 02FF20,
     // the second identical identifier stores its data under the key "02FF20_2" etc for 3 and forth...
     // A proper meter would use storagenr etc to differentiate between different measurements of
@@ -148,7 +449,7 @@ bool parseDV(Telegram *t,
 
         MeasurementType mt = difMeasurementType(dif);
         int datalen = difLenBytes(dif);
-        DEBUG_PARSER("(dvparser debug) dif=%02x datalen=%d \"%s\" type=%s\n", dif, datalen, difType(dif).c_str(),
+        DEBUG_PARSER("(dvparser debug) dif=%02x datalen=%d \"%s\" type=%s\n", dif, datalen, difType(dif),
                      measurementTypeName(mt).c_str());
         if (datalen == -2)
         {
@@ -156,9 +457,9 @@ bool parseDV(Telegram *t,
             {
                 DEBUG_PARSER("(dvparser) reached manufacturer specific data 0f, parsing is done.\n");
                 datalen = std::distance(data,data_end);
-                string value = bin2hex(data+1, data_end, datalen-1);
                 t->mfct_0f_index = 1+std::distance(data_start, data);
                 assert(t->mfct_0f_index >= 0);
+                string value = t->explaining() ? bin2hex(data+1, data_end, datalen-1) : "";
                 t->addExplanationAndIncrementPos(data, datalen, KindOfData::PROTOCOL, Understanding::NONE, "%02X manufacturer specific data %s", dif, value.c_str());
                 break;
             }
@@ -178,7 +479,8 @@ bool parseDV(Telegram *t,
         if (data_has_difvifs) {
             format_bytes.push_back(dif);
             id_bytes.push_back(dif);
-            t->addExplanationAndIncrementPos(*format, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02X dif (%s)", dif, difType(dif).c_str());
+            t->addExplanationAndIncrementPos(*format, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02X dif (%s)", dif,
+                                             t->explaining() ? difType(dif) : "");
         } else {
             id_bytes.push_back(**format);
             (*format)++;
@@ -223,12 +525,12 @@ bool parseDV(Telegram *t,
         if (*format == format_end) { debug("(dvparser) warning: unexpected end of data (vif expected)\n"); break; }
 
         uchar vif = **format;
-        DEBUG_PARSER("(dvparser debug) vif=%02x \"%s\"\n", vif, vifType(vif).c_str());
+        DEBUG_PARSER("(dvparser debug) vif=%02x \"%s\"\n", vif, vifType(vif));
         if (data_has_difvifs) {
             format_bytes.push_back(vif);
             id_bytes.push_back(vif);
             t->addExplanationAndIncrementPos(*format, 1, KindOfData::PROTOCOL, Understanding::FULL,
-                                             "%02X vif (%s)", vif, vifType(vif).c_str());
+                                             "%02X vif (%s)", vif, t->explaining() ? vifType(vif) : "");
         } else {
             id_bytes.push_back(**format);
             (*format)++;
@@ -263,7 +565,8 @@ bool parseDV(Telegram *t,
                 format_bytes.push_back(vife);
                 id_bytes.push_back(vife);
                 t->addExplanationAndIncrementPos(*format, 1, KindOfData::PROTOCOL, Understanding::FULL,
-                                                 "%02X vife (%s)", vife, vifeType(dif, vif, vife).c_str());
+                                                 "%02X vife (%s)", vife,
+                                                 t->explaining() ? vifeType(dif, vif, vife).c_str() : "");
             } else {
                 id_bytes.push_back(**format);
                 (*format)++;
@@ -271,22 +574,7 @@ bool parseDV(Telegram *t,
             has_another_vife = (vife & 0x80) == 0x80;
         }
 
-        dv = "";
-        for (uchar c : id_bytes) {
-            char hex[3];
-            hex[2] = 0;
-            snprintf(hex, 3, "%02X", c);
-            dv.append(hex);
-        }
-        DEBUG_PARSER("(dvparser debug) key \"%s\"\n", dv.c_str());
-
-        int count = ++dv_count[dv];
-        if (count > 1) {
-            strprintf(key, "%s_%d", dv.c_str(), count);
-        } else {
-            strprintf(key, "%s", dv.c_str());
-        }
-        DEBUG_PARSER("(dvparser debug) DifVif key is %s\n", key.c_str());
+        DEBUG_PARSER("(dvparser debug) key \"%s\"\n", bin2hex(id_bytes).c_str());
 
         int remaining = std::distance(data, data_end);
         if (variable_length) {
@@ -303,10 +591,12 @@ bool parseDV(Telegram *t,
         if (variable_length) {
             t->addExplanationAndIncrementPos(data, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02X varlen=%d", *(data+0), datalen);
         }
-        string value = bin2hex(data, data_end, datalen);
+        int value_len = max(0, min(datalen, (int)std::distance(data, data_end)));
         int offset = start_parse_here+data-data_start;
-        (*values)[key] = { offset, DVEntry(mt, vif&0x7f, storage_nr, tariff, subunit, value) };
-        if (value.length() > 0) {
+        values->add(id_bytes, offset, DVEntry(mt, vif&0x7f, storage_nr, tariff, subunit,
+                                              value_len > 0 ? &*data : NULL, value_len));
+        if (value_len > 0) {
+            string value = t->explaining() ? bin2hex(data, data_end, datalen) : "";
             // This call increments data with datalen.
             t->addExplanationAndIncrementPos(data, datalen, KindOfData::CONTENT, Understanding::NONE, "%s", value.c_str());
             DEBUG_PARSER("(dvparser debug) data \"%s\"\n\n", value.c_str());
@@ -317,15 +607,16 @@ bool parseDV(Telegram *t,
         }
     }
 
-    string format_string = bin2hex(format_bytes);
-    uint16_t hash = crc16_EN13757(&format_bytes[0], format_bytes.size());
+    uint16_t hash = crc16_EN13757(format_bytes.data(), format_bytes.size());
 
     if (data_has_difvifs) {
+        LOCK_HASH_TO_FORMAT(parse_dv);
         if (hash_to_format_.count(hash) == 0) {
-            hash_to_format_[hash] = format_string;
-            debug("(dvparser) found new format \"%s\" with hash %x, remembering!\n", format_string.c_str(), hash);
+            rememberFormat(hash, format_bytes);
+            debug("(dvparser) found new format \"%s\" with hash %x, remembering!\n", bin2hex(format_bytes).c_str(), hash);
         }
     }
+    if (format_hash) *format_hash = data_has_difvifs ? hash : t->format_signature;
 
     return true;
 }
@@ -372,32 +663,33 @@ bool isVIFMatch(int vi, ValueInformation vif)
     return matchSingleVif(vi, vif);
 }
 
-bool hasKey(std::map<std::string,std::pair<int,DVEntry>> *values, std::string key)
+bool hasKey(DVEntries *values, std::string key)
 {
-    return values->count(key) > 0;
+    return values->has(key);
 }
 
 bool findKey(MeasurementType mit, ValueInformation vif, int storagenr, int tariffnr,
-             std::string *key, std::map<std::string,std::pair<int,DVEntry>> *values)
+             std::string *key, DVEntries *values)
 {
     return findKeyWithNr(mit, vif, storagenr, tariffnr, 1, key, values);
 }
 
 bool findKeyWithNr(MeasurementType mit, ValueInformation vif, int storagenr, int tariffnr, int nr,
-                   std::string *key, std::map<std::string,std::pair<int,DVEntry>> *values)
+                   std::string *key, DVEntries *values)
 {
     /*debug("(dvparser) looking for type=%s vif=%s storagenr=%d value_ran_low=%02x value_ran_hi=%02x\n",
           measurementTypeName(mit).c_str(), toString(vif), storagenr,
           low, hi);*/
 
-    for (auto& v : *values)
+    for (size_t i = 0; i < values->size(); ++i)
     {
-        MeasurementType ty = v.second.second.type;
-        int vi = v.second.second.value_information;
-        int sn = v.second.second.storagenr;
-        int tn = v.second.second.tariff;
+        DVEntry &dve = values->at(i).second;
+        MeasurementType ty = dve.type;
+        int vi = dve.value_information;
+        int sn = dve.storagenr;
+        int tn = dve.tariff;
         /*debug("(dvparser) match? %s type=%s vif=%02x (%s) and storagenr=%d\n",
-              v.first.c_str(),
+              values->keyAt(i).c_str(),
               measurementTypeName(ty).c_str(), vi, toString(toValueInformation(vi)), storagenr, sn);*/
 
         if (isVIFMatch(vi, vif) &&
@@ -405,11 +697,14 @@ bool findKeyWithNr(MeasurementType mit, ValueInformation vif, int storagenr, int
             (storagenr == ANY_STORAGENR || storagenr == sn) &&
             (tariffnr == ANY_TARIFFNR || tariffnr == tn))
         {
-            *key = v.first;
             nr--;
-            if (nr <= 0) return true;
+            if (nr <= 0)
+            {
+                *key = values->keyAt(i);
+                return true;
+            }
             /*debug("(dvparser) found key %s for type=%s vif=%02x (%s) storagenr=%d\n",
-                  v.first.c_str(), measurementTypeName(ty).c_str(),
+                  values->keyAt(i).c_str(), measurementTypeName(ty).c_str(),
                   vi, toString(toValueInformation(vi)), storagenr);*/
         }
     }
@@ -437,118 +732,145 @@ void extractDV(string &s, uchar *dif, uchar *vif)
     *vif = bytes[i];
 }
 
-bool extractDVuint8(map<string,pair<int,DVEntry>> *values,
+// Read an unsigned little endian integer from the first len bytes of the value.
+static uint64_t valueAsUnsigned(const DVEntry &e, int len)
+{
+    const uchar *v = e.value();
+    uint64_t raw = 0;
+    for (int i = min(len, e.valueLength())-1; i >= 0; --i)
+    {
+        raw = (raw << 8) | v[i];
+    }
+    return raw;
+}
+
+// The bcd digits used to be read from the hex string of the value. An (invalid)
+// digit A-F therefore counts as its ascii distance from '0', keep it that way.
+static int bcdDigit(uchar nibble)
+{
+    return nibble < 10 ? nibble : nibble+7;
+}
+
+// 74140000 -> 00001474 If negate is set, then the top nibble (F) of
+// the most significant byte is the sign and not a digit.
+static uint64_t valueAsBCD(const DVEntry &e, bool negate)
+{
+    const uchar *v = e.value();
+    int len = e.valueLength();
+    uint64_t raw = 0;
+    for (int i = len-1; i >= 0; --i)
+    {
+        uchar b = v[i];
+        if (negate && i == len-1) b &= 0x0f;
+        raw = raw*100 + bcdDigit(b >> 4)*10 + bcdDigit(b & 0x0f);
+    }
+    return raw;
+}
+
+bool extractDVuint8(DVEntries *values,
                     string key,
                     int *offset,
                     uchar *value)
 {
-    if ((*values).count(key) == 0) {
+    uchar dif, vif;
+    pair<int,DVEntry> *found = values->find(key, &dif, &vif);
+    if (found == NULL) {
         verbose("(dvparser) warning: cannot extract uint8 from non-existant key \"%s\"\n", key.c_str());
         *offset = -1;
         *value = 0;
         return false;
     }
-    uchar dif, vif;
-    extractDV(key, &dif, &vif);
 
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
-    vector<uchar> v;
-    hex2bin(p.second.value, &v);
 
-    *value = v[0];
+    *value = valueAsUnsigned(p.second, 1);
     return true;
 }
 
-bool extractDVuint16(map<string,pair<int,DVEntry>> *values,
+bool extractDVuint16(DVEntries *values,
                      string key,
                      int *offset,
                      uint16_t *value)
 {
-    if ((*values).count(key) == 0) {
+    uchar dif, vif;
+    pair<int,DVEntry> *found = values->find(key, &dif, &vif);
+    if (found == NULL) {
         verbose("(dvparser) warning: cannot extract uint16 from non-existant key \"%s\"\n", key.c_str());
         *offset = -1;
         *value = 0;
         return false;
     }
-    uchar dif, vif;
-    extractDV(key, &dif, &vif);
 
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
-    vector<uchar> v;
-    hex2bin(p.second.value, &v);
 
-    *value = v[1]<<8 | v[0];
+    *value = valueAsUnsigned(p.second, 2);
     return true;
 }
 
-bool extractDVuint24(map<string,pair<int,DVEntry>> *values,
+bool extractDVuint24(DVEntries *values,
                      string key,
                      int *offset,
                      uint32_t *value)
 {
-    if ((*values).count(key) == 0) {
+    uchar dif, vif;
+    pair<int,DVEntry> *found = values->find(key, &dif, &vif);
+    if (found == NULL) {
         verbose("(dvparser) warning: cannot extract uint24 from non-existant key \"%s\"\n", key.c_str());
         *offset = -1;
         *value = 0;
         return false;
     }
-    uchar dif, vif;
-    extractDV(key, &dif, &vif);
 
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
-    vector<uchar> v;
-    hex2bin(p.second.value, &v);
 
-    *value = v[2] << 16 | v[1]<<8 | v[0];
+    *value = valueAsUnsigned(p.second, 3);
     return true;
 }
 
-bool extractDVuint32(map<string,pair<int,DVEntry>> *values,
+bool extractDVuint32(DVEntries *values,
                      string key,
                      int *offset,
                      uint32_t *value)
 {
-    if ((*values).count(key) == 0) {
+    uchar dif, vif;
+    pair<int,DVEntry> *found = values->find(key, &dif, &vif);
+    if (found == NULL) {
         verbose("(dvparser) warning: cannot extract uint32 from non-existant key \"%s\"\n", key.c_str());
         *offset = -1;
         *value = 0;
         return false;
     }
-    uchar dif, vif;
-    extractDV(key, &dif, &vif);
 
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
-    vector<uchar> v;
-    hex2bin(p.second.value, &v);
 
-    *value = (uint32_t(v[3]) << 24) |  (uint32_t(v[2]) << 16) | (uint32_t(v[1])<<8) | uint32_t(v[0]);
+    *value = valueAsUnsigned(p.second, 4);
     return true;
 }
 
-bool extractDVdouble(map<string,pair<int,DVEntry>> *values,
+bool extractDVdouble(DVEntries *values,
                      string key,
                      int *offset,
                      double *value,
                      bool auto_scale,
                      bool assume_signed)
 {
-    if ((*values).count(key) == 0) {
+    uchar dif, vif;
+    pair<int,DVEntry> *found = values->find(key, &dif, &vif);
+    if (found == NULL) {
         verbose("(dvparser) warning: cannot extract double from non-existant key \"%s\"\n", key.c_str());
         *offset = 0;
         *value = 0;
         return false;
     }
-    uchar dif, vif;
-    extractDV(key, &dif, &vif);
 
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
 
-    if (p.second.value.length() == 0) {
+    if (p.second.valueLength() == 0) {
         verbose("(dvparser) warning: key found but no data  \"%s\"\n", key.c_str());
         *offset = 0;
         *value = 0;
@@ -563,50 +885,15 @@ bool extractDVdouble(map<string,pair<int,DVEntry>> *values,
         t == 0x6 || // 48 Bit Integer/Binary
         t == 0x7)   // 64 Bit Integer/Binary
     {
-        vector<uchar> v;
-        hex2bin(p.second.value, &v);
-        uint64_t raw = 0;
+        int len = p.second.valueLength();
+        assert(len == difLenBytes(dif));
+        uint64_t raw = valueAsUnsigned(p.second, len);
         bool negate = false;
         uint64_t negate_mask = 0;
-        if (t == 0x1) {
-            assert(v.size() == 1);
-            raw = v[0];
-            if (assume_signed && (raw & (uint64_t)0x80UL) != 0) { negate = true; negate_mask = ~((uint64_t)0)<<8; }
-        } else if (t == 0x2) {
-            assert(v.size() == 2);
-            raw = v[1]*256 + v[0];
-            if (assume_signed && (raw & (uint64_t)0x8000UL) != 0) { negate = true; negate_mask = ~((uint64_t)0)<<16; }
-        } else if (t == 0x3) {
-            assert(v.size() == 3);
-            raw = v[2]*256*256 + v[1]*256 + v[0];
-            if (assume_signed && (raw & (uint64_t)0x800000UL) != 0) { negate = true; negate_mask = ~((uint64_t)0)<<24; }
-        } else if (t == 0x4) {
-            assert(v.size() == 4);
-            raw = ((unsigned int)v[3])*256*256*256
-                + ((unsigned int)v[2])*256*256
-                + ((unsigned int)v[1])*256
-                + ((unsigned int)v[0]);
-            if (assume_signed && (raw & (uint64_t)0x80000000UL) != 0) { negate = true; negate_mask = ~((uint64_t)0)<<32; }
-        } else if (t == 0x6) {
-            assert(v.size() == 6);
-            raw = ((uint64_t)v[5])*256*256*256*256*256
-                + ((uint64_t)v[4])*256*256*256*256
-                + ((uint64_t)v[3])*256*256*256
-                + ((uint64_t)v[2])*256*256
-                + ((uint64_t)v[1])*256
-                + ((uint64_t)v[0]);
-            if (assume_signed && (raw & (uint64_t)0x800000000000UL) != 0) { negate = true; negate_mask = ~((uint64_t)0)<<48; }
-        } else if (t == 0x7) {
-            assert(v.size() == 8);
-            raw = ((uint64_t)v[7])*256*256*256*256*256*256*256
-                + ((uint64_t)v[6])*256*256*256*256*256*256
-                + ((uint64_t)v[5])*256*256*256*256*256
-                + ((uint64_t)v[4])*256*256*256*256
-                + ((uint64_t)v[3])*256*256*256
-                + ((uint64_t)v[2])*256*256
-                + ((uint64_t)v[1])*256
-                + ((uint64_t)v[0]);
-            if (assume_signed && (raw & (uint64_t)0x8000000000000000UL) != 0) { negate = true; negate_mask = 0; }
+        if (assume_signed && (raw & ((uint64_t)1 << (len*8-1))) != 0)
+        {
+            negate = true;
+            negate_mask = len < 8 ? ~((uint64_t)0) << (len*8) : 0;
         }
         double scale = 1.0;
         double draw = (double)raw;
@@ -624,42 +911,10 @@ bool extractDVdouble(map<string,pair<int,DVEntry>> *values,
         t == 0xC || // 8 digit BCD
         t == 0xE)   // 12 digit BCD
     {
-        // 74140000 -> 00001474
-        string& v = p.second.value;
-        uint64_t raw = 0;
-        bool negate = false;
-        if (t == 0x9) {
-            assert(v.size() == 2);
-            if (assume_signed && v[0] == 'F') { negate = true; v[0] = '0'; }
-            raw = (v[0]-'0')*10 + (v[1]-'0');
-        } else if (t ==  0xA) {
-            assert(v.size() == 4);
-            if (assume_signed && v[2] == 'F') { negate = true; v[2] = '0'; }
-            raw = (v[2]-'0')*10*10*10 + (v[3]-'0')*10*10
-                + (v[0]-'0')*10 + (v[1]-'0');
-        } else if (t ==  0xB) {
-            assert(v.size() == 6);
-            if (assume_signed && v[4] == 'F') { negate = true; v[4] = '0'; }
-            raw = (v[4]-'0')*10*10*10*10*10 + (v[5]-'0')*10*10*10*10
-                + (v[2]-'0')*10*10*10 + (v[3]-'0')*10*10
-                + (v[0]-'0')*10 + (v[1]-'0');
-        } else if (t ==  0xC) {
-            assert(v.size() == 8);
-            if (assume_signed && v[6] == 'F') { negate = true; v[6] = '0'; }
-            raw = (v[6]-'0')*10*10*10*10*10*10*10 + (v[7]-'0')*10*10*10*10*10*10
-                + (v[4]-'0')*10*10*10*10*10 + (v[5]-'0')*10*10*10*10
-                + (v[2]-'0')*10*10*10 + (v[3]-'0')*10*10
-                + (v[0]-'0')*10 + (v[1]-'0');
-        } else if (t ==  0xE) {
-            assert(v.size() == 12);
-            if (assume_signed && v[10] == 'F') { negate = true; v[10] = '0'; }
-            raw =(v[10]-'0')*10*10*10*10*10*10*10*10*10*10*10 + (v[11]-'0')*10*10*10*10*10*10*10*10*10*10
-                + (v[8]-'0')*10*10*10*10*10*10*10*10*10 + (v[9]-'0')*10*10*10*10*10*10*10*10
-                + (v[6]-'0')*10*10*10*10*10*10*10 + (v[7]-'0')*10*10*10*10*10*10
-                + (v[4]-'0')*10*10*10*10*10 + (v[5]-'0')*10*10*10*10
-                + (v[2]-'0')*10*10*10 + (v[3]-'0')*10*10
-                + (v[0]-'0')*10 + (v[1]-'0');
-        }
+        int len = p.second.valueLength();
+        assert(len == difLenBytes(dif));
+        bool negate = assume_signed && (p.second.value()[len-1] & 0xf0) == 0xf0;
+        uint64_t raw = valueAsBCD(p.second, negate);
         double scale = 1.0;
         double draw = (double)raw;
         if (negate)
@@ -677,24 +932,24 @@ bool extractDVdouble(map<string,pair<int,DVEntry>> *values,
     return true;
 }
 
-bool extractDVlong(map<string,pair<int,DVEntry>> *values,
+bool extractDVlong(DVEntries *values,
                    string key,
                    int *offset,
                    uint64_t *value)
 {
-    if ((*values).count(key) == 0) {
+    uchar dif, vif;
+    pair<int,DVEntry> *found = values->find(key, &dif, &vif);
+    if (found == NULL) {
         verbose("(dvparser) warning: cannot extract long from non-existant key \"%s\"\n", key.c_str());
         *offset = 0;
         *value = 0;
         return false;
     }
-    uchar dif, vif;
-    extractDV(key, &dif, &vif);
 
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
 
-    if (p.second.value.length() == 0) {
+    if (p.second.valueLength() == 0) {
         verbose("(dvparser) warning: key found but no data  \"%s\"\n", key.c_str());
         *offset = 0;
         *value = 0;
@@ -709,44 +964,8 @@ bool extractDVlong(map<string,pair<int,DVEntry>> *values,
         t == 0x6 || // 48 Bit Integer/Binary
         t == 0x7)   // 64 Bit Integer/Binary
     {
-        vector<uchar> v;
-        hex2bin(p.second.value, &v);
-        uint64_t raw = 0;
-        if (t == 0x1) {
-            assert(v.size() == 1);
-            raw = v[0];
-        } else if (t == 0x2) {
-            assert(v.size() == 2);
-            raw = v[1]*256 + v[0];
-        } else if (t == 0x3) {
-            assert(v.size() == 3);
-            raw = v[2]*256*256 + v[1]*256 + v[0];
-        } else if (t == 0x4) {
-            assert(v.size() == 4);
-            raw = ((unsigned int)v[3])*256*256*256
-                + ((unsigned int)v[2])*256*256
-                + ((unsigned int)v[1])*256
-                + ((unsigned int)v[0]);
-        } else if (t == 0x6) {
-            assert(v.size() == 6);
-            raw = ((uint64_t)v[5])*256*256*256*256*256
-                + ((uint64_t)v[4])*256*256*256*256
-                + ((uint64_t)v[3])*256*256*256
-                + ((uint64_t)v[2])*256*256
-                + ((uint64_t)v[1])*256
-                + ((uint64_t)v[0]);
-        } else if (t == 0x7) {
-            assert(v.size() == 8);
-            raw = ((uint64_t)v[7])*256*256*256*256*256*256*256
-                + ((uint64_t)v[6])*256*256*256*256*256*256
-                + ((uint64_t)v[5])*256*256*256*256*256
-                + ((uint64_t)v[4])*256*256*256*256
-                + ((uint64_t)v[3])*256*256*256
-                + ((uint64_t)v[2])*256*256
-                + ((uint64_t)v[1])*256
-                + ((uint64_t)v[0]);
-        }
-        *value = raw;
+        assert(p.second.valueLength() == difLenBytes(dif));
+        *value = valueAsUnsigned(p.second, p.second.valueLength());
     }
     else
     if (t == 0x9 || // 2 digit BCD
@@ -755,38 +974,8 @@ bool extractDVlong(map<string,pair<int,DVEntry>> *values,
         t == 0xC || // 8 digit BCD
         t == 0xE)   // 12 digit BCD
     {
-        // 74140000 -> 00001474
-        string& v = p.second.value;
-        uint64_t raw = 0;
-        if (t == 0x9) {
-            assert(v.size() == 2);
-            raw = (v[0]-'0')*10 + (v[1]-'0');
-        } else if (t ==  0xA) {
-            assert(v.size() == 4);
-            raw = (v[2]-'0')*10*10*10 + (v[3]-'0')*10*10
-                + (v[0]-'0')*10 + (v[1]-'0');
-        } else if (t ==  0xB) {
-            assert(v.size() == 6);
-            raw = (v[4]-'0')*10*10*10*10*10 + (v[5]-'0')*10*10*10*10
-                + (v[2]-'0')*10*10*10 + (v[3]-'0')*10*10
-                + (v[0]-'0')*10 + (v[1]-'0');
-        } else if (t ==  0xC) {
-            assert(v.size() == 8);
-            raw = (v[6]-'0')*10*10*10*10*10*10*10 + (v[7]-'0')*10*10*10*10*10*10
-                + (v[4]-'0')*10*10*10*10*10 + (v[5]-'0')*10*10*10*10
-                + (v[2]-'0')*10*10*10 + (v[3]-'0')*10*10
-                + (v[0]-'0')*10 + (v[1]-'0');
-        } else if (t ==  0xE) {
-            assert(v.size() == 12);
-            raw =(v[10]-'0')*10*10*10*10*10*10*10*10*10*10*10 + (v[11]-'0')*10*10*10*10*10*10*10*10*10*10
-                + (v[8]-'0')*10*10*10*10*10*10*10*10*10 + (v[9]-'0')*10*10*10*10*10*10*10*10
-                + (v[6]-'0')*10*10*10*10*10*10*10 + (v[7]-'0')*10*10*10*10*10*10
-                + (v[4]-'0')*10*10*10*10*10 + (v[5]-'0')*10*10*10*10
-                + (v[2]-'0')*10*10*10 + (v[3]-'0')*10*10
-                + (v[0]-'0')*10 + (v[1]-'0');
-        }
-
-        *value = raw;
+        assert(p.second.valueLength() == difLenBytes(dif));
+        *value = valueAsBCD(p.second, false);
     }
     else
     {
@@ -796,42 +985,45 @@ bool extractDVlong(map<string,pair<int,DVEntry>> *values,
     return true;
 }
 
-bool extractDVHexString(map<string,pair<int,DVEntry>> *values,
+bool extractDVHexString(DVEntries *values,
                         string key,
                         int *offset,
                         string *value)
 {
-    if ((*values).count(key) == 0) {
+    pair<int,DVEntry> *found = values->find(key);
+    if (found == NULL) {
         verbose("(dvparser) warning: cannot extract string from non-existant key \"%s\"\n", key.c_str());
         *offset = -1;
         return false;
     }
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
-    *value = p.second.value;
+    *value = p.second.valueHex();
 
     return true;
 }
 
 
-bool extractDVReadableString(map<string,pair<int,DVEntry>> *values,
+bool extractDVReadableString(DVEntries *values,
                              string key,
                              int *offset,
                              string *value)
 {
-    if ((*values).count(key) == 0) {
+    uchar dif, vif;
+    pair<int,DVEntry> *found = values->find(key, &dif, &vif);
+    if (found == NULL) {
         verbose("(dvparser) warning: cannot extract string from non-existant key \"%s\"\n", key.c_str());
         *offset = -1;
         return false;
     }
-    uchar dif, vif;
-    extractDV(key, &dif, &vif);
     int t = dif&0xf;
 
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
 
-    string v = p.second.value;
+    const uchar *v = p.second.value();
+    vector<uchar> reversed(v, v+p.second.valueLength());
+    reverse(reversed.begin(), reversed.end());
 
     if (t == 0x1 || // 8 Bit Integer/Binary
         t == 0x2 || // 16 Bit Integer/Binary
@@ -844,20 +1036,22 @@ bool extractDVReadableString(map<string,pair<int,DVEntry>> *values,
         // For example an enhanced id 32 bits binary looks like:
         // 44434241 and will be reversed to: 41424344 and translated using ascii
         // to ABCD
-        v = reverseBinaryAsciiSafeToString(v);
+        *value = safeString(reversed);
     }
-    if (t == 0x9 || // 2 digit BCD
-        t == 0xA || // 4 digit BCD
-        t == 0xB || // 6 digit BCD
-        t == 0xC || // 8 digit BCD
-        t == 0xE)   // 12 digit BCD
+    else if (t == 0x9 || // 2 digit BCD
+             t == 0xA || // 4 digit BCD
+             t == 0xB || // 6 digit BCD
+             t == 0xC || // 8 digit BCD
+             t == 0xE)   // 12 digit BCD
     {
         // For example an enhanced id 12 digit bcd looks like:
         // 618171183100 and will be reversed to: 003118718161
-        v = reverseBCD(v);
+        *value = bin2hex(reversed);
+    }
+    else
+    {
+        *value = p.second.valueHex();
     }
-
-    *value = v;
     return true;
 }
 
@@ -895,12 +1089,14 @@ bool extractTime(uchar hi, uchar lo, struct tm *date)
     return true;
 }
 
-bool extractDVdate(map<string,pair<int,DVEntry>> *values,
+bool extractDVdate(DVEntries *values,
                    string key,
                    int *offset,
                    struct tm *value)
 {
-    if ((*values).count(key) == 0)
+    uchar dif, vif;
+    pair<int,DVEntry> *found = values->find(key, &dif, &vif);
+    if (found == NULL)
     {
         verbose("(dvparser) warning: cannot extract date from non-existant key \"%s\"\n", key.c_str());
         *offset = -1;
@@ -918,23 +1114,21 @@ bool extractDVdate(map<string,pair<int,DVEntry>> *values,
     value->tm_mon = 0;
     value->tm_year = 0;
 
-    uchar dif, vif;
-    extractDV(key, &dif, &vif);
 
-    pair<int,DVEntry>&  p = (*values)[key];
+    pair<int,DVEntry>&  p = *found;
     *offset = p.first;
-    vector<uchar> v;
-    hex2bin(p.second.value, &v);
+    const uchar *v = p.second.value();
+    int len = p.second.valueLength();
 
     bool ok = true;
-    if (v.size() == 2) {
+    if (len == 2) {
         ok &= extractDate(v[1], v[0], value);
     }
-    else if (v.size() == 4) {
+    else if (len == 4) {
         ok &= extractDate(v[3], v[2], value);
         ok &= extractTime(v[1], v[0], value);
     }
-    else if (v.size() == 6) {
+    else if (len == 6) {
         ok &= extractDate(v[4], v[3], value);
         ok &= extractTime(v[2], v[1], value);
         // ..ss ssss
@@ -109,12 +109,16 @@ private:
 static IndexNr AnyIndexNr = IndexNr(-1);
 
 bool loadFormatBytesFromSignature(uint16_t format_signature, vector<uchar> *format_bytes);
+// The formats seen can be stored in a file and loaded at the next start,
+// then compact frames can be decoded before a full frame has been received.
+bool loadFormatSignatures(string file);
+bool saveFormatSignatures(string file);
 
 bool parseDV(Telegram *t,
              std::vector<uchar> &databytes,
              std::vector<uchar>::iterator data,
              size_t data_len,
-             std::map<std::string,std::pair<int,DVEntry>> *values,
+             DVEntries *values,
              std::vector<uchar>::iterator *format = NULL,
              size_t format_len = 0,
              uint16_t *format_hash = NULL);
@@ -124,40 +128,40 @@ bool parseDV(Telegram *t,
 // Like: Volume, VolumeFlow, FlowTemperature, ExternalTemperature etc
 // in combination with the storagenr. (Later I will add tariff/subunit)
 bool findKey(MeasurementType mt, ValueInformation vi, int storagenr, int tariffnr,
-             std::string *key, std::map<std::string,std::pair<int,DVEntry>> *values);
+             std::string *key, DVEntries *values);
 // Some meters have multiple identical DIF/VIF values! Meh, they are not using storage nrs or tariff nrs.
 // So here we can pick for example nr 2 of an identical set if DIF/VIF values.
 // Nr 1 means the first found value.
 bool findKeyWithNr(MeasurementType mt, ValueInformation vi, int storagenr, int tariffnr, int indexnr,
-                   std::string *key, std::map<std::string,std::pair<int,DVEntry>> *values);
+                   std::string *key, DVEntries *values);
 
 #define ANY_STORAGENR -1
 #define ANY_TARIFFNR -1
 
-bool hasKey(std::map<std::string,std::pair<int,DVEntry>> *values, std::string key);
+bool hasKey(DVEntries *values, std::string key);
 
-bool extractDVuint8(std::map<std::string,std::pair<int,DVEntry>> *values,
+bool extractDVuint8(DVEntries *values,
                     std::string key,
                     int *offset,
                     uchar *value);
 
-bool extractDVuint16(std::map<std::string,std::pair<int,DVEntry>> *values,
+bool extractDVuint16(DVEntries *values,
                      std::string key,
                      int *offset,
                      uint16_t *value);
 
-bool extractDVuint24(std::map<std::string,std::pair<int,DVEntry>> *values,
+bool extractDVuint24(DVEntries *values,
                      std::string key,
                      int *offset,
                      uint32_t *value);
 
-bool extractDVuint32(std::map<std::string,std::pair<int,DVEntry>> *values,
+bool extractDVuint32(DVEntries *values,
                      std::string key,
                      int *offset,
                      uint32_t *value);
 
 // All values are scaled according to the vif and wmbusmeters scaling defaults.
-bool extractDVdouble(std::map<std::string,std::pair<int,DVEntry>> *values,
+bool extractDVdouble(DVEntries *values,
                      std::string key,
                      int *offset,
                      double *value,
@@ -165,25 +169,25 @@ bool extractDVdouble(std::map<std::string,std::pair<int,DVEntry>> *values,
                      bool assume_signed = false);
 
 // Extract a value without scaling. Works for 8bits to 64 bits, binary and bcd.
-bool extractDVlong(map<string,pair<int,DVEntry>> *values,
+bool extractDVlong(DVEntries *values,
                    string key,
                    int *offset,
                    uint64_t *value);
 
 // Just copy the raw hex data into the string, not reversed or anything.
-bool extractDVHexString(std::map<std::string,std::pair<int,DVEntry>> *values,
+bool extractDVHexString(DVEntries *values,
                         std::string key,
                         int *offset,
                         string *value);
 
 // Read the content and attempt to reverse and transform it into a readble string
 // based on the dif information.
-bool extractDVReadableString(std::map<std::string,std::pair<int,DVEntry>> *values,
+bool extractDVReadableString(DVEntries *values,
                              std::string key,
                              int *offset,
                              string *value);
 
-bool extractDVdate(std::map<std::string,std::pair<int,DVEntry>> *values,
+bool extractDVdate(DVEntries *values,
                    std::string key,
                    int *offset,
                    struct tm *value);
@@ -50,7 +50,7 @@ int main(int argc, char **argv)
         }
     }
 
-    map<string,pair<int,DVEntry>> values;
+    DVEntries values;
     Telegram t;
     vector<uchar>::iterator i = databytes.begin();
 
@@ -270,6 +270,8 @@ void list_fields(Configuration *config, string meter_driver)
     printf("%s  UTC time when wmbusmeters received the telegram.\n", timestamp_utc.c_str());
     string device = padLeft("device", width);
     printf("%s  The wmbus device that received the telegram.\n", device.c_str());
+    string devices = padLeft("devices", width);
+    printf("%s  All wmbus devices that received the telegram, when merged from several devices.\n", devices.c_str());
     string rssi = padLeft("rssi_dbm", width);
     printf("%s  The rssi for the received telegram as reported by the device.\n", rssi.c_str());
     for (auto &p : meter->prints())
@@ -381,6 +383,8 @@ time_t last_info_print_ = 0;
 
 void regular_checkup(Configuration *config)
 {
+    meter_manager_->removeIdleMeters(time(NULL));
+
     if (config->daemon)
     {
         time_t now = time(NULL);
@@ -393,6 +397,14 @@ void regular_checkup(Configuration *config)
 
             // Log memory usage once per day.
             notice_timestamp("(memory) rss %zu peak %s\n", curr_rss, prss.c_str());
+            string stats = meter_manager_->statistics();
+            notice_timestamp("(meters) %s\n", stats.c_str());
+            string ingest = bus_manager_->ingestStatistics();
+            if (ingest != "") notice_timestamp("(ingest) %s\n", ingest.c_str());
+            string merge = bus_manager_->mergeStatistics();
+            if (merge != "") notice_timestamp("(merge) %s\n", merge.c_str());
+            string duplicates = duplicateTelegramStatistics();
+            if (duplicates != "") notice_timestamp("(duplicates) %s\n", duplicates.c_str());
         }
     }
 
@@ -479,7 +491,8 @@ bool start(Configuration *config)
 
     stderrEnabled(config->use_stderr_for_log);
     setAlarmShells(config->alarm_shells);
-    setIgnoreDuplicateTelegrams(config->ignore_duplicate_telegrams);
+    setIgnoreDuplicateTelegrams(config->ignore_duplicate_telegrams, config->ignore_duplicates_window);
+    if (config->formatcache != "") loadFormatSignatures(config->formatcache);
 
     log_start_information(config);
 
@@ -510,7 +523,11 @@ bool start(Configuration *config)
                                    config->analyze_format,
                                    config->analyze_driver,
                                    config->analyze_key,
-                                   config->analyze_verbose);
+                                   config->analyze_verbose,
+                                   config->analyze_threads);
+    meter_manager_->setMaxMeters(config->maxmeters);
+    meter_manager_->setMeterIdleTimeout(config->meteridletimeout);
+    meter_manager_->setIgnoredMetersCache(config->ignoredmeters, config->ignoredmeters_ttl);
 
     // The bus manager detects new/lost wmbus devices and
     // configures the devices according to the specification.
@@ -527,6 +544,12 @@ bool start(Configuration *config)
 
     setup_meters(config, meter_manager_.get());
 
+    // Optionally queue the received telegrams and decode them in other threads than the event loop thread.
+    startDecodeWorkerThreads(config->decodethreads, config->decodequeue);
+    bus_manager_->startIngestQueue(config->ingestqueue, config->ingestqueue_policy);
+    // Optionally merge the copies of a telegram received by several bus devices.
+    bus_manager_->startMergeStage(config->mergewindow);
+
     bus_manager_->detectAndConfigureWmbusDevices(config, DetectionType::STDIN_FILE_SIMULATION);
 
     serial_manager_->startEventLoop();
@@ -570,13 +593,13 @@ bool start(Configuration *config)
         {
             notice("No meters configured. Printing id:s of all telegrams heard!\n");
 
-            meter_manager_->onTelegram([](AboutTelegram &about, vector<uchar> frame) {
+            meter_manager_->onTelegram([](shared_ptr<ReceivedFrame> frame) {
                     Telegram t;
-                    t.about = about;
+                    t.about = frame->about;
                     MeterKeys mk;
-                    t.parse(frame, &mk, false); // Try a best effort parse, do not print any warnings.
+                    t.parse(frame->bytes, &mk, false); // Try a best effort parse, do not print any warnings.
                     t.print();
-                    string info = string("(")+toString(about.type)+")";
+                    string info = string("(")+toString(frame->about.type)+")";
                     t.explainParse(info.c_str(), 0);
                     logTelegram(t.original, t.frame, 0, 0);
                     return true;
@@ -605,6 +628,7 @@ bool start(Configuration *config)
     // is started in a separate thread.
     //
     // Totalling 3 threads: main (sleeping here), serial manager (telegram handling), regular checks (check lost devices and alarms)
+    // plus the optional decode worker threads (parsing, decrypting and printing the telegrams).
     serial_manager_->waitForStop();
 
     if (config->daemon)
@@ -613,6 +637,19 @@ bool start(Configuration *config)
     }
 
     bus_manager_->removeAllBusDevices();
+    // No more telegrams can arrive, finish decoding the already received telegrams.
+    bus_manager_->stopMergeStage();
+    bus_manager_->stopIngestQueue();
+    stopDecodeWorkerThreads();
+    if (config->formatcache != "") saveFormatSignatures(config->formatcache);
+    string stats = meter_manager_->statistics();
+    verbose("(meters) %s\n", stats.c_str());
+    string ingest = bus_manager_->ingestStatistics();
+    if (ingest != "") verbose("(ingest) %s\n", ingest.c_str());
+    string merge = bus_manager_->mergeStatistics();
+    if (merge != "") verbose("(merge) %s\n", merge.c_str());
+    string duplicates = duplicateTelegramStatistics();
+    if (duplicates != "") verbose("(duplicates) %s\n", duplicates.c_str());
     meter_manager_->removeAllMeters();
     printer_.reset();
     serial_manager_.reset();
@@ -141,6 +141,23 @@ void transformDiehlAddress(vector<uchar>& frame, DiehlAddressTransformMethod tra
     if (transform_method == DiehlAddressTransformMethod::SWAPPING)
     {
         debug("(diehl) Pre-processing: swapping address field\n");
+    }
+    else if (transform_method == DiehlAddressTransformMethod::SAP_PRIOS)
+    {
+        debug("(diehl) Pre-processing: setting device type to water meter for SAP PRIOS\n");
+    }
+    else if (transform_method == DiehlAddressTransformMethod::SAP_PRIOS_STANDARD)
+    {
+        warning("(diehl) Pre-processing: SAP PRIOS STANDARD transformation not implemented!\n"); // TODO
+    }
+    transformDiehlAddress(&frame[0], transform_method);
+}
+
+// Diehl: transform "A field" in the first 10 bytes of a frame, silently.
+void transformDiehlAddress(uchar *frame, DiehlAddressTransformMethod transform_method)
+{
+    if (transform_method == DiehlAddressTransformMethod::SWAPPING)
+    {
         uchar version = frame[4];
         uchar type    = frame[5];
         for (int i = 4; i < 8; i++)
@@ -152,14 +169,9 @@ void transformDiehlAddress(vector<uchar>& frame, DiehlAddressTransformMethod tra
     }
     else if (transform_method == DiehlAddressTransformMethod::SAP_PRIOS)
     {
-        debug("(diehl) Pre-processing: setting device type to water meter for SAP PRIOS\n");
         frame[8] = 0x00; // version field is used by IZAR as part of meter id on 5 bytes instead of 4
         frame[9] = 0x07; // water meter
     }
-    else if (transform_method == DiehlAddressTransformMethod::SAP_PRIOS_STANDARD)
-    {
-        warning("(diehl) Pre-processing: SAP PRIOS STANDARD transformation not implemented!\n"); // TODO
-    }
 }
 
 // Diehl: decode LFSR encrypted data used in Izar/PRIOS and Sharky meters
@@ -249,8 +261,9 @@ void addDefaultManufacturerKeyIfAny(const vector<uchar> &frame, TPLSecurityMode
     {
         vector<uchar> half;
         hex2bin(PRIOS_DEFAULT_KEY2, &half);
-        meter_keys->confidentiality_key = vector<uchar>(half.begin(), half.end());
-        meter_keys->confidentiality_key.insert(meter_keys->confidentiality_key.end(), half.begin(), half.end());
+        vector<uchar> key(half.begin(), half.end());
+        key.insert(key.end(), half.begin(), half.end());
+        meter_keys->setConfidentialityKey(key);
         debug("(mfct) added default key\n");
     }
 }
@@ -73,6 +73,8 @@ DiehlAddressTransformMethod mustTransformDiehlAddress(const vector<uchar>& frame
 
 // Diehl: transform "A field" to make it compliant to standard
 void transformDiehlAddress(vector<uchar>& frame, DiehlAddressTransformMethod method);
+// Diehl: same transformation on the first 10 bytes of a frame, without logging
+void transformDiehlAddress(uchar *frame, DiehlAddressTransformMethod method);
 
 // Diehl: Is payload real data crypted (LFSR)?
 bool mustDecryptDiehlRealData(const vector<uchar>& frame);
@@ -149,7 +149,7 @@ void MeterEI6500::processContent(Telegram *t)
       (ei6500) 1d: 02 dif (16 Bit Integer/Binary Instantaneous value)
       (ei6500) 1e: FD vif (Second extension FD of VIF-codes)
       (ei6500) 1f: 17 vife (Error flags (binary))
-      (ei6500) 20: * 0000 info codes (148ce5d8)
+      (ei6500) 20: * 0000 info codes (NOT_INSTALLED)
       (ei6500) 22: 82 dif (16 Bit Integer/Binary Instantaneous value)
       (ei6500) 23: 20 dife (subunit=0 tariff=2 storagenr=0)
       (ei6500) 24: 6C vif (Date type G)
@@ -220,7 +220,7 @@ void MeterEI6500::processContent(Telegram *t)
     if (extractDVuint16(&t->values, "02FD17", &offset, &info_codes_))
     {
         string s = status();
-        t->addMoreExplanation(offset, " info codes (%x)", s.c_str());
+        t->addMoreExplanation(offset, " info codes (%s)", s.c_str());
     }
 
     extractDVdate(&t->values, "82506C", &offset, &datetime);
@@ -71,7 +71,7 @@ void MKRadio4::processContent(Telegram *t)
     // simple wrapped inside a wmbus telegram since the ci-field is 0xa2.
     // Which means that the entire payload is manufacturer specific.
 
-    map<string,pair<int,DVEntry>> vendor_values;
+    DVEntries vendor_values;
     vector<uchar> content;
 
     t->extractPayload(&content);
@@ -83,7 +83,7 @@ void MKRadio4::processContent(Telegram *t)
     string prevs;
     strprintf(prevs, "%02x%02x", prev_lo, prev_hi);
     int offset = t->parsed.size()+3;
-    vendor_values["0215"] = { offset, DVEntry(MeasurementType::Instantaneous, 0x15, 0, 0, 0, prevs) };
+    vendor_values.set("0215", offset, DVEntry(MeasurementType::Instantaneous, 0x15, 0, 0, 0, prevs));
     t->explanations.push_back(Explanation(offset, 2, prevs, KindOfData::CONTENT, Understanding::FULL));
     t->addMoreExplanation(offset, " prev consumption (%f m3)", prev);
 
@@ -94,7 +94,7 @@ void MKRadio4::processContent(Telegram *t)
     string currs;
     strprintf(currs, "%02x%02x", curr_lo, curr_hi);
     offset = t->parsed.size()+7;
-    vendor_values["0215"] = { offset, DVEntry(MeasurementType::Instantaneous, 0x15, 0, 0, 0, currs) };
+    vendor_values.set("0215", offset, DVEntry(MeasurementType::Instantaneous, 0x15, 0, 0, 0, currs));
     t->explanations.push_back(Explanation(offset, 2, currs, KindOfData::CONTENT, Understanding::FULL));
     t->addMoreExplanation(offset, " curr consumption (%f m3)", curr);
 
@@ -19,20 +19,74 @@
 #include"meters.h"
 #include"meter_detection.h"
 #include"meters_common_implementation.h"
+#include"threads.h"
 #include"units.h"
 #include"wmbus.h"
 #include"wmbus_utils.h"
 
 #include<algorithm>
+#include<list>
 #include<memory.h>
 #include<numeric>
 #include<time.h>
+#include<unordered_map>
 #include<cmath>
 
 
 map<string, DriverInfo> all_registered_drivers_;
 vector<DriverInfo> all_registered_drivers_list_;
 
+// The drivers that are detected by a (mfct,type,version) triplet.
+// The old style drivers are kept in METER_DETECTION order and the
+// new style drivers are kept sorted on name, which is the order
+// the detection functions used to find them.
+struct DetectedDrivers
+{
+    vector<MeterDriver> old_style;
+    vector<DriverInfo*> new_style;
+};
+
+static uint32_t detectionKey(uint16_t mfct, uchar type, uchar version)
+{
+    return ((uint32_t)mfct) << 16 | ((uint32_t)type) << 8 | version;
+}
+
+// The detection table is built when first used, which happens from the static
+// initializers that register the new style drivers. Wildcard media/version (-1)
+// in METER_DETECTION are expanded here into one entry per possible value.
+static unordered_map<uint32_t,DetectedDrivers> &detectionTable()
+{
+    static unordered_map<uint32_t,DetectedDrivers> table = []()
+    {
+        unordered_map<uint32_t,DetectedDrivers> t;
+#define X(TY,MA,ME,VE) {                                                \
+            for (int me = 0; me < 256; ++me)                            \
+            {                                                           \
+                if (ME != -1 && me != ME) continue;                     \
+                for (int ve = 0; ve < 256; ++ve)                        \
+                {                                                       \
+                    if (VE != -1 && ve != VE) continue;                 \
+                    t[detectionKey(MA, me, ve)].old_style.push_back(MeterDriver::TY); \
+                }                                                       \
+            }                                                           \
+        }
+METER_DETECTION
+#undef X
+        return t;
+    }();
+    return table;
+}
+
+static DetectedDrivers *lookupDetection(int mfct, int type, int version)
+{
+    if (mfct < 0 || mfct > 0xffff || type < 0 || type > 0xff || version < 0 || version > 0xff) return NULL;
+
+    auto &table = detectionTable();
+    auto i = table.find(detectionKey(mfct, type, version));
+    if (i == table.end()) return NULL;
+    return &i->second;
+}
+
 bool DriverInfo::detect(uint16_t mfct, uchar type, uchar version)
 {
     for (auto &dd : detect_)
@@ -82,14 +136,12 @@ bool registerDriver(function<void(DriverInfo&)> setup)
     // Check that no other driver also triggers on the same detection values.
     for (auto &d : di.detect())
     {
-        for (auto &p : all_registered_drivers_)
+        if (d.mfct == 0 && d.type == 0 && d.version == 0) continue; // Ignore drivers with no detection.
+        DetectedDrivers *dd = lookupDetection(d.mfct, d.type, d.version);
+        if (dd != NULL && dd->new_style.size() > 0)
         {
-            bool foo = p.second.detect(d.mfct, d.type, d.version);
-            if (foo)
-            {
-                error("Internal error: driver %s tried to register the same auto detect combo as driver %s alread has taken!\n",
-                      di.name().str().c_str(), p.second.name().str().c_str());
-            }
+            error("Internal error: driver %s tried to register the same auto detect combo as driver %s alread has taken!\n",
+                  di.name().str().c_str(), dd->new_style.front()->name().str().c_str());
         }
     }
 
@@ -97,6 +149,18 @@ bool registerDriver(function<void(DriverInfo&)> setup)
     all_registered_drivers_[di.name().str()] = di;
     all_registered_drivers_list_.push_back(di);
 
+    DriverInfo *installed = &all_registered_drivers_[di.name().str()];
+    auto &table = detectionTable();
+    for (auto &d : di.detect())
+    {
+        if (d.mfct == 0 && d.type == 0 && d.version == 0) continue;
+        vector<DriverInfo*> &drivers = table[detectionKey(d.mfct, d.type, d.version)].new_style;
+        if (std::find(drivers.begin(), drivers.end(), installed) != drivers.end()) continue;
+        auto pos = std::upper_bound(drivers.begin(), drivers.end(), installed,
+                                    [](DriverInfo *a, DriverInfo *b) { return a->name().str() < b->name().str(); });
+        drivers.insert(pos, installed);
+    }
+
     // This code is invoked from the static initializers of DriverInfos when starting
     // wmbusmeters. Thus we do not yet know if the user has supplied --debug or similar setting.
     // To debug this you have to uncomment the printf below.
@@ -124,36 +188,340 @@ private:
     string analyze_driver_;
     string analyze_key_;
     bool analyze_verbose_;
+    int analyze_threads_ {};
     vector<MeterInfo> meter_templates_;
-    vector<shared_ptr<Meter>> meters_;
-    function<void(AboutTelegram&,vector<uchar>)> on_telegram_;
+    // The meters in the order they were added, and the position of each meter in the list.
+    list<shared_ptr<Meter>> meters_;
+    unordered_map<Meter*,list<shared_ptr<Meter>>::iterator> meters_pos_;
+    // Meters that only use plain ids (no wildcards, no negations) are found
+    // through this index from telegram id to meters, in the order they were added.
+    unordered_map<string,vector<shared_ptr<Meter>>> meters_by_id_;
+    // The match expressions of the templates and of the meters with wildcard
+    // or negated expressions are compiled into this matcher. The owner found
+    // by the matcher is an index into match_owners_.
+    IdMatcher id_matcher_;
+    struct MatchOwner
+    {
+        shared_ptr<Meter> meter; // Either a meter
+        int template_index; // or an index into meter_templates_.
+    };
+    vector<MatchOwner> match_owners_;
+    // Telegrams from meters that no meter or template listens to are remembered here,
+    // keyed on the dll mfct,id,version,type bytes, so that the next telegram from the
+    // same meter can be dropped without parsing it. Only telegrams without any other id
+    // than the dll id are looked up or remembered. The cache is cleared when meters
+    // or templates are added or removed. The cache belongs to the meters, thus it is
+    // looked up after the merge stage, the ingest queue and the duplicate filter,
+    // when the telegram is dispatched to the meters.
+    struct IgnoredMeter
+    {
+        uint64_t key;
+        time_t added;
+    };
+    // The oldest entry first, when the cache is full the oldest entries are dropped.
+    list<IgnoredMeter> ignored_meters_order_;
+    unordered_map<uint64_t,list<IgnoredMeter>::iterator> ignored_meters_;
+    size_t ignored_meters_hits_ {};
+    size_t ignored_meters_misses_ {};
+    size_t ignored_meters_max_size_ = 10000;
+    time_t ignored_meters_ttl_ = 3600;
+    // The meters created from templates, the most recently updated first.
+    // If there is a limit and it is reached, then the least recently updated
+    // meter is removed before a new meter is created. If there is an idle timeout,
+    // then the meters not updated within the timeout are removed.
+    size_t max_meters_ {};
+    time_t meter_idle_timeout_ {};
+    struct TemplateMeter
+    {
+        Meter *meter;
+        time_t touched; // When the meter was created or last updated.
+    };
+    list<TemplateMeter> template_meters_;
+    unordered_map<Meter*,list<TemplateMeter>::iterator> template_meters_pos_;
+    size_t num_removed_meters_ {};
+    int num_added_meters_ {};
+    function<void(shared_ptr<ReceivedFrame>)> on_telegram_;
     function<void(Telegram*t,Meter*)> on_meter_updated_;
+    // When decode worker threads are used, the meters, the index, the matcher and the
+    // caches above are protected by this lock. A meter is updated outside of this lock,
+    // while holding its own lock, since a meter matched through several ids or through
+    // the ell/tpl id of relayed telegrams can receive telegrams from several workers.
+    RecursiveMutex meters_mutex_ = { "meters_mutex" };
+#define LOCK_METERS(where) WITH(meters_mutex_, meters_mutex, where)
 
 public:
     void addMeterTemplate(MeterInfo &mi)
     {
+        LOCK_METERS(add_meter_template);
         meter_templates_.push_back(mi);
+        addMatchOwner(NULL, meter_templates_.size()-1, mi.ids);
+        clearIgnoredMeters();
+    }
+
+    void addMatchOwner(shared_ptr<Meter> meter, int template_index, vector<string> &match_rules)
+    {
+        id_matcher_.add(match_owners_.size(), match_rules);
+        match_owners_.push_back({ meter, template_index });
     }
 
     void addMeter(shared_ptr<Meter> meter)
     {
+        LOCK_METERS(add_meter);
         meters_.push_back(meter);
-        meter->setIndex(meters_.size());
+        meters_pos_[meter.get()] = prev(meters_.end());
+        // Meters can be removed, so the index is the running count of added meters.
+        meter->setIndex(++num_added_meters_);
         meter->onUpdate(on_meter_updated_);
+        indexMeter(meter);
+        clearIgnoredMeters();
+    }
+
+    void indexMeter(shared_ptr<Meter> meter)
+    {
+        bool plain = true;
+        for (string &me : meter->ids())
+        {
+            if (me.find('*') != string::npos || (me.length() > 0 && me.front() == '!'))
+            {
+                plain = false;
+                break;
+            }
+        }
+
+        if (!plain)
+        {
+            addMatchOwner(meter, -1, meter->ids());
+            return;
+        }
+
+        for (string &me : meter->ids())
+        {
+            vector<shared_ptr<Meter>> &v = meters_by_id_[me];
+            // The same id can be listed twice for a meter, only index it once.
+            if (v.size() == 0 || v.back() != meter) v.push_back(meter);
+        }
+    }
+
+    // Find the meters that might want this telegram, ie meters with a plain id
+    // equal to one of the telegram ids and the meters found by the id matcher.
+    // The meters are returned in the order they were added.
+    void findCandidateMeters(vector<string> &ids, vector<IdMatch> &matches, vector<shared_ptr<Meter>> *candidates)
+    {
+        for (string &id : ids)
+        {
+            auto i = meters_by_id_.find(id);
+            if (i == meters_by_id_.end()) continue;
+            candidates->insert(candidates->end(), i->second.begin(), i->second.end());
+        }
+        for (IdMatch &m : matches)
+        {
+            shared_ptr<Meter> &meter = match_owners_[m.owner].meter;
+            if (meter) candidates->push_back(meter);
+        }
+
+        if (candidates->size() > 1)
+        {
+            sort(candidates->begin(), candidates->end(),
+                 [](const shared_ptr<Meter> &a, const shared_ptr<Meter> &b) { return a->index() < b->index(); });
+            candidates->erase(unique(candidates->begin(), candidates->end()), candidates->end());
+        }
     }
 
     Meter *lastAddedMeter()
     {
+        LOCK_METERS(last_added_meter);
         return meters_.back().get();
     }
 
+    void addTemplateMeter(shared_ptr<Meter> meter)
+    {
+        LOCK_METERS(add_template_meter);
+        time_t now = time(NULL);
+        removeIdleMeters(now);
+        while (max_meters_ > 0 && template_meters_.size() >= max_meters_)
+        {
+            removeMeter(template_meters_.back().meter);
+        }
+        addMeter(meter);
+        template_meters_.push_front({ meter.get(), now });
+        template_meters_pos_[meter.get()] = template_meters_.begin();
+    }
+
+    void touchTemplateMeter(Meter *meter)
+    {
+        LOCK_METERS(touch_template_meter);
+        auto i = template_meters_pos_.find(meter);
+        if (i == template_meters_pos_.end()) return;
+        i->second->touched = time(NULL);
+        template_meters_.splice(template_meters_.begin(), template_meters_, i->second);
+    }
+
+    void setMeterIdleTimeout(time_t seconds)
+    {
+        meter_idle_timeout_ = seconds;
+    }
+
+    void removeIdleMeters(time_t now)
+    {
+        if (meter_idle_timeout_ <= 0) return;
+
+        LOCK_METERS(remove_idle_meters);
+        // The least recently updated meter is last.
+        while (template_meters_.size() > 0 && now-template_meters_.back().touched >= meter_idle_timeout_)
+        {
+            removeMeter(template_meters_.back().meter);
+        }
+    }
+
+    // Remove a meter created from a template.
+    void removeMeter(Meter *meter)
+    {
+        LOCK_METERS(remove_meter);
+        auto p = template_meters_pos_.find(meter);
+        if (p == template_meters_pos_.end()) return;
+
+        // A decode worker might be updating the meter right now, thus only its constant
+        // properties are used here. The time of the last update is the time it was touched.
+        char touched[40];
+        memset(touched, 0, sizeof(touched));
+        struct tm tm;
+        strftime(touched, 20, "%Y-%m-%d %H:%M.%S", localtime_r(&p->second->touched, &tm));
+        if (is_daemon_)
+        {
+            notice("(wmbusmeters) removed meter %d (%s %s %s) last updated %s\n",
+                   meter->index(), meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str(),
+                   touched);
+        }
+        else
+        {
+            verbose("(meter) removed meter %d (%s %s %s) last updated %s\n",
+                    meter->index(), meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str(),
+                    touched);
+        }
+
+        // Meters created from templates have plain ids, thus they are only found in the id index.
+        for (string &id : meter->ids())
+        {
+            auto i = meters_by_id_.find(id);
+            if (i == meters_by_id_.end()) continue;
+            vector<shared_ptr<Meter>> &v = i->second;
+            v.erase(remove_if(v.begin(), v.end(), [meter](shared_ptr<Meter> &m) { return m.get() == meter; }), v.end());
+            if (v.size() == 0) meters_by_id_.erase(i);
+        }
+
+        template_meters_.erase(p->second);
+        template_meters_pos_.erase(p);
+        num_removed_meters_++;
+
+        // Removing the shared_ptr deletes the meter, unless a decode worker still uses it.
+        auto m = meters_pos_.find(meter);
+        meters_.erase(m->second);
+        meters_pos_.erase(m);
+    }
+
+    void setMaxMeters(size_t n)
+    {
+        max_meters_ = n;
+    }
+
+    void setIgnoredMetersCache(size_t max_size, time_t ttl)
+    {
+        LOCK_METERS(set_ignored_meters_cache);
+        ignored_meters_max_size_ = max_size;
+        ignored_meters_ttl_ = ttl;
+        clearIgnoredMeters();
+    }
+
     void removeAllMeters()
     {
+        LOCK_METERS(remove_all_meters);
+        template_meters_.clear();
+        template_meters_pos_.clear();
+        meters_by_id_.clear();
+        // Recompile the matcher with only the templates left.
+        id_matcher_.clear();
+        match_owners_.clear();
+        for (size_t i = 0; i < meter_templates_.size(); ++i)
+        {
+            addMatchOwner(NULL, i, meter_templates_[i].ids);
+        }
         meters_.clear();
+        meters_pos_.clear();
+        clearIgnoredMeters();
+    }
+
+    // The key is the mfct,id,version,type bytes of the data link layer.
+    // A telegram with another id than the dll id (an ell or tpl id) might be relayed
+    // for another meter, thus such telegrams are never looked up or remembered.
+    bool ignoredMeterKey(ReceivedFrame &frame, vector<string> &tids, uint64_t *key)
+    {
+        if (ignored_meters_max_size_ == 0) return false;
+        if (frame.about.type != FrameType::WMBUS || frame.bytes.size() < 10) return false;
+        for (string &id : tids) if (id != tids[0]) return false;
+        memcpy(key, &frame.bytes[2], 8);
+        return true;
+    }
+
+    bool isIgnoredMeter(uint64_t key)
+    {
+        LOCK_METERS(is_ignored_meter);
+        auto i = ignored_meters_.find(key);
+        if (i != ignored_meters_.end())
+        {
+            if (time(NULL)-i->second->added < ignored_meters_ttl_)
+            {
+                ignored_meters_hits_++;
+                return true;
+            }
+            ignored_meters_order_.erase(i->second);
+            ignored_meters_.erase(i);
+        }
+        ignored_meters_misses_++;
+        return false;
+    }
+
+    void rememberIgnoredMeter(uint64_t key)
+    {
+        LOCK_METERS(remember_ignored_meter);
+        time_t now = time(NULL);
+        auto i = ignored_meters_.find(key);
+        if (i != ignored_meters_.end())
+        {
+            // Another decode worker already remembered it.
+            ignored_meters_order_.erase(i->second);
+            ignored_meters_.erase(i);
+        }
+        // Make room by dropping the expired entries and then the oldest entries.
+        while (ignored_meters_order_.size() > 0 &&
+               (ignored_meters_order_.size() >= ignored_meters_max_size_ ||
+                now-ignored_meters_order_.front().added >= ignored_meters_ttl_))
+        {
+            ignored_meters_.erase(ignored_meters_order_.front().key);
+            ignored_meters_order_.pop_front();
+        }
+        ignored_meters_order_.push_back({ key, now });
+        ignored_meters_[key] = prev(ignored_meters_order_.end());
+    }
+
+    void clearIgnoredMeters()
+    {
+        ignored_meters_order_.clear();
+        ignored_meters_.clear();
+    }
+
+    string statistics()
+    {
+        LOCK_METERS(statistics);
+        return tostrprintf("meters %zu (%zu from templates, %zu removed) templates %zu "
+                           "ignored meters %zu hits %zu misses %zu",
+                           meters_.size(), template_meters_.size(), num_removed_meters_,
+                           meter_templates_.size(),
+                           ignored_meters_.size(), ignored_meters_hits_, ignored_meters_misses_);
     }
 
     void forEachMeter(std::function<void(Meter*)> cb)
     {
+        LOCK_METERS(for_each_meter);
         for (auto &meter : meters_)
         {
             cb(meter.get());
@@ -162,6 +530,7 @@ public:
 
     bool hasAllMetersReceivedATelegram()
     {
+        LOCK_METERS(has_all_meters_received_a_telegram);
         if (meters_.size() < meter_templates_.size()) return false;
 
         for (auto &meter : meters_)
@@ -174,6 +543,7 @@ public:
 
     bool hasMeters()
     {
+        LOCK_METERS(has_meters);
         return meters_.size() != 0 || meter_templates_.size() != 0;
     }
 
@@ -197,9 +567,9 @@ public:
                 name.c_str(),
                 id_b[3], id_b[2], id_b[1], id_b[0],
                 manufacturerFlag(mfct).c_str(),
-                manufacturer(mfct).c_str(),
+                manufacturer(mfct),
                 mfct,
-                mediaType(media, mfct).c_str(), media,
+                mediaType(media, mfct), media,
                 version);
 
 
@@ -207,11 +577,11 @@ public:
         warning("(meter) to add support for this unknown mfct,media,version combination\n");
     }
 
-    bool handleTelegram(AboutTelegram &about, vector<uchar> input_frame, bool simulated)
+    bool handleTelegram(shared_ptr<ReceivedFrame> frame, bool simulated)
     {
         if (should_analyze_)
         {
-            analyzeTelegram(about, input_frame, simulated);
+            analyzeTelegram(*frame, simulated);
             return true;
         }
 
@@ -219,122 +589,195 @@ public:
         {
             if (on_telegram_)
             {
-                on_telegram_(about, input_frame);
+                on_telegram_(frame);
             }
             return true;
         }
 
+        if (numDecodeWorkerThreads() > 0)
+        {
+            queueDecodeWork(decodeShard(*frame), [this, frame, simulated]() { dispatchTelegram(frame, simulated); });
+            return true;
+        }
+
+        return dispatchTelegram(frame, simulated);
+    }
+
+    bool dispatchTelegram(shared_ptr<ReceivedFrame> frame, bool simulated)
+    {
         bool handled = false;
         bool exact_id_match = false;
 
-        string ids;
-        for (auto &m : meters_)
+        // Peek at the header, to find the ids used to look up the meters.
+        // Only the meters that match the ids parse the full telegram.
+        HeaderPeek hp;
+        bool ok = peekHeader(frame->about.type, frame->bytes, &hp);
+        vector<string> tids;
+        hp.ids(&tids);
+
+        if (!ok)
         {
-            bool h = m->handleTelegram(about, input_frame, simulated, &ids, &exact_id_match);
-            if (h) handled = true;
+            // No meter or template can match a telegram without a proper header.
+            if (isVerboseEnabled())
+            {
+                string ids = toIdsCommaSeparated(tids);
+                verbose("(wmbus) telegram from %s ignored by all configured meters!\n", ids.c_str());
+            }
+            return false;
+        }
+
+        uint64_t ignored_key = 0;
+        bool cacheable = ignoredMeterKey(*frame, tids, &ignored_key);
+        if (cacheable && isIgnoredMeter(ignored_key))
+        {
+            debug("(meter) dropping telegram from meter that nobody listens to.\n");
+            return false;
+        }
+        string ids = toIdsCommaSeparated(tids);
+
+        // A single pass through the compiled match expressions finds both
+        // the wildcard meters and the templates that match the ids.
+        vector<IdMatch> matches;
+        vector<shared_ptr<Meter>> candidates;
+        {
+            LOCK_METERS(find_candidate_meters);
+            id_matcher_.match(tids, &matches);
+            findCandidateMeters(tids, matches, &candidates);
+        }
+
+        if (cacheable && candidates.size() == 0 && matches.size() == 0)
+        {
+            // Nobody listens to the dll id, the telegrams from this meter can be dropped early.
+            rememberIgnoredMeter(ignored_key);
+        }
+        bool created = false;
+
+        // The candidates are kept alive by the shared_ptrs, even if
+        // another decode worker removes one of them meanwhile.
+        for (shared_ptr<Meter> &m : candidates)
+        {
+            string tmp;
+            bool h = m->handleTelegram(*frame, simulated, &tmp, &exact_id_match);
+            if (h)
+            {
+                handled = true;
+                touchTemplateMeter(m.get());
+            }
         }
 
         // If not properly handled, and there was no exact id match.
         // then lets check if there is a template that can create a meter for it.
         if (!handled && !exact_id_match)
         {
+            // Match owners are only appended while running, thus the matches are still valid.
+            // Hold the lock while creating the meter, since the index and the lru are updated.
+            LOCK_METERS(create_meter_from_template);
             debug("(meter) no meter handled %s checking %d templates.\n", ids.c_str(), meter_templates_.size());
-            // Not handled, maybe we have a template to create a new meter instance for this telegram?
+            // The full header is only needed to check and pick the driver for a new meter.
             Telegram t;
-            t.about = about;
-            bool ok = t.parseHeader(input_frame);
-            if (simulated) t.markAsSimulated();
-
-            if (ok)
+            t.about = frame->about;
+            if (matches.size() > 0)
             {
-                ids = t.idsc;
-                for (auto &mi : meter_templates_)
+                t.parseHeader(frame->bytes);
+                if (simulated) t.markAsSimulated();
+            }
+            // Not handled, maybe we have a template to create a new meter instance for this telegram?
+            for (IdMatch &im : matches)
+            {
+                if (match_owners_[im.owner].meter) continue;
+                MeterInfo &mi = meter_templates_[match_owners_[im.owner].template_index];
+                debug("(meter) %s: for me? %s in %s\n", mi.name.c_str(), t.idsc.c_str(), mi.idsc.c_str());
+                if (MeterCommonImplementation::isTelegramForDriver(&t, mi.name, mi.driver, im.used_wildcard))
                 {
-                    if (MeterCommonImplementation::isTelegramForMeter(&t, NULL, &mi))
+                    // We found a match, make a copy of the meter info.
+                    MeterInfo meter_info = mi;
+                    // Overwrite the wildcard pattern with the highest level id.
+                    // The last id in the t.ids is the highest level id.
+                    // For example: a telegram can have dll_id,tpl_id
+                    // This will pick the tpl_id.
+                    // Or a telegram can have a single dll_id,
+                    // then the dll_id will be picked.
+                    vector<string> tmp_ids;
+                    tmp_ids.push_back(t.ids.back());
+                    meter_info.ids = tmp_ids;
+                    meter_info.idsc = t.ids.back();
+
+                    if (meter_info.driver == MeterDriver::AUTO)
                     {
-                        // We found a match, make a copy of the meter info.
-                        MeterInfo meter_info = mi;
-                        // Overwrite the wildcard pattern with the highest level id.
-                        // The last id in the t.ids is the highest level id.
-                        // For example: a telegram can have dll_id,tpl_id
-                        // This will pick the tpl_id.
-                        // Or a telegram can have a single dll_id,
-                        // then the dll_id will be picked.
-                        vector<string> tmp_ids;
-                        tmp_ids.push_back(t.ids.back());
-                        meter_info.ids = tmp_ids;
-                        meter_info.idsc = t.ids.back();
-
-                        if (meter_info.driver == MeterDriver::AUTO)
+                        // Look up the proper meter driver!
+                        DriverInfo di = pickMeterDriver(&t);
+                        if (di.driver() == MeterDriver::UNKNOWN && di.name().str() == "")
                         {
-                            // Look up the proper meter driver!
-                            DriverInfo di = pickMeterDriver(&t);
-                            if (di.driver() == MeterDriver::UNKNOWN && di.name().str() == "")
+                            if (should_analyze_ == false)
                             {
-                                if (should_analyze_ == false)
-                                {
-                                    // We are not analyzing, so warn here.
-                                    warnForUnknownDriver(mi.name, &t);
-                                }
+                                // We are not analyzing, so warn here.
+                                warnForUnknownDriver(mi.name, &t);
                             }
-                            else
-                            {
-                                meter_info.driver = di.driver();
-                                meter_info.driver_name = di.name();
-                            }
-                        }
-                        // Now build a meter object with for this exact id.
-                        auto meter = createMeter(&meter_info);
-                        addMeter(meter);
-                        string idsc = toIdsCommaSeparated(t.ids);
-                        verbose("(meter) used meter template %s %s %s to match %s\n",
-                                mi.name.c_str(),
-                                mi.idsc.c_str(),
-                                toString(mi.driver).c_str(),
-                                idsc.c_str());
-
-                        if (is_daemon_)
-                        {
-                            notice("(wmbusmeters) started meter %d (%s %s %s)\n",
-                                   meter->index(),
-                                   mi.name.c_str(),
-                                   meter_info.idsc.c_str(),
-                                   toString(mi.driver).c_str());
                         }
                         else
                         {
-                            verbose("(meter) started meter %d (%s %s %s)\n",
-                                   meter->index(),
-                                   mi.name.c_str(),
-                                   meter_info.idsc.c_str(),
-                                   toString(mi.driver).c_str());
+                            meter_info.driver = di.driver();
+                            meter_info.driver_name = di.name();
                         }
+                    }
+                    // Now build a meter object with for this exact id.
+                    auto meter = createMeter(&meter_info);
+                    addTemplateMeter(meter);
+                    created = true;
+                    string idsc = toIdsCommaSeparated(t.ids);
+                    verbose("(meter) used meter template %s %s %s to match %s\n",
+                            mi.name.c_str(),
+                            mi.idsc.c_str(),
+                            toString(mi.driver).c_str(),
+                            idsc.c_str());
+
+                    if (is_daemon_)
+                    {
+                        notice("(wmbusmeters) started meter %d (%s %s %s)\n",
+                               meter->index(),
+                               mi.name.c_str(),
+                               meter_info.idsc.c_str(),
+                               toString(mi.driver).c_str());
+                    }
+                    else
+                    {
+                        verbose("(meter) started meter %d (%s %s %s)\n",
+                               meter->index(),
+                               mi.name.c_str(),
+                               meter_info.idsc.c_str(),
+                               toString(mi.driver).c_str());
+                    }
 
-                        bool match = false;
-                        bool h = meter->handleTelegram(about, input_frame, simulated, &ids, &match);
-                        if (!match)
-                        {
-                            // Oups, we added a new meter object tailored for this telegram
-                            // but it still did not match! This is probably an error in wmbusmeters!
-                            warning("(meter) newly created meter (%s %s %s) did not match telegram! ",
-                                    "Please open an issue at https://github.com/weetmuts/wmbusmeters/\n",
-                                    meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str());
-                        }
-                        else if (!h)
-                        {
-                            // Oups, we added a new meter object tailored for this telegram
-                            // but it still did not handle it! This can happen if the wrong
-                            // decryption key was used.
-                            warning("(meter) newly created meter (%s %s %s) did not handle telegram!\n",
-                                    meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str());
-                        }
-                        else
-                        {
-                            handled = true;
-                        }
+                    bool match = false;
+                    bool h = meter->handleTelegram(*frame, simulated, &ids, &match);
+                    if (!match)
+                    {
+                        // Oups, we added a new meter object tailored for this telegram
+                        // but it still did not match! This is probably an error in wmbusmeters!
+                        warning("(meter) newly created meter (%s %s %s) did not match telegram! ",
+                                "Please open an issue at https://github.com/weetmuts/wmbusmeters/\n",
+                                meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str());
+                    }
+                    else if (!h)
+                    {
+                        // Oups, we added a new meter object tailored for this telegram
+                        // but it still did not handle it! This can happen if the wrong
+                        // decryption key was used.
+                        warning("(meter) newly created meter (%s %s %s) did not handle telegram!\n",
+                                meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str());
+                    }
+                    else
+                    {
+                        handled = true;
                     }
                 }
             }
+            if (cacheable && candidates.size() == 0 && matches.size() > 0 && !created)
+            {
+                // The templates matched the dll id, but rejected the driver. The mfct, version and type
+                // that decide the driver are part of the key, thus the next telegram is rejected as well.
+                rememberIgnoredMeter(ignored_key);
+            }
         }
         if (isVerboseEnabled() && !handled)
         {
@@ -343,7 +786,7 @@ public:
         return handled;
     }
 
-    void onTelegram(function<void(AboutTelegram &about, vector<uchar>)> cb)
+    void onTelegram(function<void(shared_ptr<ReceivedFrame>)> cb)
     {
         on_telegram_ = cb;
     }
@@ -355,27 +798,101 @@ public:
 
     void pollMeters(shared_ptr<BusManager> bus)
     {
+        LOCK_METERS(poll_meters);
         for (auto &m : meters_)
         {
             m->poll(bus);
         }
     }
 
-    void analyzeEnabled(bool b, OutputFormat f, string force_driver, string key, bool verbose)
+    void analyzeEnabled(bool b, OutputFormat f, string force_driver, string key, bool verbose, int threads)
     {
         should_analyze_ = b;
         analyze_format_ = f;
         analyze_driver_ = force_driver;
         analyze_key_ = key;
         analyze_verbose_ = verbose;
+        analyze_threads_ = threads;
+    }
+
+    // The outcome of decoding the analyzed telegram with one driver.
+    struct DriverTrial
+    {
+        MeterDriver driver {}; // Old style driver, or UNKNOWN for a new style driver.
+        string name;
+        bool handled {};
+        int length {};
+        int understood {};
+    };
+
+    // Each trial gets its own meter and telegram, thus the trials can run in parallel.
+    void runDriverTrials(MeterInfo &mi, vector<DriverTrial> *trials, const ReceivedFrame &frame, bool simulated)
+    {
+        int num_threads = analyze_threads_ > 0 ? analyze_threads_ : numCpus();
+        runInParallel(trials->size(), num_threads, [&](size_t i)
+        {
+            DriverTrial &dt = (*trials)[i];
+            MeterInfo tmi = mi;
+            tmi.driver = dt.driver;
+            tmi.driver_name = DriverName(dt.driver == MeterDriver::UNKNOWN ? dt.name : "");
+
+            debug("Testing %s style driver %s...\n", dt.driver == MeterDriver::UNKNOWN ? "new" : "old", dt.name.c_str());
+            auto meter = createMeter(&tmi);
+
+            Telegram t;
+            bool match = false;
+            string id;
+            bool h = meter->handleTelegram(frame, simulated, &id, &match, &t);
+            if (!match)
+            {
+                debug("no match!\n");
+            }
+            else if (!h)
+            {
+                // Oups, we added a new meter object tailored for this telegram
+                // but it still did not handle it! This can happen if the wrong
+                // decryption key was used. But it is ok if analyzing....
+                debug("Newly created meter (%s %s %s) did not handle telegram!\n",
+                      meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str());
+            }
+            else
+            {
+                t.analyzeParse(OutputFormat::NONE, &dt.length, &dt.understood);
+                dt.handled = true;
+            }
+        });
+    }
+
+    // Pick the driver that understood most of the telegram. The trials are in driver list
+    // order and a tie is won by the earlier driver, so the result does not depend on the
+    // order in which the trials finished.
+    string pickBestDriverTrial(vector<DriverTrial> &trials,
+                               const char *style,
+                               int *best_length,
+                               int *best_understood,
+                               bool verbose)
+    {
+        string best_driver = "";
+        for (DriverTrial &dt : trials)
+        {
+            if (!dt.handled) continue;
+            if (verbose) printf("(verbose) %s %02d/%02d %s\n", style, dt.understood, dt.length, dt.name.c_str());
+            if (dt.understood > *best_understood)
+            {
+                *best_understood = dt.understood;
+                *best_length = dt.length;
+                best_driver = dt.name;
+                if (verbose) printf("(verbose) %s best so far: %s %02d/%02d\n", style, best_driver.c_str(), dt.understood, dt.length);
+            }
+        }
+        return best_driver;
     }
 
     string findBestOldStyleDriver(MeterInfo &mi,
                                   int *best_length,
                                   int *best_understood,
                                   Telegram &t,
-                                  AboutTelegram &about,
-                                  vector<uchar> &input_frame,
+                                  const ReceivedFrame &frame,
                                   bool simulated,
                                   string only)
     {
@@ -384,7 +901,7 @@ public:
 LIST_OF_METERS
 #undef X
 
-        string best_driver = "";
+        vector<DriverTrial> trials;
         for (MeterDriver odr : old_drivers)
         {
             if (odr == MeterDriver::AUTO) continue;
@@ -398,111 +915,58 @@ LIST_OF_METERS
                 // Sanity check, skip this driver since it is not relevant for this media.
                 continue;
             }
+            DriverTrial dt;
+            dt.driver = odr;
+            dt.name = driver_name;
+            trials.push_back(dt);
+        }
 
+        runDriverTrials(mi, &trials, frame, simulated);
 
-            debug("Testing old style driver %s...\n", driver_name.c_str());
-            mi.driver = odr;
-            mi.driver_name = DriverName("");
-
-            auto meter = createMeter(&mi);
-
-            bool match = false;
-            string id;
-            bool h = meter->handleTelegram(about, input_frame, simulated, &id, &match, &t);
-            if (!match)
-            {
-                debug("no match!\n");
-            }
-            else if (!h)
-            {
-                // Oups, we added a new meter object tailored for this telegram
-                // but it still did not handle it! This can happen if the wrong
-                // decryption key was used. But it is ok if analyzing....
-                debug("Newly created meter (%s %s %s) did not handle telegram!\n",
-                      meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str());
-            }
-            else
-            {
-                int l = 0;
-                int u = 0;
-                t.analyzeParse(OutputFormat::NONE, &l, &u);
-                if (analyze_verbose_ && only == "") printf("(verbose) old %02d/%02d %s\n", u, l, driver_name.c_str());
-                if (u > *best_understood)
-                {
-                    *best_understood = u;
-                    *best_length = l;
-                    best_driver = driver_name;
-                    if (analyze_verbose_ && only == "") printf("(verbose) old best so far: %s %02d/%02d\n", best_driver.c_str(), u, l);
-                }
-            }
-        }
-        return best_driver;
+        return pickBestDriverTrial(trials, "old", best_length, best_understood, analyze_verbose_ && only == "");
     }
 
     string findBestNewStyleDriver(MeterInfo &mi,
                                   int *best_length,
                                   int *best_understood,
                                   Telegram &t,
-                                  AboutTelegram &about,
-                                  vector<uchar> &input_frame,
+                                  const ReceivedFrame &frame,
                                   bool simulated,
                                   string only)
     {
-        string best_driver = "";
-
-        for (DriverInfo ndr : all_registered_drivers_list_)
+        vector<DriverTrial> trials;
+        for (DriverInfo &ndr : all_registered_drivers_list_)
         {
             string driver_name = toString(ndr);
             if (only != "" && driver_name != only) continue;
 
-            debug("Testing new style driver %s...\n", driver_name.c_str());
-            mi.driver = MeterDriver::UNKNOWN;
-            mi.driver_name = driver_name;
-
-            auto meter = createMeter(&mi);
-
-            bool match = false;
-            string id;
-            bool h = meter->handleTelegram(about, input_frame, simulated, &id, &match, &t);
-
-            if (!match)
-            {
-                debug("no match!\n");
-            }
-            else if (!h)
-            {
-                // Oups, we added a new meter object tailored for this telegram
-                // but it still did not handle it! This can happen if the wrong
-                // decryption key was used. But it is ok if analyzing....
-                debug("Newly created meter (%s %s %s) did not handle telegram!\n",
-                      meter->name().c_str(), meter->idsc().c_str(), meter->driverName().str().c_str());
-            }
-            else
+            if (only == "" &&
+                ndr.detect().size() > 0 &&
+                !ndr.isCloseEnoughMedia(t.dll_type) &&
+                !ndr.isCloseEnoughMedia(t.tpl_type))
             {
-                int l = 0;
-                int u = 0;
-                t.analyzeParse(OutputFormat::NONE, &l, &u);
-                if (analyze_verbose_ && only == "") printf("(verbose) new %02d/%02d %s\n", u, l, driver_name.c_str());
-                if (u > *best_understood)
-                {
-                    *best_understood = u;
-                    *best_length = l;
-                    best_driver = ndr.name().str();
-                    if (analyze_verbose_ && only == "") printf("(verbose) new best so far: %s %02d/%02d\n", best_driver.c_str(), u, l);
-                }
+                // Sanity check, skip this driver since it is not relevant for this media.
+                continue;
             }
+            DriverTrial dt;
+            dt.driver = MeterDriver::UNKNOWN;
+            dt.name = driver_name;
+            trials.push_back(dt);
         }
-        return best_driver;
+
+        runDriverTrials(mi, &trials, frame, simulated);
+
+        return pickBestDriverTrial(trials, "new", best_length, best_understood, analyze_verbose_ && only == "");
     }
 
-    void analyzeTelegram(AboutTelegram &about, vector<uchar> &input_frame, bool simulated)
+    void analyzeTelegram(const ReceivedFrame &frame, bool simulated)
     {
         Telegram t;
-        t.about = about;
+        t.about = frame.about;
 
-        bool ok = t.parseHeader(input_frame);
         if (simulated) t.markAsSimulated();
         t.markAsBeingAnalyzed();
+        bool ok = t.parseHeader(frame.bytes);
 
         if (!ok)
         {
@@ -539,11 +1003,11 @@ LIST_OF_METERS
 
         int old_best_length = 0;
         int old_best_understood = 0;
-        string best_old_driver = findBestOldStyleDriver(mi, &old_best_length, &old_best_understood, t, about, input_frame, simulated, "");
+        string best_old_driver = findBestOldStyleDriver(mi, &old_best_length, &old_best_understood, t, frame, simulated, "");
 
         int new_best_length = 0;
         int new_best_understood = 0;
-        string best_new_driver = findBestNewStyleDriver(mi, &new_best_length, &new_best_understood, t, about, input_frame, simulated, "");
+        string best_new_driver = findBestNewStyleDriver(mi, &new_best_length, &new_best_understood, t, frame, simulated, "");
 
         mi.driver = MeterDriver::UNKNOWN;
         mi.driver_name = DriverName("");
@@ -573,7 +1037,7 @@ LIST_OF_METERS
 
         if (force_driver != "")
         {
-            using_driver = findBestOldStyleDriver(mi, &force_length, &force_understood, t, about, input_frame, simulated,
+            using_driver = findBestOldStyleDriver(mi, &force_length, &force_understood, t, frame, simulated,
                                                   force_driver);
 
             if (using_driver != "")
@@ -583,7 +1047,7 @@ LIST_OF_METERS
             }
             else
             {
-                using_driver = findBestNewStyleDriver(mi, &force_length, &force_understood, t, about, input_frame, simulated,
+                using_driver = findBestNewStyleDriver(mi, &force_length, &force_understood, t, frame, simulated,
                                                       force_driver);
                 mi.driver_name = using_driver;
                 mi.driver = MeterDriver::UNKNOWN;
@@ -626,7 +1090,7 @@ LIST_OF_METERS
         bool match = false;
         string id;
 
-        meter->handleTelegram(about, input_frame, simulated, &id, &match, &t);
+        meter->handleTelegram(frame, simulated, &id, &match, &t);
 
         int u = 0;
         int l = 0;
@@ -657,6 +1121,16 @@ LIST_OF_METERS
     ~MeterManagerImplementation() {}
 };
 
+uint64_t decodeShard(const ReceivedFrame &frame)
+{
+    // Shard on the dll mfct and id, so that all telegrams from the same dll address
+    // are decoded in the order they arrived by the same worker thread. The address is
+    // hashed, since the raw bytes begin with the mfct, which is the same for most meters
+    // of a site, and would then put all of them on the same worker.
+    if (frame.about.type != FrameType::WMBUS || frame.bytes.size() < 8) return 0;
+    return hash64(&frame.bytes[2], 6);
+}
+
 shared_ptr<MeterManager> createMeterManager(bool daemon)
 {
     return shared_ptr<MeterManager>(new MeterManagerImplementation(daemon));
@@ -671,7 +1145,9 @@ MeterCommonImplementation::MeterCommonImplementation(MeterInfo &mi,
 
     if (mi.key.length() > 0)
     {
-        hex2bin(mi.key, &meter_keys_.confidentiality_key);
+        vector<uchar> key;
+        hex2bin(mi.key, &key);
+        meter_keys_.setConfidentialityKey(key);
     }
     for (auto s : mi.shells) {
         addShell(s);
@@ -690,7 +1166,9 @@ MeterCommonImplementation::MeterCommonImplementation(MeterInfo &mi,
 
     if (mi.key.length() > 0)
     {
-        hex2bin(mi.key, &meter_keys_.confidentiality_key);
+        vector<uchar> key;
+        hex2bin(mi.key, &key);
+        meter_keys_.setConfidentialityKey(key);
     }
     for (auto s : mi.shells) {
         addShell(s);
@@ -868,24 +1346,11 @@ void MeterCommonImplementation::addFieldWithExtractor(
     fields_.push_back(field_name);
 
     // Compose the extract function.
-    function<bool(FieldInfo *p,Meter *m, Telegram *t)> extract =
-              [](FieldInfo *fi, Meter *m, Telegram *t)
+    function<bool(FieldInfo *p,Meter *m, Telegram *t, const string &key)> extract =
+              [](FieldInfo *fi, Meter *m, Telegram *t, const string &key)
               {
                   bool found = false;
-                  string key = fi->difVifKey().str();
                   int offset {};
-                  if (key == "")
-                  {
-                      // Search for key.
-                      bool ok = findKeyWithNr(fi->measurementType(),
-                                              fi->valueInformation(),
-                                              fi->storageNr().intValue(),
-                                              fi->tariffNr().intValue(),
-                                              fi->indexNr().intValue(),
-                                              &key,
-                                              &t->values);
-                      if (!ok) return false;
-                  }
                   double extracted_double_value = NAN;
                   if (extractDVdouble(&t->values,
                                       key,
@@ -995,24 +1460,11 @@ void MeterCommonImplementation::addStringFieldWithExtractor(
     fields_.push_back(field_name);
 
     // Compose the extract function.
-    function<bool(FieldInfo *p,Meter *m, Telegram *t)> extract =
-                  [](FieldInfo *fi, Meter *m, Telegram *t)
+    function<bool(FieldInfo *p,Meter *m, Telegram *t, const string &key)> extract =
+                  [](FieldInfo *fi, Meter *m, Telegram *t, const string &key)
                   {
                       bool found = false;
-                      string key = fi->difVifKey().str();
                       int offset {};
-                      if (key == "")
-                      {
-                          // Search for key.
-                          bool ok = findKeyWithNr(fi->measurementType(),
-                                                  fi->valueInformation(),
-                                                  fi->storageNr().intValue(),
-                                                  fi->tariffNr().intValue(),
-                                                  fi->indexNr().intValue(),
-                                                  &key,
-                                                  &t->values);
-                          if (!ok) return false;
-                      }
                       if (fi->valueInformation() == ValueInformation::DateTime)
                       {
                           struct tm datetime;
@@ -1096,24 +1548,11 @@ void MeterCommonImplementation::addStringFieldWithExtractorAndLookup(
     fields_.push_back(field_name);
 
     // Compose the extract function.
-    function<bool(FieldInfo *p,Meter *m, Telegram *t)> extract =
-                  [](FieldInfo *fi, Meter *m, Telegram *t)
+    function<bool(FieldInfo *p,Meter *m, Telegram *t, const string &key)> extract =
+                  [](FieldInfo *fi, Meter *m, Telegram *t, const string &key)
                   {
                       bool found = false;
-                      string key = fi->difVifKey().str();
                       int offset {};
-                      if (key == "")
-                      {
-                          // Search for key.
-                          bool ok = findKeyWithNr(fi->measurementType(),
-                                                  fi->valueInformation(),
-                                                  fi->storageNr().intValue(),
-                                                  fi->tariffNr().intValue(),
-                                                  fi->indexNr().intValue(),
-                                                  &key,
-                                                  &t->values);
-                          if (!ok) return false;
-                      }
                       uint64_t extracted_bits {};
                       if (extractDVlong(&t->values, key, &offset, &extracted_bits))
                       {
@@ -1316,6 +1755,47 @@ bool MeterCommonImplementation::isTelegramForMeter(Telegram *t, Meter *meter, Me
         return false;
     }
 
+    return isTelegramForDriver(t, name, driver, used_wildcard);
+}
+
+bool MeterCommonImplementation::isTelegramForMeter(HeaderPeek *hp, vector<string> &tids,
+                                                   const ReceivedFrame &frame, Meter *meter, Telegram *t)
+{
+    if (isDebugEnabled())
+    {
+        string tidsc = toIdsCommaSeparated(tids);
+        debug("(meter) %s: for me? %s in %s\n", meter->name().c_str(), tidsc.c_str(), meter->idsc().c_str());
+    }
+
+    bool used_wildcard = false;
+    bool id_match = doesIdsMatchExpressions(tids, meter->ids(), &used_wildcard);
+
+    if (!id_match) {
+        // The id must match.
+        debug("(meter) %s: not for me: not my id\n", meter->name().c_str());
+        return false;
+    }
+
+    MeterDriver driver = meter->driver();
+    bool valid_driver = isMeterDriverValid(driver, hp->dll_mfct, hp->dll_type, hp->dll_version);
+    if (!valid_driver && hp->tpl_id_found)
+    {
+        valid_driver = isMeterDriverValid(driver, hp->tpl_mfct, hp->tpl_type, hp->tpl_version);
+    }
+    if (valid_driver || driver == MeterDriver::AUTO)
+    {
+        debug("(meter) %s: yes for me\n", meter->name().c_str());
+        return true;
+    }
+
+    // The driver does not match, parse the header to ignore or warn as usual.
+    t->parseHeader(frame.bytes);
+    string name = meter->name();
+    return isTelegramForDriver(t, name, driver, used_wildcard);
+}
+
+bool MeterCommonImplementation::isTelegramForDriver(Telegram *t, string &name, MeterDriver driver, bool used_wildcard)
+{
     bool valid_driver = isMeterDriverValid(driver, t->dll_mfct, t->dll_type, t->dll_version);
     if (!valid_driver && t->tpl_id_found)
     {
@@ -1353,9 +1833,9 @@ bool MeterCommonImplementation::isTelegramForMeter(Telegram *t, Meter *meter, Me
                         possible_drivers.c_str(),
                         t->dll_id_b[3], t->dll_id_b[2], t->dll_id_b[1], t->dll_id_b[0],
                         manufacturerFlag(t->dll_mfct).c_str(),
-                        manufacturer(t->dll_mfct).c_str(),
+                        manufacturer(t->dll_mfct),
                         t->dll_mfct,
-                        mediaType(t->dll_type, t->dll_mfct).c_str(), t->dll_type,
+                        mediaType(t->dll_type, t->dll_mfct), t->dll_type,
                         t->dll_version);
 
                 if (possible_drivers == "unknown!")
@@ -1490,6 +1970,11 @@ bool checkCommonField(string *buf, string field, Meter *m, Telegram *t, char c)
         *buf += t->about.device + c;
         return true;
     }
+    if (field == "devices")
+    {
+        *buf += t->about.devices + c;
+        return true;
+    }
     if (field == "rssi_dbm")
     {
         *buf += to_string(t->about.rssi_dbm) + c;
@@ -1590,67 +2075,97 @@ string concatFields(Meter *m, Telegram *t, char c, vector<FieldInfo> &prints, ve
     return buf;
 }
 
-bool MeterCommonImplementation::handleTelegram(AboutTelegram &about, vector<uchar> input_frame,
+bool MeterCommonImplementation::handleTelegram(const ReceivedFrame &frame,
                                                bool simulated, string *ids, bool *id_match, Telegram *out_analyzed)
 {
-    Telegram t;
-    t.about = about;
-    bool ok = t.parseHeader(input_frame);
+    // Check the ids and the driver using only a peek at the header,
+    // the telegram is only parsed if it is intended for this meter.
+    HeaderPeek hp;
+    bool ok = peekHeader(frame.about.type, frame.bytes, &hp);
+    vector<string> tids;
+    hp.ids(&tids);
 
-    if (simulated) t.markAsSimulated();
-    if (out_analyzed != NULL) t.markAsBeingAnalyzed();
+    *ids = toIdsCommaSeparated(tids);
 
-    *ids = t.idsc;
+    PooledTelegram t;
+    t->about = frame.about;
+    if (simulated) t->markAsSimulated();
+    if (out_analyzed != NULL) t->markAsBeingAnalyzed();
 
-    if (!ok || !isTelegramForMeter(&t, this, NULL))
+    if (!ok || !isTelegramForMeter(&hp, tids, frame, this, t.get()))
     {
         // This telegram is not intended for this meter.
         return false;
     }
 
     *id_match = true;
-    verbose("(meter) %s %s handling telegram from %s\n", name().c_str(), meterDriver().c_str(), t.ids.back().c_str());
+    // Parse, extract, update and print while holding the lock of this meter.
+    LOCK_METER(handle_telegram);
+    verbose("(meter) %s %s handling telegram from %s\n", name().c_str(), meterDriver().c_str(), tids.back().c_str());
 
     if (isDebugEnabled())
     {
-        string msg = bin2hex(input_frame);
-        debug("(meter) %s %s \"%s\"\n", name().c_str(), t.ids.back().c_str(), msg.c_str());
+        string msg = bin2hex(frame.bytes);
+        debug("(meter) %s %s \"%s\"\n", name().c_str(), tids.back().c_str(), msg.c_str());
     }
 
-    ok = t.parse(input_frame, &meter_keys_, true);
+    ok = t->parse(frame.bytes, &meter_keys_, true);
     if (!ok)
     {
-        if (out_analyzed != NULL) *out_analyzed = t;
+        if (out_analyzed != NULL) *out_analyzed = *t;
         // Ignoring telegram since it could not be parsed.
         return false;
     }
 
     char log_prefix[256];
     snprintf(log_prefix, 255, "(%s) log", meterDriver().c_str());
-    logTelegram(t.original, t.frame, t.header_size, t.suffix_size);
+    logTelegram(t->original, t->frame, t->header_size, t->suffix_size);
 
     // Invoke standardized field extractors!
-    processFieldExtractors(&t);
+    processFieldExtractors(t.get());
     // Invoke tailor made meter specific parsing!
-    processContent(&t);
+    processContent(t.get());
     // All done....
 
     if (isDebugEnabled())
     {
         char log_prefix[256];
         snprintf(log_prefix, 255, "(%s)", meterDriver().c_str());
-        t.explainParse(log_prefix, 0);
+        t->explainParse(log_prefix, 0);
     }
-    triggerUpdate(&t);
-    if (out_analyzed != NULL) *out_analyzed = t;
+    triggerUpdate(t.get());
+    if (out_analyzed != NULL) *out_analyzed = *t;
     return true;
 }
 
 void MeterCommonImplementation::processFieldExtractors(Telegram *t)
 {
-    for (auto &fi : prints_)
+    if (extraction_plans_.size() >= 16 && extraction_plans_.count(t->dv_format_hash) == 0)
+    {
+        // Something is odd with this meter, do not let the plans grow forever.
+        extraction_plans_.clear();
+    }
+    ExtractionPlan &plan = extraction_plans_[t->dv_format_hash];
+    if (plan.keys.size() != prints_.size() || !t->values.hasLayout(plan.layout))
     {
-        fi.performExtraction(this, t);
+        // A new layout (or a format hash collision), find the keys of the fields.
+        t->values.layout(&plan.layout);
+        plan.keys.clear();
+        num_extraction_plans_resolved_++;
+        for (auto &fi : prints_)
+        {
+            string key;
+            if (fi.hasExtractor()) fi.findKey(t, &key);
+            plan.keys.push_back(key);
+        }
+    }
+
+    for (size_t i = 0; i < prints_.size(); ++i)
+    {
+        if (plan.keys[i] != "")
+        {
+            prints_[i].performExtraction(this, t, plan.keys[i]);
+        }
     }
 }
 
@@ -1785,6 +2300,10 @@ void MeterCommonImplementation::printMeter(Telegram *t,
     {
         s += ","+newline;
         s += indent+"\"device\":\""+t->about.device+"\","+newline;
+        if (t->about.devices != "")
+        {
+            s += indent+"\"devices\":\""+t->about.devices+"\","+newline;
+        }
         s += indent+"\"rssi_dbm\":"+to_string(t->about.rssi_dbm);
     }
     for (string extra_field : meterExtraConstantFields())
@@ -1820,6 +2339,7 @@ void MeterCommonImplementation::printMeter(Telegram *t,
     if (t->about.device != "")
     {
         envs->push_back(string("METER_DEVICE=")+t->about.device);
+        if (t->about.devices != "") envs->push_back(string("METER_DEVICES=")+t->about.devices);
         envs->push_back(string("METER_RSSI_DBM=")+to_string(t->about.rssi_dbm));
     }
 
@@ -1883,34 +2403,27 @@ ELLSecurityMode MeterCommonImplementation::expectedELLSecurityMode()
 
 void detectMeterDrivers(int manufacturer, int media, int version, vector<string> *drivers)
 {
-#define X(TY,MA,ME,VE) { if (manufacturer == MA && (media == ME || ME == -1) && (version == VE || VE == -1)) { drivers->push_back(toString(MeterDriver::TY)); }}
-METER_DETECTION
-#undef X
+    DetectedDrivers *dd = lookupDetection(manufacturer, media, version);
+    if (dd == NULL) return;
 
-    for (auto &p : all_registered_drivers_)
+    for (MeterDriver md : dd->old_style)
     {
-        if (p.second.detect(manufacturer, media, version))
-        {
-            drivers->push_back(p.second.name().str());
-        }
+        drivers->push_back(toString(md));
+    }
+    for (DriverInfo *di : dd->new_style)
+    {
+        drivers->push_back(di->name().str());
     }
 }
 
 bool isMeterDriverValid(MeterDriver type, int manufacturer, int media, int version)
 {
-#define X(TY,MA,ME,VE) { if (type == MeterDriver::TY && manufacturer == MA && (media == ME || ME == -1) && (version == VE || VE == -1)) { return true; }}
-METER_DETECTION
-#undef X
+    DetectedDrivers *dd = lookupDetection(manufacturer, media, version);
+    if (dd == NULL) return false;
 
-    for (auto &p : all_registered_drivers_)
-    {
-        if (p.second.detect(manufacturer, media, version))
-        {
-            return true;
-        }
-    }
+    if (dd->new_style.size() > 0) return true;
 
-    return false;
+    return std::find(dd->old_style.begin(), dd->old_style.end(), type) != dd->old_style.end();
 }
 
 bool isMeterDriverReasonableForMedia(MeterDriver type, string driver_name, int media)
@@ -1949,16 +2462,11 @@ DriverInfo pickMeterDriver(Telegram *t)
         version = t->tpl_version;
     }
 
-#define X(TY,MA,ME,VE) { if (manufacturer == MA && (media == ME || ME == -1) && (version == VE || VE == -1)) { return MeterDriver::TY; }}
-METER_DETECTION
-#undef X
-
-    for (auto &p : all_registered_drivers_)
+    DetectedDrivers *dd = lookupDetection(manufacturer, media, version);
+    if (dd != NULL)
     {
-        if (p.second.detect(manufacturer, media, version))
-        {
-            return p.second;
-        }
+        if (dd->old_style.size() > 0) return dd->old_style.front();
+        if (dd->new_style.size() > 0) return *dd->new_style.front();
     }
 
     return MeterDriver::UNKNOWN;
@@ -1970,9 +2478,10 @@ shared_ptr<Meter> createMeter(MeterInfo *mi)
 
     const char *keymsg = (mi->key[0] == 0) ? "not-encrypted" : "encrypted";
 
-    if (all_registered_drivers_.count(mi->driver_name.str()) != 0)
+    auto i = all_registered_drivers_.find(mi->driver_name.str());
+    if (i != all_registered_drivers_.end())
     {
-        DriverInfo& di = all_registered_drivers_[mi->driver_name.str()];
+        DriverInfo& di = i->second;
         shared_ptr<Meter> newm = di.construct(*mi);
         newm->addConversions(mi->conversions);
         verbose("(meter) constructed \"%s\" \"%s\" \"%s\" %s\n",
@@ -2163,16 +2672,32 @@ bool isValidKey(string& key, MeterDriver mt)
 }
 
 
-void FieldInfo::performExtraction(Meter *m, Telegram *t)
+bool FieldInfo::findKey(Telegram *t, string *key)
+{
+    if (!dif_vif_key_.useSearchInstead())
+    {
+        *key = dif_vif_key_.str();
+        return true;
+    }
+    return findKeyWithNr(measurement_type_,
+                         value_information_,
+                         storage_nr_.intValue(),
+                         tariff_nr_.intValue(),
+                         index_nr_.intValue(),
+                         key,
+                         &t->values);
+}
+
+void FieldInfo::performExtraction(Meter *m, Telegram *t, const string &key)
 {
     if (extract_double_)
     {
-        extract_double_(this, m, t);
+        extract_double_(this, m, t, key);
     }
 
     if (extract_string_)
     {
-        extract_string_(this, m, t);
+        extract_string_(this, m, t, key);
     }
 }
 
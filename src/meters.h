@@ -301,8 +301,8 @@ struct FieldInfo
               function<string()> get_value_string,
               function<void(Unit,double)> set_value_double,
               function<void(string)> set_value_string,
-              function<bool(FieldInfo*, Meter *mi, Telegram *t)> extract_double,
-              function<bool(FieldInfo*, Meter *mi, Telegram *t)> extract_string,
+              function<bool(FieldInfo*, Meter *mi, Telegram *t, const string &key)> extract_double,
+              function<bool(FieldInfo*, Meter *mi, Telegram *t, const string &key)> extract_string,
               Translate::Lookup lookup
         ) :
         vname_(vname),
@@ -353,7 +353,10 @@ struct FieldInfo
     void setValueDouble(Unit u, double d) { if (set_value_double_) set_value_double_(u, d);  }
     void setValueString(string s) { if (set_value_string_) set_value_string_(s); }
 
-    void performExtraction(Meter *m, Telegram *t);
+    bool hasExtractor() { return extract_double_ || extract_string_; }
+    // Find the key of the dif/vif value for this field in the telegram.
+    bool findKey(Telegram *t, string *key);
+    void performExtraction(Meter *m, Telegram *t, const string &key);
 
     string renderJsonOnlyDefaultUnit();
     string renderJson(vector<Unit> *additional_conversions);
@@ -383,8 +386,8 @@ private:
     function<string()> get_value_string_; // Callback to fetch the value from the meter.
     function<void(Unit,double)> set_value_double_; // Call back to set the value in the c++ object
     function<void(string)> set_value_string_; // Call back to set the value string in the c++ object
-    function<bool(FieldInfo*, Meter *mi, Telegram *t)> extract_double_; // Extract field from telegram and insert into meter.
-    function<bool(FieldInfo*, Meter *mi, Telegram *t)> extract_string_; // Extract field from telegram and insert into meter.
+    function<bool(FieldInfo*, Meter *mi, Telegram *t, const string &key)> extract_double_; // Extract field from telegram and insert into meter.
+    function<bool(FieldInfo*, Meter *mi, Telegram *t, const string &key)> extract_string_; // Extract field from telegram and insert into meter.
     Translate::Lookup lookup_;
 };
 
@@ -429,7 +432,7 @@ struct Meter
     // The handleTelegram expects an input_frame where the DLL crcs have been removed.
     // Returns true of this meter handled this telegram!
     // Sets id_match to true, if there was an id match, even though the telegram could not be properly handled.
-    virtual bool handleTelegram(AboutTelegram &about, vector<uchar> input_frame,
+    virtual bool handleTelegram(const ReceivedFrame &frame,
                                 bool simulated, string *id, bool *id_match, Telegram *out_t = NULL) = 0;
     virtual MeterKeys *meterKeys() = 0;
 
@@ -451,20 +454,35 @@ struct MeterManager
     virtual void addMeter(shared_ptr<Meter> meter) = 0;
     virtual Meter*lastAddedMeter() = 0;
     virtual void removeAllMeters() = 0;
+    // Limit the number of meters created from templates, zero means no limit.
+    // When the limit is reached, the least recently updated meter is removed.
+    virtual void setMaxMeters(size_t n) = 0;
+    // Remove the meters created from templates that have not been updated for
+    // this many seconds, zero means that idle meters are never removed.
+    // The idle meters are removed by removeIdleMeters and before a meter is created.
+    virtual void setMeterIdleTimeout(time_t seconds) = 0;
+    virtual void removeIdleMeters(time_t now) = 0;
+    // Remember at most max_size meters that nobody listens to, for ttl seconds.
+    // A max_size of zero disables the cache of ignored meters.
+    virtual void setIgnoredMetersCache(size_t max_size, time_t ttl) = 0;
     virtual void forEachMeter(std::function<void(Meter*)> cb) = 0;
-    virtual bool handleTelegram(AboutTelegram &about, vector<uchar> data, bool simulated) = 0;
+    virtual bool handleTelegram(shared_ptr<ReceivedFrame> frame, bool simulated) = 0;
     virtual bool hasAllMetersReceivedATelegram() = 0;
     virtual bool hasMeters() = 0;
-    virtual void onTelegram(function<void(AboutTelegram&,vector<uchar>)> cb) = 0;
+    virtual void onTelegram(function<void(shared_ptr<ReceivedFrame>)> cb) = 0;
     virtual void whenMeterUpdated(std::function<void(Telegram*t,Meter*)> cb) = 0;
     virtual void pollMeters(shared_ptr<BusManager> bus) = 0;
-    virtual void analyzeEnabled(bool b, OutputFormat f, string force_driver, string key, bool verbose) = 0;
-    virtual void analyzeTelegram(AboutTelegram &about, vector<uchar> &input_frame, bool simulated) = 0;
+    virtual void analyzeEnabled(bool b, OutputFormat f, string force_driver, string key, bool verbose, int threads) = 0;
+    virtual void analyzeTelegram(const ReceivedFrame &frame, bool simulated) = 0;
+    // Counters for the meters, templates and the cache of ignored meters.
+    virtual string statistics() = 0;
 
     virtual ~MeterManager() = default;
 };
 
 shared_ptr<MeterManager> createMeterManager(bool daemon);
+// The shard of the decode worker thread for a received frame, see queueDecodeWork.
+uint64_t decodeShard(const ReceivedFrame &frame);
 
 const char *toString(MeterType type);
 string toString(MeterDriver driver);
@@ -20,6 +20,7 @@
 
 #include"dvparser.h"
 #include"meters.h"
+#include"threads.h"
 #include"units.h"
 
 #include<map>
@@ -56,6 +57,12 @@ struct MeterCommonImplementation : public virtual Meter
     int numUpdates();
 
     static bool isTelegramForMeter(Telegram *t, Meter *meter, MeterInfo *mi);
+    // Same check using only a peek at the header of the frame. The header is parsed
+    // into t only when the driver does not match, to warn about it.
+    static bool isTelegramForMeter(HeaderPeek *hp, vector<string> &tids, const ReceivedFrame &frame,
+                                   Meter *meter, Telegram *t);
+    // The ids of the telegram are known to match, now check if the driver is right for the telegram.
+    static bool isTelegramForDriver(Telegram *t, string &name, MeterDriver driver, bool used_wildcard);
     MeterKeys *meterKeys();
 
     MeterCommonImplementation(MeterInfo &mi, string driver);
@@ -64,6 +71,8 @@ struct MeterCommonImplementation : public virtual Meter
     ~MeterCommonImplementation() = default;
 
     string meterDriver() { return driver_; }
+    // How many times the keys of the fields were searched for, instead of taken from an extraction plan.
+    int numExtractionPlansResolved() { return num_extraction_plans_resolved_; }
 
 protected:
 
@@ -149,7 +158,7 @@ protected:
     // The default implementation of poll does nothing.
     // Override for mbus meters that need to be queried and likewise for C2/T2 wmbus-meters.
     void poll(shared_ptr<BusManager> bus);
-    bool handleTelegram(AboutTelegram &about, vector<uchar> frame,
+    bool handleTelegram(const ReceivedFrame &frame,
                         bool simulated, string *id, bool *id_match, Telegram *out_analyzed = NULL);
     void printMeter(Telegram *t,
                     string *human_readable,
@@ -190,6 +199,24 @@ private:
     vector<string> shell_cmdlines_;
     vector<string> extra_constant_fields_;
 
+    // The key of the value of each field in prints_, as found in a telegram with this layout.
+    struct ExtractionPlan
+    {
+        vector<DVKey> layout;
+        vector<string> keys;
+    };
+    // Meters resend the same layout over and over again, thus remember
+    // the extraction plans for the layouts seen, keyed by their format hash.
+    // Only used by handleTelegram while it holds the meter_mutex_ below.
+    map<uint16_t,ExtractionPlan> extraction_plans_;
+    int num_extraction_plans_resolved_ {};
+
+    // A meter can be matched through several ids, so its telegrams can be decoded by
+    // different decode workers. The lock makes sure that only one of them at a time
+    // updates the values, the extraction plans and the cipher contexts of the keys.
+    RecursiveMutex meter_mutex_ = { "meter_mutex" };
+#define LOCK_METER(where) WITH(meter_mutex_, meter_mutex, where)
+
 protected:
     std::map<std::string,std::pair<int,std::string>> values_;
     vector<Unit> conversions_;
@@ -50,6 +50,8 @@ void Printer::print(Telegram *t, Meter *meter,
 
     meter->printMeter(t, &human_readable, &fields, separator_, &json, &envs, more_json, selected_fields, false);
 
+    LOCK_PRINTER(print);
+
     if (shell_cmdlines_.size() > 0 || meter->shellCmdlines().size() > 0) {
         printShells(meter, envs);
         printed = true;
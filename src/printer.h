@@ -17,6 +17,7 @@
 
 #include"cmdline.h"
 #include"meters.h"
+#include"threads.h"
 #include"wmbus.h"
 
 using namespace std;
@@ -46,6 +47,10 @@ struct Printer {
     bool overwrite_;
     MeterFileNaming naming_;
     MeterFileTimestamp timestamp_;
+    // The meters are rendered in parallel when there are decode worker threads,
+    // but the output to stdout, files and shells is done one meter at a time.
+    RecursiveMutex printer_mutex_ = { "printer_mutex" };
+#define LOCK_PRINTER(where) WITH(printer_mutex_, printer_mutex, where)
 
     void printShells(Meter *meter, vector<string> &envs);
     void printFiles(Meter *meter, Telegram *t, string &human_readable, string &fields, string &json);
@@ -17,38 +17,90 @@
 
 #include"aes.h"
 #include"aescmac.h"
+#include"bus.h"
 #include"cmdline.h"
 #include"config.h"
 #include"meters.h"
+#include"meters_common_implementation.h"
 #include"printer.h"
 #include"serial.h"
 #include"translatebits.h"
 #include"util.h"
 #include"wmbus.h"
+#include"wmbus_utils.h"
 #include"dvparser.h"
 
+#include<algorithm>
+#include<new>
+#include<set>
+#include<stdlib.h>
 #include<string.h>
 
 using namespace std;
 
+// Count all heap allocations, used by the benchmarks.
+static size_t num_allocations_ = 0;
+
+void *operator new(size_t size)
+{
+    num_allocations_++;
+    void *p = malloc(size > 0 ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
 int test_crc();
+void test_dll_crcs();
 int test_dvparser();
 int test_test();
 int test_linkmodes();
 void test_ids();
+void test_id_matcher();
 void test_kdf();
 void test_periods();
 void test_devices();
 void test_meters();
 void test_months();
 void test_aes();
+void test_ell_ctr();
 void test_sbc();
 void test_hex();
 void test_translate();
 void test_slip();
+void test_driver_detection();
+void test_header_peek();
+void test_telegram_pool();
+void test_descriptions();
+void test_duplicate_filter();
+void test_telegram_merger();
+void test_ignored_meters();
+void test_template_meters();
+void test_extraction_plans();
+void test_run_in_parallel();
+void test_decode_shards();
+void test_meter_dispatch();
+
+void bench_match_expressions();
+void loadSimulationFrames(vector<vector<uchar>> *frames, vector<FrameType> *types);
+void bench_simulation_allocations();
+void bench_decode_threads();
+void bench_parse_dv();
+void bench_telegram_pool();
+void bench_hex();
+void bench_crc();
+void bench_aes();
+void bench_ell_ctr();
+void bench_kdf();
+void bench_duplicate_filter();
 
 int main(int argc, char **argv)
 {
+    bool bench = false;
     if (argc > 1) {
         if (!strcmp(argv[1], "--debug"))
         {
@@ -59,9 +111,31 @@ int main(int argc, char **argv)
             debugEnabled(true);
             traceEnabled(true);
         }
+        if (!strcmp(argv[1], "--bench"))
+        {
+            bench = true;
+        }
     }
     onExit([](){});
 
+    if (bench)
+    {
+        // Only print the benchmark results.
+        silentLogging(true);
+        bench_match_expressions();
+        bench_simulation_allocations();
+        bench_decode_threads();
+        bench_parse_dv();
+        bench_telegram_pool();
+        bench_hex();
+        bench_crc();
+        bench_aes();
+        bench_ell_ctr();
+        bench_kdf();
+        bench_duplicate_filter();
+        return 0;
+    }
+
     test_crc();
     test_dvparser();
     test_test();
@@ -74,14 +148,45 @@ int main(int argc, char **argv)
     test_periods();
     test_months();
     test_aes();
+    test_ell_ctr();
     test_sbc();
     test_hex();
     test_translate();
     test_slip();
+    test_driver_detection();
+    test_header_peek();
+    test_telegram_pool();
+    test_descriptions();
+    test_duplicate_filter();
+    test_telegram_merger();
+    test_ignored_meters();
+    test_template_meters();
+    test_extraction_plans();
+    test_run_in_parallel();
+    test_decode_shards();
+    test_meter_dispatch();
 
     return 0;
 }
 
+// The EN13757 and the CCITT crcs calculated one bit at a time.
+void crcsBitByBit(const uchar *data, size_t len, uint16_t *en13757, uint16_t *ccitt)
+{
+    uint16_t en = 0, cc = 0xffff;
+    for (size_t i = 0; i < len; ++i)
+    {
+        for (int b = 0; b < 8; ++b)
+        {
+            bool en_bit = ((en >> 15) ^ (data[i] >> (7-b))) & 1;
+            en = en_bit ? (en << 1) ^ 0x3d65 : (en << 1);
+            bool cc_bit = (cc ^ (data[i] >> b)) & 1;
+            cc = cc_bit ? (cc >> 1) ^ 0x8408 : (cc >> 1);
+        }
+    }
+    *en13757 = ~en;
+    *ccitt = cc;
+}
+
 int test_crc()
 {
     int rc = 0;
@@ -140,10 +245,91 @@ int test_crc()
         printf("ERROR! %4x should be c2b7\n", crc);
         rc = -1;
     }
+
+    crc = ~crc16_CCITT(block, 9);
+
+    if (crc != 0x906e) {
+        printf("ERROR! %4x should be 906e\n", crc);
+        rc = -1;
+    }
+
+    // The table driven crcs must match the crcs calculated bit by bit.
+    uchar buf[300];
+    for (size_t i = 0; i < sizeof(buf); ++i) buf[i] = i*37+11;
+    for (size_t len = 0; len <= sizeof(buf); ++len)
+    {
+        uint16_t en, cc;
+        crcsBitByBit(buf, len, &en, &cc);
+        if (crc16_EN13757(buf, len) != en || crc16_CCITT(buf, len) != cc) {
+            printf("ERROR! table crcs %04x %04x should be %04x %04x for %zu bytes\n",
+                   crc16_EN13757(buf, len), crc16_CCITT(buf, len), en, cc, len);
+            rc = -1;
+        }
+    }
+
+    test_dll_crcs();
     return rc;
 }
 
-int test_parse(const char *data, std::map<std::string,std::pair<int,DVEntry>> *values, int testnr)
+void appendCRC(vector<uchar> *frame, vector<uchar> &data, size_t from, size_t len)
+{
+    frame->insert(frame->end(), data.begin()+from, data.begin()+from+len);
+    uint16_t crc = crc16_EN13757(&data[from], len);
+    frame->push_back(crc >> 8);
+    frame->push_back(crc & 0xff);
+}
+
+void test_dll_crcs()
+{
+    // Add the dll crcs for frame format A and B to frames of all sizes
+    // and check that they are trimmed back to the original frame.
+    for (size_t len = 10; len <= 250; ++len)
+    {
+        vector<uchar> data;
+        for (size_t i = 0; i < len; ++i) data.push_back(i*7+len);
+        data[0] = len-1;
+
+        vector<uchar> a;
+        appendCRC(&a, data, 0, 10);
+        for (size_t pos = 10; pos < len; pos += 16) appendCRC(&a, data, pos, min((size_t)16, len-pos));
+
+        vector<uchar> b;
+        if (len+2 <= 128)
+        {
+            appendCRC(&b, data, 0, len);
+        }
+        else
+        {
+            appendCRC(&b, data, 0, 126);
+            appendCRC(&b, data, 126, len-126);
+        }
+
+        vector<uchar> trimmed = a;
+        if (!trimCRCsFrameFormatA(trimmed) || trimmed != data)
+        {
+            printf("ERROR! frame format a with %zu bytes was trimmed into %s\n", len, bin2hex(trimmed).c_str());
+        }
+        trimmed = b;
+        if (!trimCRCsFrameFormatB(trimmed) || trimmed != data)
+        {
+            printf("ERROR! frame format b with %zu bytes was trimmed into %s\n", len, bin2hex(trimmed).c_str());
+        }
+        // A failed crc check must leave the frame untouched. (The formats are the same for 10 bytes.)
+        trimmed = b;
+        if (len > 10 && (trimCRCsFrameFormatA(trimmed) || trimmed != b))
+        {
+            printf("ERROR! frame format b with %zu bytes was trimmed as frame format a\n", len);
+        }
+        trimmed = b;
+        removeAnyDLLCRCs(trimmed);
+        if (trimmed != data)
+        {
+            printf("ERROR! dll crcs of frame format b with %zu bytes were not removed\n", len);
+        }
+    }
+}
+
+int test_parse(const char *data, DVEntries *values, int testnr)
 {
     debug("\n\nTest nr %d......\n\n", testnr);
     bool b;
@@ -157,21 +343,23 @@ int test_parse(const char *data, std::map<std::string,std::pair<int,DVEntry>> *v
     return b;
 }
 
-void test_double(map<string,pair<int,DVEntry>> &values, const char *key, double v, int testnr)
+void test_double(DVEntries &values, const char *key, double v, int testnr, bool assume_signed = false)
 {
     int offset;
     double value;
     bool b =  extractDVdouble(&values,
                               key,
                               &offset,
-                              &value);
+                              &value,
+                              true,
+                              assume_signed);
 
     if (!b || value != v) {
         fprintf(stderr, "Error in dvparser testnr %d: got %lf but expected value %lf for key %s\n", testnr, value, v, key);
     }
 }
 
-void test_string(map<string,pair<int,DVEntry>> &values, const char *key, const char *v, int testnr)
+void test_string(DVEntries &values, const char *key, const char *v, int testnr)
 {
     int offset;
     string value;
@@ -184,7 +372,7 @@ void test_string(map<string,pair<int,DVEntry>> &values, const char *key, const c
     }
 }
 
-void test_date(map<string,pair<int,DVEntry>> &values, const char *key, string date_expected, int testnr)
+void test_date(DVEntries &values, const char *key, string date_expected, int testnr)
 {
     int offset;
     struct tm value;
@@ -203,7 +391,7 @@ void test_date(map<string,pair<int,DVEntry>> &values, const char *key, string da
 
 int test_dvparser()
 {
-    map<string,pair<int,DVEntry>> values;
+    DVEntries values;
 
     int testnr = 1;
     test_parse("2F 2F 0B 13 56 34 12 8B 82 00 93 3E 67 45 23 0D FD 10 0A 30 31 32 33 34 35 36 37 38 39 0F 88 2F", &values, testnr);
@@ -227,6 +415,28 @@ int test_dvparser()
     values.clear();
     test_parse("426C FE04", &values, testnr);
     test_date(values, "426C", "2007-04-30 00:00:00", testnr); // 2010-dec-31
+
+    testnr++;
+    values.clear();
+    test_parse("0E13 563412000000 4613 FEFFFFFFFFFF 8A0113 3412 8A0213 34F2", &values, testnr);
+    test_double(values, "0E13", 123.456, testnr);
+    test_double(values, "4613", -0.002, testnr, true);
+    test_double(values, "8A0113", 1.234, testnr);
+    test_double(values, "8A0213", -0.234, testnr, true);
+
+    testnr++;
+    values.clear();
+    test_parse("0213 0100 0213 0200 0213 0300 4213 0400", &values, testnr);
+    test_double(values, "0213", 0.001, testnr);
+    test_double(values, "0213_2", 0.002, testnr);
+    test_double(values, "0213_3", 0.003, testnr);
+    test_double(values, "4213", 0.004, testnr);
+    string key;
+    if (!findKeyWithNr(MeasurementType::Instantaneous, ValueInformation::Volume, ANY_STORAGENR, ANY_TARIFFNR, 3, &key, &values) ||
+        key != "0213_3")
+    {
+        printf("Error in dvparser testnr %d: expected key 0213_3 but got %s\n", testnr, key.c_str());
+    }
     return 0;
 }
 
@@ -415,6 +625,52 @@ void test_does_id_match_expression(string id, string mes, bool expected, bool ex
     }
 }
 
+void test_id_matcher()
+{
+    // The compiled matcher must give the same answer as doesIdsMatchExpressions.
+    vector<string> mess = {
+        "12345678", "*", "2*", "*,!2*", "22*,!22222222", "*,!22*", "123*,!1234*,!1235*,!1236*",
+        "22*,33*,44*,55*", "78563412,78563413", "*,!00156327,!00048713", "1234567*,12345678",
+        "!12345678", "A*", "" };
+    vector<vector<string>> idss = {
+        { "12345678" }, { "22222222" }, { "22222223" }, { "12333333" }, { "12366666" },
+        { "55223344" }, { "78563413" }, { "00156327" }, { "22222222", "12345678" },
+        { "12345678", "22222222" }, { "12" }, { "" }, { "Abcdef01" } };
+
+    IdMatcher im;
+    vector<vector<string>> rules;
+    for (size_t i = 0; i < mess.size(); ++i)
+    {
+        rules.push_back(splitMatchExpressions(mess[i]));
+        im.add(i, rules.back());
+    }
+
+    for (vector<string> &ids : idss)
+    {
+        vector<IdMatch> matches;
+        im.match(ids, &matches);
+        size_t j = 0;
+        for (size_t i = 0; i < mess.size(); ++i)
+        {
+            bool uw = false;
+            bool expected = doesIdsMatchExpressions(ids, rules[i], &uw);
+            bool found = j < matches.size() && matches[j].owner == (int)i;
+            string idsc = toIdsCommaSeparated(ids);
+            if (expected != found)
+            {
+                printf("ERROR! Id matcher for \"%s\" \"%s\" expected %d but got %d!\n",
+                       idsc.c_str(), mess[i].c_str(), expected, found);
+            }
+            else if (found && matches[j].used_wildcard != uw)
+            {
+                printf("ERROR! Id matcher for \"%s\" \"%s\" expected used_wildcard %d but got %d!\n",
+                       idsc.c_str(), mess[i].c_str(), uw, matches[j].used_wildcard);
+            }
+            if (found) j++;
+        }
+    }
+}
+
 void test_ids()
 {
     test_valid_match_expression("12345678", true);
@@ -450,6 +706,8 @@ void test_ids()
 
     test_does_id_match_expression("78563413", "78563412,78563413", true, false);
     test_does_id_match_expression("78563413", "*,!00156327,!00048713", true, true);
+
+    test_id_matcher();
 }
 
 void eq(string a, string b, const char *tn)
@@ -496,6 +754,31 @@ void test_kdf()
     {
         printf("ERROR in aes-cmac expected \"%s\" but got \"%s\"\n", ex.c_str(), s.c_str());
     }
+
+    // The rfc 4493 vectors with the cmac context cached in the meter keys.
+    MeterKeys mk;
+    mk.setConfidentialityKey(key);
+    const AES_CMAC_ctx *ctx = mk.confidentialityKeyCMACCtx();
+    input.clear();
+    hex2bin("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+            "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710", &input);
+    int lengths[] = { 0, 16, 40, 64 };
+    const char *expected[] = { "BB1D6929E95937287FA37D129B756746", "070A16B46B4D4144F79BDD9DD04A287C",
+                               "DFA66747DE9AE63030CA32611497C827", "51F0BEBF7E3B9D92FC49741779363CFE" };
+    for (int i = 0; i < 4; ++i)
+    {
+        AES_CMAC(ctx, &input[0], lengths[i], &mac[0]);
+        s = bin2hex(mac);
+        if (s != expected[i])
+        {
+            printf("ERROR in aes-cmac with context for %d bytes expected \"%s\" but got \"%s\"\n",
+                   lengths[i], expected[i], s.c_str());
+        }
+    }
+    if (mk.confidentialityKeyCMACCtx() != ctx || &ctx->aes != mk.confidentialityKeyCtx())
+    {
+        printf("ERROR the meter keys did not reuse the prepared cmac context\n");
+    }
 }
 
 void testp(time_t now, string period, bool expected)
@@ -944,7 +1227,7 @@ void test_sbc()
           "1122334455"); // content
 }
 
-void test_aes()
+void test_aes_vectors()
 {
     vector<uchar> key;
 
@@ -991,6 +1274,144 @@ void test_aes()
     {
         printf("ERROR! aes encrypt decrypt (no iv) failed!\n");
     }
+
+    // A prepared context must give the same results as expanding the key for every call.
+    AES_ctx ctx;
+    AES_init_ctx(&ctx, &key[0]);
+    // The cbc encryption xors the iv into its input, thus encrypt copies of the poem.
+    uchar ctx_in[sizeof(in)], ctx_out[sizeof(in)];
+    memcpy(in, &poe[0], poe.size());
+    memcpy(ctx_in, &poe[0], poe.size());
+    AES_CBC_encrypt_buffer(out, in, sizeof(in), &key[0], iv);
+    AES_CBC_encrypt_buffer_ctx(&ctx, ctx_out, ctx_in, sizeof(in), iv);
+    if (memcmp(out, ctx_out, sizeof(in)))
+    {
+        printf("ERROR! aes cbc encrypt with prepared context differs!\n");
+    }
+    AES_CBC_decrypt_buffer_ctx(&ctx, back, ctx_out, sizeof(in), iv);
+    if (memcmp(back, &poe[0], sizeof(in)))
+    {
+        printf("ERROR! aes cbc decrypt with prepared context failed!\n");
+    }
+
+    // The ECB-AES128 test vector from NIST SP 800-38A.
+    vector<uchar> nist_key, plain, cipher;
+    hex2bin("2b7e151628aed2a6abf7158809cf4f3c", &nist_key);
+    hex2bin("6bc1bee22e409f96e93d7e117393172a", &plain);
+    hex2bin("3ad77bb40d7a3660a89ecaf32466ef97", &cipher);
+    AES_init_ctx(&ctx, &nist_key[0]);
+    uchar block[16];
+    AES_ECB_encrypt_ctx(&ctx, &plain[0], block);
+    if (memcmp(block, &cipher[0], 16))
+    {
+        printf("ERROR! aes ecb encrypt with prepared context gave %s\n", bin2hex(vector<uchar>(block, block+16)).c_str());
+    }
+    AES_ECB_decrypt_ctx(&ctx, &cipher[0], block);
+    if (memcmp(block, &plain[0], 16))
+    {
+        printf("ERROR! aes ecb decrypt with prepared context failed!\n");
+    }
+
+    // The CBC-AES128 and CTR-AES128 test vectors from NIST SP 800-38A.
+    vector<uchar> nist_iv, nist_ctr;
+    hex2bin("000102030405060708090a0b0c0d0e0f", &nist_iv);
+    cipher.clear();
+    hex2bin("7649abac8119b246cee98e9b12e9197d", &cipher);
+    AES_CBC_decrypt_buffer_ctx(&ctx, block, &cipher[0], 16, &nist_iv[0]);
+    if (memcmp(block, &plain[0], 16))
+    {
+        printf("ERROR! aes cbc decrypt (%s) of the nist vector failed!\n", AES_kernels_name());
+    }
+    hex2bin("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", &nist_ctr);
+    cipher.clear();
+    hex2bin("874d6191b620e3261bef6864990db6ce", &cipher);
+    memcpy(block, &plain[0], 16);
+    AES_CTR_xcrypt_buffer_ctx(&ctx, &nist_ctr[0], block, 16);
+    if (memcmp(block, &cipher[0], 16) || nist_ctr[15] != 0x00 || nist_ctr[14] != 0xff)
+    {
+        printf("ERROR! aes ctr (%s) of the nist vector failed!\n", AES_kernels_name());
+    }
+}
+
+void test_aes()
+{
+    // Validate the portable kernels and then the kernels picked for this cpu.
+    AES_use_portable_kernels(true);
+    test_aes_vectors();
+    AES_use_portable_kernels(false);
+    test_aes_vectors();
+
+    // The picked kernels must agree with the portable kernels for every length.
+    vector<uchar> key;
+    hex2bin("000102030405060708090a0b0c0d0e0f", &key);
+    AES_ctx ctx;
+    AES_init_ctx(&ctx, &key[0]);
+    uchar data[256], portable[256], picked[256];
+    for (int i = 0; i < 256; ++i) data[i] = i*7+3;
+    for (uint32_t len = 0; len <= 150; ++len)
+    {
+        uchar portable_iv[16], picked_iv[16];
+        memset(portable_iv, 0xfe, 16);
+        memset(picked_iv, 0xfe, 16);
+        memcpy(portable, data, len);
+        memcpy(picked, data, len);
+        AES_use_portable_kernels(true);
+        AES_CTR_xcrypt_buffer_ctx(&ctx, portable_iv, portable, len);
+        AES_use_portable_kernels(false);
+        AES_CTR_xcrypt_buffer_ctx(&ctx, picked_iv, picked, len);
+        if (memcmp(portable, picked, len) || memcmp(portable_iv, picked_iv, 16))
+        {
+            printf("ERROR! aes ctr %s differs from portable for length %u\n", AES_kernels_name(), len);
+        }
+        if (len % 16 != 0) continue;
+
+        AES_use_portable_kernels(true);
+        AES_CBC_decrypt_buffer_ctx(&ctx, portable, data, len, data+200);
+        AES_use_portable_kernels(false);
+        AES_CBC_decrypt_buffer_ctx(&ctx, picked, data, len, data+200);
+        if (memcmp(portable, picked, len))
+        {
+            printf("ERROR! aes cbc decrypt %s differs from portable for length %u\n", AES_kernels_name(), len);
+        }
+    }
+}
+
+void test_ell_ctr()
+{
+    // The ELL payload is decrypted in place, compare it with a keystream built one block at a time.
+    vector<uchar> key;
+    hex2bin("0123456789abcdef0123456789abcdef", &key);
+    AES_ctx ctx;
+    AES_init_ctx(&ctx, &key[0]);
+    Telegram t;
+    t.dll_mfct_b[0] = 0x2d; t.dll_mfct_b[1] = 0x2c;
+    t.dll_a.assign(6, 0x11);
+    t.dll_a[5] = 0x07;
+    t.ell_cc = 0x20;
+    t.ell_sn_b[0] = 0x01; t.ell_sn_b[3] = 0xff;
+
+    for (size_t len = 0; len <= 70; ++len)
+    {
+        vector<uchar> frame;
+        for (size_t i = 0; i < 17+len; ++i) frame.push_back(i*31+5);
+        vector<uchar> expected = frame;
+        uchar iv[16] = { 0x2d, 0x2c, 0x11, 0x11, 0x11, 0x11, 0x11, 0x07, 0x20, 0x01, 0, 0, 0xff, 0, 0, 0 };
+        for (size_t offset = 0; offset < len; offset += 16)
+        {
+            uchar stream[16];
+            AES_ECB_encrypt(iv, &key[0], stream, 16);
+            for (size_t i = 0; i < 16 && offset+i < len; ++i) expected[17+offset+i] ^= stream[i];
+            incrementIV(iv, sizeof(iv));
+        }
+
+        vector<uchar>::iterator pos = frame.begin()+17;
+        decrypt_ELL_AES_CTR(&t, frame, pos, &ctx);
+        if (frame != expected || pos != frame.begin()+17)
+        {
+            printf("ERROR! ell ctr decryption of %zu bytes gave %s expected %s\n",
+                   len, bin2hex(frame).c_str(), bin2hex(expected).c_str());
+        }
+    }
 }
 
 void test_is_hex(const char *hex, bool expected_ok, bool expected_invalid, bool strict)
@@ -1017,6 +1438,50 @@ void test_hex()
 
     test_is_hex("00 11 22 33#44|55#66 778899aabbccddeeff", true, false, false);
     test_is_hex("00 11 22 33#4|55#66 778899aabbccddeeff", true, true, false);
+
+    // The vectorized hex kernels must encode and decode exactly like the scalar kernels,
+    // also when a non hex digit or a separator is found inside a vectorized block.
+    srand(4711);
+    for (int len = 0; len < 200; ++len)
+    {
+        vector<uchar> bin;
+        for (int i = 0; i < len; ++i) bin.push_back(rand() & 0xff);
+
+        string hex = bin2hex(bin);
+        useScalarHexKernels(true);
+        string scalar_hex = bin2hex(bin);
+        useScalarHexKernels(false);
+        if (hex != scalar_hex)
+        {
+            printf("ERROR! %s hex kernel encoded \"%s\" expected \"%s\"\n", hexKernelsName(), hex.c_str(), scalar_hex.c_str());
+        }
+
+        for (int i = 0; i < (int)hex.length(); ++i) if (rand() & 1) hex[i] = tolower(hex[i]);
+        string broken = hex;
+        if (len > 0) broken[rand() % broken.length()] = "G #|@`/:g\xff"[rand() % 11];
+
+        for (const string &h : { hex, broken })
+        {
+            vector<uchar> out, scalar_out;
+            bool ok = hex2bin(h.c_str(), &out);
+            useScalarHexKernels(true);
+            bool scalar_ok = hex2bin(h.c_str(), &scalar_out);
+            vector<uchar> hv(h.begin(), h.end()), scalar_vout, vout;
+            bool scalar_vok = hex2bin(hv, &scalar_vout);
+            useScalarHexKernels(false);
+            bool vok = hex2bin(hv, &vout);
+            if (ok != scalar_ok || out != scalar_out || vok != scalar_vok || vout != scalar_vout)
+            {
+                printf("ERROR! %s hex kernel decoded \"%s\" differently (%d %s) expected (%d %s)\n",
+                       hexKernelsName(), h.c_str(), ok, bin2hex(out).c_str(), scalar_ok, bin2hex(scalar_out).c_str());
+            }
+        }
+        vector<uchar> back;
+        if (!hex2bin(hex, &back) || back != bin)
+        {
+            printf("ERROR! %s hex kernel failed to decode \"%s\"\n", hexKernelsName(), hex.c_str());
+        }
+    }
 }
 
 void test_translate()
@@ -1151,3 +1616,1173 @@ void test_slip()
     }
 
 }
+
+void test_detect(int mfct, int media, int version, string expected)
+{
+    vector<string> drivers;
+    detectMeterDrivers(mfct, media, version, &drivers);
+    string got;
+    for (string &d : drivers)
+    {
+        if (got != "") got += ",";
+        got += d;
+    }
+    if (got != expected)
+    {
+        printf("ERROR in driver detection %04x %02x %02x expected \"%s\" but got \"%s\"\n",
+               mfct, media, version, expected.c_str(), got.c_str());
+    }
+}
+
+void test_driver_detection()
+{
+    // Old style driver.
+    test_detect(MANUFACTURER_APA, 0x07, 0x05, "apator162");
+    // Old style driver with wildcard version.
+    test_detect(MANUFACTURER_SAP, 0x15, 0x00, "izar");
+    test_detect(MANUFACTURER_SAP, 0x15, 0xff, "izar");
+    test_detect(MANUFACTURER_SAP, 0x16, 0x00, "");
+    // New style drivers.
+    test_detect(MANUFACTURER_APA, 0x02, 0x02, "amiplus");
+    test_detect(MANUFACTURER_SEN, 0x07, 0x7c, "iperl");
+    // Nothing.
+    test_detect(MANUFACTURER_SEN, 0x07, 0x7d, "");
+    test_detect(0x10000, 0x07, 0x7c, "");
+    test_detect(MANUFACTURER_SEN, 0x107, 0x7c, "");
+
+    if (!isMeterDriverValid(MeterDriver::IZAR, MANUFACTURER_SAP, 0x04, 0x33))
+    {
+        printf("ERROR izar should be valid for SAP 04 33\n");
+    }
+    if (isMeterDriverValid(MeterDriver::APATOR162, MANUFACTURER_SAP, 0x04, 0x33))
+    {
+        printf("ERROR apator162 should not be valid for SAP 04 33\n");
+    }
+}
+
+void test_header_peek()
+{
+    // The peek must find the same ids as parsing the header.
+    vector<vector<uchar>> frames;
+    vector<FrameType> types;
+    loadSimulationFrames(&frames, &types);
+
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        Telegram t;
+        t.about = AboutTelegram("test", 0, types[i]);
+        bool ok = t.parseHeader(frames[i]);
+
+        HeaderPeek hp;
+        bool peek_ok = peekHeader(types[i], frames[i], &hp);
+        vector<string> ids;
+        hp.ids(&ids);
+
+        if (ok != peek_ok ||
+            (ok && (ids != t.ids ||
+                    hp.dll_mfct != t.dll_mfct ||
+                    hp.dll_type != t.dll_type ||
+                    hp.dll_version != t.dll_version ||
+                    hp.tpl_id_found != t.tpl_id_found ||
+                    (hp.tpl_id_found && (hp.tpl_mfct != t.tpl_mfct ||
+                                         hp.tpl_type != t.tpl_type ||
+                                         hp.tpl_version != t.tpl_version)))))
+        {
+            string hex = bin2hex(frames[i]);
+            string pids = toIdsCommaSeparated(ids);
+            printf("ERROR header peek %s found \"%s\" but parse header found \"%s\" for %s\n",
+                   peek_ok ? "ok" : "failed", pids.c_str(), t.idsc.c_str(), hex.c_str());
+        }
+    }
+}
+
+void test_telegram_pool()
+{
+    // A reused telegram must parse the simulation frames exactly like a fresh telegram.
+    // Once the pool has warmed up, the buffers of the telegram are never allocated again.
+    vector<vector<uchar>> frames;
+    vector<FrameType> types;
+    loadSimulationFrames(&frames, &types);
+
+    // The frames are parsed without keys, do not print the warnings about encryption.
+    silentLogging(true);
+    MeterKeys no_keys;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        PooledTelegram t;
+        t->about = AboutTelegram("test", 0, types[i]);
+        t->parse(frames[i], &no_keys, false);
+    }
+
+    size_t fresh_allocations = 0;
+    size_t pooled_allocations = 0;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        size_t before = num_allocations_;
+        Telegram fresh;
+        fresh.about = AboutTelegram("test", 0, types[i]);
+        bool fresh_ok = fresh.parse(frames[i], &no_keys, false);
+        size_t fresh_allocs = num_allocations_-before;
+
+        before = num_allocations_;
+        PooledTelegram t;
+        t->about = AboutTelegram("test", 0, types[i]);
+        bool ok = t->parse(frames[i], &no_keys, false);
+        size_t pooled_allocs = num_allocations_-before;
+
+        if (ok != fresh_ok || t->idsc != fresh.idsc || t->frame != fresh.frame ||
+            t->values.size() != fresh.values.size() || t->dv_format_hash != fresh.dv_format_hash)
+        {
+            printf("ERROR! pooled telegram parsed %s differently (%s %zu values) (%s %zu values)\n",
+                   bin2hex(frames[i]).c_str(),
+                   t->idsc.c_str(), t->values.size(), fresh.idsc.c_str(), fresh.values.size());
+        }
+        if (pooled_allocs > fresh_allocs)
+        {
+            printf("ERROR! pooled telegram allocated more than a fresh telegram %zu > %zu for %s\n",
+                   pooled_allocs, fresh_allocs, bin2hex(frames[i]).c_str());
+        }
+        fresh_allocations += fresh_allocs;
+        pooled_allocations += pooled_allocs;
+    }
+    silentLogging(false);
+
+    // Only the temporary strings and buffers used while parsing remain.
+    if (pooled_allocations*2 > fresh_allocations)
+    {
+        printf("ERROR! pooled telegrams allocated memory %zu times, fresh telegrams %zu times, when parsing %zu frames\n",
+               pooled_allocations, fresh_allocations, frames.size());
+    }
+}
+
+void test_description(const char *what, const char *got, const char *expected)
+{
+    if (strcmp(got, expected))
+    {
+        printf("ERROR! %s expected \"%s\" but got \"%s\"\n", what, expected, got);
+    }
+}
+
+void test_descriptions()
+{
+    test_description("manufacturer", manufacturer(MANUFACTURER_KAM), "Kamstrup Energi");
+    test_description("manufacturer", manufacturer(MANUFACTURER_TCH), "Techem Service");
+    test_description("manufacturer", manufacturer(0), "Unknown");
+    test_description("manufacturer", manufacturer(0x8000 | MANUFACTURER_KAM), "Unknown");
+    test_description("manufacturer", manufacturer(-1), "Unknown");
+
+    test_description("media type", mediaType(0x07, MANUFACTURER_KAM), "Water meter");
+    test_description("media type", mediaType(0x1b, MANUFACTURER_KAM), "Room sensor (eg temperature or humidity)");
+    test_description("media type", mediaType(0x12, MANUFACTURER_KAM), "Unknown");
+    test_description("media type", mediaType(0x62, MANUFACTURER_KAM), "Unknown");
+    test_description("media type", mediaType(0x62, MANUFACTURER_TCH), "Warm water");
+    test_description("media type json", mediaTypeJSON(0x16, MANUFACTURER_KAM), "cold water");
+    test_description("media type json", mediaTypeJSON(0x1e, MANUFACTURER_KAM), "Unknown");
+    test_description("media type json", mediaTypeJSON(0xf0, MANUFACTURER_TCH), "smoke detector");
+
+    test_description("c type", cType(0x44), "from meter SND_NR");
+    test_description("c type", cType(0xc6), "relayed from meter SND_IR");
+    test_description("c type", cType(0x0b), "to meter REQ_UD2");
+    test_description("cc type", ccType(0x00), "slow_resp");
+    test_description("cc type", ccType(0xa0), "bidir slow_resp sync");
+    test_description("dif type", difType(0x04), "32 Bit Integer/Binary Instantaneous value");
+    test_description("dif type", difType(0x62), "16 Bit Integer/Binary Minimum value storagenr=1");
+    test_description("dif type", difType(0x0f), "Special Functions");
+    test_description("ci type", ciType(0x7a), "EN 13757-3 Application Layer (short tplh)");
+    test_description("vif type", vifType(0x13), "Volume l");
+    test_description("vif key", vifKey(0x13), "volume");
+
+    // The descriptions are static, looking them up never allocates.
+    size_t before = num_allocations_;
+    size_t len = 0;
+    for (int i = 0; i < 256; ++i)
+    {
+        len += strlen(manufacturer(i*128+i)) + strlen(mediaType(i, MANUFACTURER_TCH)) + strlen(mediaTypeJSON(i, 0));
+        len += strlen(cType(i)) + strlen(ccType(i)) + strlen(difType(i)) + strlen(ciType(i));
+        len += strlen(vifType(i)) + strlen(vifKey(i));
+    }
+    size_t allocations = num_allocations_-before;
+    if (allocations != 0 || len == 0)
+    {
+        printf("ERROR! looking up descriptions allocated memory %zu times\n", allocations);
+    }
+}
+
+void bench_match_expressions()
+{
+    // Compile 10000 match expressions, a mix of exact ids, wildcards and negations,
+    // and compare the compiled matcher with testing all expressions one by one.
+    srand(4711);
+    vector<vector<string>> rules;
+    vector<string> configured_ids;
+    IdMatcher im;
+    for (int i = 0; i < 10000; ++i)
+    {
+        string me = tostrprintf("%08d", rand() % 100000000);
+        configured_ids.push_back(me);
+        int r = rand() % 10;
+        if (r == 0) me = me.substr(0, 4)+"*";
+        if (r == 1) me = me.substr(0, 3)+"*,!"+me;
+        rules.push_back(splitMatchExpressions(me));
+        im.add(i, rules.back());
+    }
+    vector<vector<string>> idss;
+    for (int i = 0; i < 1000; ++i)
+    {
+        vector<string> ids;
+        // Every other id is one of the configured ids.
+        if (i % 2 == 0) ids.push_back(tostrprintf("%08d", rand() % 100000000));
+        else ids.push_back(configured_ids[rand() % configured_ids.size()]);
+        idss.push_back(ids);
+    }
+
+    size_t linear_matches = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (vector<string> &ids : idss)
+    {
+        for (vector<string> &r : rules)
+        {
+            bool uw = false;
+            if (doesIdsMatchExpressions(ids, r, &uw)) linear_matches++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double linear_us = ((end.tv_sec-start.tv_sec)*1000000.0+(end.tv_nsec-start.tv_nsec)/1000.0)/idss.size();
+
+    size_t compiled_matches = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (vector<string> &ids : idss)
+    {
+        vector<IdMatch> matches;
+        im.match(ids, &matches);
+        compiled_matches += matches.size();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double compiled_us = ((end.tv_sec-start.tv_sec)*1000000.0+(end.tv_nsec-start.tv_nsec)/1000.0)/idss.size();
+
+    printf("match expressions: %zu expressions %zu telegrams\n", rules.size(), idss.size());
+    printf("match expressions: linear   %10.2f us/telegram (%zu matches)\n", linear_us, linear_matches);
+    printf("match expressions: compiled %10.2f us/telegram (%zu matches)\n", compiled_us, compiled_matches);
+    if (linear_matches != compiled_matches)
+    {
+        printf("ERROR! Compiled matcher found %zu matches but expected %zu\n", compiled_matches, linear_matches);
+    }
+}
+
+// Load all telegrams from the simulation files as received frames.
+void loadSimulationFrames(vector<vector<uchar>> *frames, vector<FrameType> *types)
+{
+    vector<string> files;
+    listFiles("simulations", &files);
+    sort(files.begin(), files.end());
+    for (string &f : files)
+    {
+        if (f.substr(0, 11) != "simulation_" || f.substr(f.length()-4) != ".txt") continue;
+        vector<string> lines;
+        loadFile("simulations/"+f, &lines);
+        for (string &l : lines)
+        {
+            if (l.substr(0,9) != "telegram=") continue;
+            string hex;
+            for (size_t i=9; i<l.length() && l[i] != '+'; ++i)
+            {
+                if (l[i] != '|') hex += l[i];
+            }
+            vector<uchar> payload;
+            if (!hex2bin(hex.c_str(), &payload)) continue;
+
+            size_t frame_length;
+            int payload_len, payload_offset;
+            if (FullFrame == checkWMBusFrame(payload, &frame_length, &payload_len, &payload_offset, true))
+            {
+                removeAnyDLLCRCs(payload);
+                types->push_back(FrameType::WMBUS);
+            }
+            else
+            {
+                types->push_back(FrameType::MBUS);
+            }
+            frames->push_back(payload);
+        }
+    }
+}
+
+void bench_simulation_allocations()
+{
+    // Count the heap allocations needed to pass the telegrams in the simulation files
+    // from the bus into the meter manager and to a meter created from a template.
+    vector<vector<uchar>> frames;
+    vector<FrameType> types;
+    loadSimulationFrames(&frames, &types);
+
+    shared_ptr<MeterManager> manager = createMeterManager(false);
+    MeterInfo mi;
+    mi.parse("bench", "auto", "*", "");
+    manager->addMeterTemplate(mi);
+
+    // First round instantiates the meters from the template.
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        AboutTelegram about("bench", 0, types[i]);
+        vector<uchar> frame = frames[i];
+        manager->handleTelegram(make_shared<ReceivedFrame>(about, frame), true);
+    }
+
+    size_t frame_allocations = 0;
+    size_t handle_allocations = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        AboutTelegram about("bench", 0, types[i]);
+        vector<uchar> frame = frames[i];
+        size_t before = num_allocations_;
+        shared_ptr<ReceivedFrame> received = make_shared<ReceivedFrame>(about, frame);
+        size_t middle = num_allocations_;
+        manager->handleTelegram(received, true);
+        size_t after = num_allocations_;
+        frame_allocations += middle-before;
+        handle_allocations += after-middle;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double us = ((end.tv_sec-start.tv_sec)*1000000.0+(end.tv_nsec-start.tv_nsec)/1000.0)/frames.size();
+
+    printf("simulation allocations: %zu telegrams %.2f us/telegram\n", frames.size(), us);
+    printf("simulation allocations: %.2f allocations/telegram to share the frame\n", (double)frame_allocations/frames.size());
+    printf("simulation allocations: %.2f allocations/telegram to handle the telegram\n", (double)handle_allocations/frames.size());
+}
+
+void bench_decode_threads()
+{
+    // Replay one million simulation telegrams through the meter manager, decoding them
+    // in the calling thread and then in 1, 2 and 4 decode worker threads.
+    vector<vector<uchar>> frames;
+    vector<FrameType> types;
+    loadSimulationFrames(&frames, &types);
+
+    size_t total = 1000000;
+    int threads[] = { 0, 1, 2, 4 };
+    double base = 0;
+    int base_updates = 0;
+    for (int n : threads)
+    {
+        shared_ptr<MeterManager> manager = createMeterManager(false);
+        MeterInfo mi;
+        mi.parse("bench", "auto", "*", "");
+        manager->addMeterTemplate(mi);
+        startDecodeWorkerThreads(n, 1000);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < total; ++i)
+        {
+            size_t f = i % frames.size();
+            AboutTelegram about("bench", 0, types[f]);
+            vector<uchar> frame = frames[f];
+            manager->handleTelegram(make_shared<ReceivedFrame>(about, frame), true);
+        }
+        // Waits for the queued telegrams to be decoded.
+        stopDecodeWorkerThreads();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double s = (end.tv_sec-start.tv_sec)+(end.tv_nsec-start.tv_nsec)/1000000000.0;
+        if (n == 0) base = s;
+
+        int updates = 0;
+        manager->forEachMeter([&](Meter *m) { updates += m->numUpdates(); });
+        if (n == 0) base_updates = updates;
+        if (updates != base_updates)
+        {
+            printf("ERROR! %d decode threads updated the meters %d times, expected %d\n", n, updates, base_updates);
+        }
+        printf("decode threads: %d threads %zu telegrams %.2f s %.0f telegrams/s speedup %.2f\n",
+               n, total, s, total/s, base/s);
+    }
+}
+
+double benchParseDV(vector<uchar> &databytes, bool explain, int rounds, size_t *allocations)
+{
+    size_t before = num_allocations_;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; ++i)
+    {
+        Telegram t;
+        // Analyzed telegrams always record their explanations.
+        if (explain) t.markAsBeingAnalyzed();
+        DVEntries values;
+        parseDV(&t, databytes, databytes.begin(), databytes.size(), &values);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *allocations = (num_allocations_-before)/rounds;
+    return ((end.tv_sec-start.tv_sec)*1000000.0+(end.tv_nsec-start.tv_nsec)/1000.0)/rounds;
+}
+
+void bench_parse_dv()
+{
+    // Parse the dif/vif content of a telegram with and without recording the explanations.
+    vector<uchar> databytes;
+    hex2bin("0C1348550000426CE1F14C130000000082046C21298C0413330000008D04931E3A3CFE33000000330000003300000033000000"
+            "33000000330000003300000033000000330000003300000033000000330000004300000034180000046D0D0B5C2B03FD6C5E15"
+            "0082206C5C290BFD0F0200018C4079678885238310FD3100000082106C01018110FD610002FD66020002FD170000",
+            &databytes);
+
+    int rounds = 20000;
+    size_t with_allocs, without_allocs;
+    double with_us = benchParseDV(databytes, true, rounds, &with_allocs);
+    double without_us = benchParseDV(databytes, false, rounds, &without_allocs);
+
+    printf("parse dv: %zu bytes with explanations    %.2f us/parse %zu allocations/parse\n",
+           databytes.size(), with_us, with_allocs);
+    printf("parse dv: %zu bytes without explanations %.2f us/parse %zu allocations/parse\n",
+           databytes.size(), without_us, without_allocs);
+}
+
+double benchParseFrames(vector<vector<uchar>> &frames, vector<FrameType> &types, bool pooled, size_t *allocations)
+{
+    MeterKeys no_keys;
+    int rounds = 100;
+    size_t before = num_allocations_;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            if (pooled)
+            {
+                PooledTelegram t;
+                t->about = AboutTelegram("bench", 0, types[i]);
+                t->parse(frames[i], &no_keys, false);
+            }
+            else
+            {
+                Telegram t;
+                t.about = AboutTelegram("bench", 0, types[i]);
+                t.parse(frames[i], &no_keys, false);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *allocations = (num_allocations_-before)/rounds;
+    return ((end.tv_sec-start.tv_sec)*1000000.0+(end.tv_nsec-start.tv_nsec)/1000.0)/rounds/frames.size();
+}
+
+void bench_telegram_pool()
+{
+    // Parse the simulation frames using fresh telegrams and telegrams from the pool.
+    vector<vector<uchar>> frames;
+    vector<FrameType> types;
+    loadSimulationFrames(&frames, &types);
+
+    size_t fresh_allocs, pooled_allocs;
+    double fresh_us = benchParseFrames(frames, types, false, &fresh_allocs);
+    double pooled_us = benchParseFrames(frames, types, true, &pooled_allocs);
+
+    printf("telegram pool: fresh  telegrams %.2f us/telegram %.2f allocations/telegram\n",
+           fresh_us, (double)fresh_allocs/frames.size());
+    printf("telegram pool: pooled telegrams %.2f us/telegram %.2f allocations/telegram\n",
+           pooled_us, (double)pooled_allocs/frames.size());
+}
+
+double benchHex(vector<uchar> &bin, string &hex, bool encode, int rounds)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t sum = 0;
+    for (int i = 0; i < rounds; ++i)
+    {
+        if (encode)
+        {
+            sum += bin2hex(bin).length();
+        }
+        else
+        {
+            vector<uchar> out;
+            hex2bin(hex, &out);
+            sum += out.size();
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (sum != (size_t)rounds*bin.size()*(encode ? 2 : 1)) printf("ERROR! bad hex benchmark\n");
+    return ((end.tv_sec-start.tv_sec)*1000000000.0+(end.tv_nsec-start.tv_nsec))/rounds;
+}
+
+void bench_hex()
+{
+    // Encode and decode a full size wmbus frame with the scalar and the vectorized kernels.
+    vector<uchar> bin;
+    for (int i = 0; i < 255; ++i) bin.push_back(i*13+7);
+    string hex = bin2hex(bin);
+
+    int rounds = 200000;
+    useScalarHexKernels(true);
+    double scalar_encode = benchHex(bin, hex, true, rounds);
+    double scalar_decode = benchHex(bin, hex, false, rounds);
+    useScalarHexKernels(false);
+    double encode = benchHex(bin, hex, true, rounds);
+    double decode = benchHex(bin, hex, false, rounds);
+
+    printf("hex: %zu bytes scalar  encode %.0f ns decode %.0f ns\n", bin.size(), scalar_encode, scalar_decode);
+    printf("hex: %zu bytes %-6s  encode %.0f ns decode %.0f ns\n", bin.size(), hexKernelsName(), encode, decode);
+}
+
+void bench_crc()
+{
+    // Calculate the crcs of a 255 byte frame and remove the dll crcs from a 255 byte frame format a.
+    vector<uchar> data;
+    for (int i = 0; i < 255; ++i) data.push_back(i*13+7);
+    data[0] = 254;
+    vector<uchar> a;
+    appendCRC(&a, data, 0, 10);
+    for (size_t pos = 10; pos < data.size(); pos += 16) appendCRC(&a, data, pos, min((size_t)16, data.size()-pos));
+
+    int rounds = 100000;
+    uint16_t sum = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; ++i)
+    {
+        uint16_t en, cc;
+        crcsBitByBit(&data[0], data.size(), &en, &cc);
+        sum += en+cc;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double bit_ns = ((end.tv_sec-start.tv_sec)*1000000000.0+(end.tv_nsec-start.tv_nsec))/rounds;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; ++i)
+    {
+        sum -= crc16_EN13757(&data[0], data.size())+crc16_CCITT(&data[0], data.size());
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double table_ns = ((end.tv_sec-start.tv_sec)*1000000000.0+(end.tv_nsec-start.tv_nsec))/rounds;
+
+    size_t allocations = num_allocations_;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    vector<uchar> frame;
+    frame.reserve(a.size());
+    for (int i = 0; i < rounds; ++i)
+    {
+        frame.assign(a.begin(), a.end());
+        removeAnyDLLCRCs(frame);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double trim_ns = ((end.tv_sec-start.tv_sec)*1000000000.0+(end.tv_nsec-start.tv_nsec))/rounds;
+    allocations = num_allocations_-allocations;
+
+    if (sum != 0 || frame != data) printf("ERROR! bad crc benchmark\n");
+    printf("crc: %zu bytes en13757+ccitt bit by bit %.0f ns table %.0f ns\n", data.size(), bit_ns, table_ns);
+    printf("crc: %zu bytes remove dll crcs %.0f ns %zu allocations\n", a.size(), trim_ns, allocations);
+}
+
+double benchAESMode(AES_ctx *ctx, vector<uchar> &key, int mode, uchar *buf, uint32_t len, int rounds)
+{
+    uchar iv[16], mac[16];
+    memset(iv, 0, sizeof(iv));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; ++i)
+    {
+        switch (mode) {
+        case 0: for (uint32_t b = 0; b < len; b += 16) AES_ECB_encrypt_ctx(ctx, buf+b, buf+b); break;
+        case 1: AES_CBC_decrypt_buffer_ctx(ctx, buf, buf, len, iv); break;
+        case 2: AES_CTR_xcrypt_buffer_ctx(ctx, iv, buf, len); break;
+        case 3: AES_CMAC(&key[0], buf, len, mac); buf[0] ^= mac[0]; break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec-start.tv_sec)*1000000000.0+(end.tv_nsec-start.tv_nsec))/rounds;
+}
+
+void bench_aes()
+{
+    // Run each mode over a full size wmbus payload with the portable and the picked kernels.
+    vector<uchar> key;
+    hex2bin("0123456789abcdef0123456789abcdef", &key);
+    AES_ctx ctx;
+    AES_init_ctx(&ctx, &key[0]);
+    uchar buf[256];
+    for (int i = 0; i < 256; ++i) buf[i] = i*13+7;
+
+    const char *modes[] = { "ecb", "cbc decrypt", "ctr", "cmac" };
+    uint32_t lens[] = { 240, 240, 255, 240 };
+    int rounds = 20000;
+    for (int mode = 0; mode < 4; ++mode)
+    {
+        AES_use_portable_kernels(true);
+        double portable_ns = benchAESMode(&ctx, key, mode, buf, lens[mode], rounds);
+        AES_use_portable_kernels(false);
+        double picked_ns = benchAESMode(&ctx, key, mode, buf, lens[mode], rounds);
+        printf("aes: %-11s %u bytes portable %.0f ns %s %.0f ns\n",
+               modes[mode], lens[mode], portable_ns, AES_kernels_name(), picked_ns);
+    }
+}
+
+void bench_ell_ctr()
+{
+    // Decrypt the ELL payload of a full size telegram, in megabytes per second.
+    vector<uchar> key;
+    hex2bin("0123456789abcdef0123456789abcdef", &key);
+    AES_ctx ctx;
+    AES_init_ctx(&ctx, &key[0]);
+    Telegram t;
+    t.dll_mfct_b[0] = 0x2d; t.dll_mfct_b[1] = 0x2c;
+    t.dll_a.assign(6, 0x11);
+    t.ell_cc = 0x20;
+
+    vector<uchar> frame;
+    for (int i = 0; i < 255; ++i) frame.push_back(i*13+7);
+    size_t payload = frame.size()-17;
+    int rounds = 100000;
+    for (int portable = 1; portable >= 0; --portable)
+    {
+        AES_use_portable_kernels(portable);
+        size_t allocations = num_allocations_;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < rounds; ++i)
+        {
+            vector<uchar>::iterator pos = frame.begin()+17;
+            decrypt_ELL_AES_CTR(&t, frame, pos, &ctx);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        allocations = num_allocations_-allocations;
+        double s = (end.tv_sec-start.tv_sec)+(end.tv_nsec-start.tv_nsec)/1000000000.0;
+        printf("ell ctr: %zu bytes %-8s %.0f ns %.1f MB/s %.1f allocations/telegram\n",
+               payload, AES_kernels_name(), s*1000000000.0/rounds, payload*rounds/s/1000000.0,
+               (double)allocations/rounds);
+    }
+    AES_use_portable_kernels(false);
+}
+
+void bench_kdf()
+{
+    // Derive the ephemeral Kenc and Kmac for a mode 7 telegram, expanding
+    // the key and the subkeys for every cmac versus the cached context.
+    vector<uchar> key;
+    hex2bin("0123456789abcdef0123456789abcdef", &key);
+    MeterKeys mk;
+    mk.setConfidentialityKey(key);
+    uchar input[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x78, 0x56, 0x34, 0x12, 7, 7, 7, 7, 7, 7, 7 };
+    uchar kenc[16], kmac[16];
+    int rounds = 100000;
+    uchar sum = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; ++i)
+    {
+        input[1] = i;
+        input[0] = 0x00;
+        AES_CMAC(&key[0], input, 16, kenc);
+        input[0] = 0x01;
+        AES_CMAC(&key[0], input, 16, kmac);
+        sum += kenc[0]+kmac[0];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double keyed_ns = ((end.tv_sec-start.tv_sec)*1000000000.0+(end.tv_nsec-start.tv_nsec))/rounds;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; ++i)
+    {
+        const AES_CMAC_ctx *kdf = mk.confidentialityKeyCMACCtx();
+        input[1] = i;
+        input[0] = 0x00;
+        AES_CMAC(kdf, input, 16, kenc);
+        input[0] = 0x01;
+        AES_CMAC(kdf, input, 16, kmac);
+        sum -= kenc[0]+kmac[0];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double cached_ns = ((end.tv_sec-start.tv_sec)*1000000000.0+(end.tv_nsec-start.tv_nsec))/rounds;
+
+    if (sum != 0) printf("ERROR! bad kdf benchmark\n");
+    printf("kdf: %s derive Kenc+Kmac expanding the key %.0f ns cached context %.0f ns\n",
+           AES_kernels_name(), keyed_ns, cached_ns);
+}
+
+void test_duplicate_filter()
+{
+    vector<uchar> a, b;
+    hex2bin("2E4493157856341233037A2A0020255923C95AAA26D1B2E7493B2A8B013EC4A6F6D3529B520EDFF0EA6DEFC955B29D6D69EBF3EC8A", &a);
+    b = a;
+    b[b.size()-1] ^= 1;
+    if (hash64(&a[0], a.size()) != hash64(&a[0], a.size()) ||
+        hash64(&a[0], a.size()) == hash64(&b[0], b.size()) ||
+        hash64(&a[0], a.size()) == hash64(&a[0], a.size()-1))
+    {
+        printf("ERROR in hash64 of frames\n");
+    }
+
+    DuplicateFilter df(10000);
+    uint64_t ha = hash64(&a[0], a.size());
+    uint64_t hb = hash64(&b[0], b.size());
+    if (df.seenBefore(ha, 1000)) printf("ERROR first frame reported as duplicate\n");
+    if (!df.seenBefore(ha, 1500)) printf("ERROR duplicate frame not found\n");
+    if (df.seenBefore(hb, 2000)) printf("ERROR different frame reported as duplicate\n");
+    if (!df.seenBefore(ha, 10999)) printf("ERROR duplicate frame not found at the end of the window\n");
+    // The first frame was added at 1000 and is not refreshed by the duplicates.
+    if (df.seenBefore(ha, 11000)) printf("ERROR expired frame reported as duplicate\n");
+    if (!df.seenBefore(hb, 11000)) printf("ERROR duplicate frame expired too early\n");
+    if (df.checked() != 6 || df.duplicates() != 3 || df.size() != 2)
+    {
+        printf("ERROR in duplicate filter counters checked %zu duplicates %zu size %zu\n",
+               df.checked(), df.duplicates(), df.size());
+    }
+
+    // A hash is only expired when the whole window has passed.
+    DuplicateFilter dw(10000);
+    if (dw.seenBefore(ha, 5000) || !dw.seenBefore(ha, 5000) || !dw.seenBefore(ha, 14999) || dw.seenBefore(ha, 15000))
+    {
+        printf("ERROR in duplicate filter window bounds\n");
+    }
+
+    // Hashes with the same home slot form long probe sequences, expiring the
+    // first half must move the rest back so that they can still be found.
+    DuplicateFilter dc(1000);
+    for (uint64_t i = 1; i <= 300; ++i)
+    {
+        if (dc.seenBefore(i << 32, i)) printf("ERROR colliding hash %" PRIu64 " reported as duplicate\n", i);
+    }
+    if (dc.seenBefore(0, 500) || !dc.seenBefore(0, 501)) printf("ERROR the zero hash is not remembered\n");
+    for (uint64_t i = 1; i <= 300; ++i)
+    {
+        bool seen = dc.seenBefore(i << 32, 1150);
+        if (seen != (i > 150)) printf("ERROR colliding hash %" PRIu64 " seen %d at 1150\n", i, seen);
+    }
+    // The 150 expired hashes were added again at 1150.
+    if (dc.size() != 301) printf("ERROR expected 301 remembered hashes but got %zu\n", dc.size());
+    if (dc.seenBefore(12345, 100000) || dc.size() != 1)
+    {
+        printf("ERROR expected all hashes to expire but %zu remain\n", dc.size());
+    }
+}
+
+void bench_duplicate_filter()
+{
+    // Check 1000 different frames from 100 meters against a window that remembers all of them,
+    // every frame is received twice, once from a repeater.
+    vector<uchar> frame;
+    hex2bin("2E4493157856341233037A2A0020255923C95AAA26D1B2E7493B2A8B013EC4A6F6D3529B520EDFF0EA6DEFC955B29D6D69EBF3EC8A", &frame);
+    int rounds = 100;
+    int frames = 1000;
+    size_t duplicates = 0;
+    size_t allocations = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; ++r)
+    {
+        DuplicateFilter df(3600*1000);
+        size_t a = num_allocations_;
+        for (int i = 0; i < frames; ++i)
+        {
+            frame[4] = i % 100;
+            frame[20] = i / 100;
+            uint64_t h = hash64(&frame[0], frame.size());
+            if (df.seenBefore(h, i)) duplicates++;
+            if (df.seenBefore(h, i)) duplicates++;
+        }
+        if (r == rounds-1) allocations = num_allocations_-a;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = ((end.tv_sec-start.tv_sec)*1000000000.0+(end.tv_nsec-start.tv_nsec))/(2.0*rounds*frames);
+
+    if (duplicates != (size_t)rounds*frames) printf("ERROR! bad duplicate filter benchmark\n");
+    printf("duplicates: %zu byte frames %d remembered hash+check %.0f ns allocations %zu per %d frames\n",
+           frame.size(), frames, ns, allocations, 2*frames);
+}
+
+void test_telegram_merger()
+{
+    vector<uchar> a, b;
+    hex2bin("2E4493157856341233037A2A0020255923C95AAA26D1B2E7493B2A8B013EC4A6F6D3529B520EDFF0EA6DEFC955B29D6D69EBF3EC8A", &a);
+    b = a;
+    b[b.size()-1] ^= 1;
+
+    vector<shared_ptr<ReceivedFrame>> forwarded;
+    pthread_mutex_t forwarded_mutex = PTHREAD_MUTEX_INITIALIZER;
+    shared_ptr<TelegramMerger::Next> next = make_shared<TelegramMerger::Next>(
+        [&](shared_ptr<ReceivedFrame> f){
+            pthread_mutex_lock(&forwarded_mutex);
+            forwarded.push_back(f);
+            pthread_mutex_unlock(&forwarded_mutex);
+            return true;
+        });
+
+    struct { const char *device; int rssi; vector<uchar> *bytes; } copies[] = {
+        { "im871a[1]", -80, &a }, { "amb8465[2]", -60, &a }, { "im871a[3]", -70, &a },
+        { "im871a[1]", -90, &b }, { "amb8465[2]", -50, &a },
+    };
+
+    TelegramMerger merger(20);
+    merger.start();
+    for (auto &c : copies)
+    {
+        AboutTelegram about(c.device, c.rssi, FrameType::WMBUS);
+        vector<uchar> frame = *c.bytes;
+        merger.add(make_shared<ReceivedFrame>(about, frame), next);
+    }
+    usleep(100*1000);
+    pthread_mutex_lock(&forwarded_mutex);
+    if (forwarded.size() != 2)
+    {
+        printf("ERROR expected 2 forwarded telegrams but got %zu\n", forwarded.size());
+    }
+    else
+    {
+        ReceivedFrame &fa = *forwarded[0];
+        if (fa.bytes != a || fa.about.device != "amb8465[2]" || fa.about.rssi_dbm != -50 ||
+            fa.about.devices != "amb8465[2],im871a[1],im871a[3]")
+        {
+            printf("ERROR in merged telegram device %s rssi %d devices %s\n",
+                   fa.about.device.c_str(), fa.about.rssi_dbm, fa.about.devices.c_str());
+        }
+        ReceivedFrame &fb = *forwarded[1];
+        if (fb.bytes != b || fb.about.device != "im871a[1]" || fb.about.devices != "")
+        {
+            printf("ERROR in single telegram device %s devices %s\n",
+                   fb.about.device.c_str(), fb.about.devices.c_str());
+        }
+    }
+    pthread_mutex_unlock(&forwarded_mutex);
+
+    // The held telegrams are forwarded when stopping, without waiting for the window.
+    TelegramMerger slow(60000);
+    slow.start();
+    AboutTelegram about("im871a[1]", -80, FrameType::WMBUS);
+    vector<uchar> frame = a;
+    slow.add(make_shared<ReceivedFrame>(about, frame), next);
+    slow.stop();
+    if (forwarded.size() != 3) printf("ERROR expected the held telegram to be forwarded when stopping\n");
+
+    merger.stop();
+    string s = merger.statistics();
+    if (s.find("received 5 forwarded 2 merged 1 ") != 0 || s.find("(window 20 ms)") == string::npos)
+    {
+        printf("ERROR in merge statistics \"%s\"\n", s.c_str());
+    }
+}
+
+void checkStatistics(shared_ptr<MeterManager> &manager, const char *expected, const char *when)
+{
+    string s = manager->statistics();
+    if (s.find(expected) == string::npos)
+    {
+        printf("ERROR %s expected \"%s\" in \"%s\"\n", when, expected, s.c_str());
+    }
+}
+
+void test_ignored_meters()
+{
+    // A telegram relayed with dll id 81818181 and tpl id 56465646.
+    vector<uchar> relayed;
+    hex2bin("6644242381818181640E7246564656A51170071F0050052F2F15257A616F14139172137DAE3A0C000000008C20139172"
+            "13000B3B0000000B26784601025AF5000266EF00046D1B08B7214C1338861200CC101300000000CC201338861200426C"
+            "9F2C42EC7EBF2C", &relayed);
+    // The same dll address with a short tpl header, ie without any other id than the dll id.
+    vector<uchar> dll_only(relayed.begin(), relayed.begin()+10);
+    uchar short_tpl[] = { 0x7a, 0x01, 0x00, 0x00, 0x00, 0x2f, 0x2f, 0x2f, 0x2f };
+    dll_only.insert(dll_only.end(), short_tpl, short_tpl+sizeof(short_tpl));
+    dll_only[0] = dll_only.size()-1;
+
+    shared_ptr<MeterManager> manager = createMeterManager(false);
+    manager->setIgnoredMetersCache(100, 1);
+    MeterInfo mi;
+    mi.parse("water", "hydrus", "56465646", "");
+    manager->addMeterTemplate(mi);
+
+    auto send = [&](vector<uchar> &bytes)
+    {
+        AboutTelegram about("test", 0, FrameType::WMBUS);
+        vector<uchar> frame = bytes;
+        manager->handleTelegram(make_shared<ReceivedFrame>(about, frame), true);
+    };
+
+    // The hydrus telegram is encrypted, do not print the warnings about the missing key.
+    silentLogging(true);
+    send(dll_only);
+    checkStatistics(manager, "ignored meters 1 hits 0 misses 1", "remembering an ignored meter");
+    send(dll_only);
+    checkStatistics(manager, "ignored meters 1 hits 1 misses 1", "dropping an ignored meter");
+
+    // The relayed telegram from the same dll address must still reach the template.
+    send(relayed);
+    checkStatistics(manager, "meters 1 (1 from templates", "creating a meter from a relayed telegram");
+    // Creating the meter cleared the cache.
+    checkStatistics(manager, "ignored meters 0 hits 1 misses 1", "not caching a relayed telegram");
+
+    // The entry expires after the ttl.
+    send(dll_only);
+    usleep(1100*1000);
+    send(dll_only);
+    checkStatistics(manager, "ignored meters 1 hits 1 misses 3", "expiring an ignored meter");
+
+    // Adding or removing meters and templates invalidates the cache.
+    MeterInfo other;
+    other.parse("other", "hydrus", "11111111", "");
+    manager->addMeter(createMeter(&other));
+    checkStatistics(manager, "ignored meters 0 ", "adding a meter");
+    send(dll_only);
+    checkStatistics(manager, "ignored meters 1 hits 1 misses 4", "remembering an ignored meter again");
+    manager->removeAllMeters();
+    checkStatistics(manager, "ignored meters 0 ", "removing the meters");
+    send(dll_only);
+    manager->addMeterTemplate(other);
+    checkStatistics(manager, "ignored meters 0 ", "adding a template");
+
+    // A zero size disables the cache.
+    manager->setIgnoredMetersCache(0, 1);
+    send(dll_only);
+    send(dll_only);
+    checkStatistics(manager, "ignored meters 0 hits 1 misses 5", "disabling the cache");
+
+    // A full cache drops its oldest entries.
+    manager->setIgnoredMetersCache(2, 100);
+    vector<uchar> dll_only_b = dll_only, dll_only_c = dll_only;
+    dll_only_b[4]++;
+    dll_only_c[4] += 2;
+    send(dll_only);
+    send(dll_only_b);
+    send(dll_only_c);
+    checkStatistics(manager, "ignored meters 2 hits 1 misses 8", "filling the cache");
+    send(dll_only_c);
+    send(dll_only_b);
+    checkStatistics(manager, "ignored meters 2 hits 3 misses 8", "keeping the newest entries");
+    send(dll_only);
+    checkStatistics(manager, "ignored meters 2 hits 3 misses 9", "dropping the oldest entry");
+
+    // A wildcard template whose driver does not fit the telegram rejects it the same way every time.
+    shared_ptr<MeterManager> wildcard = createMeterManager(false);
+    MeterInfo multical21;
+    multical21.parse("water", "multical21", "*", "");
+    wildcard->addMeterTemplate(multical21);
+    AboutTelegram about("test", 0, FrameType::WMBUS);
+    vector<uchar> frame = dll_only;
+    wildcard->handleTelegram(make_shared<ReceivedFrame>(about, frame), true);
+    checkStatistics(wildcard, "meters 0 (0 from templates", "rejecting a telegram by the driver of the template");
+    checkStatistics(wildcard, "ignored meters 1 hits 0 misses 1", "remembering a telegram rejected by a template");
+    frame = dll_only;
+    wildcard->handleTelegram(make_shared<ReceivedFrame>(about, frame), true);
+    checkStatistics(wildcard, "ignored meters 1 hits 1 misses 1", "dropping a telegram rejected by a template");
+    silentLogging(false);
+}
+
+void test_template_meters()
+{
+    vector<uchar> a, b;
+    hex2bin("1E44AE4C9956341268077A360010002F2F0413181E0000023B00002F2F2F2F", &a);
+    hex2bin("1844AE4C4455223368077A55000000041389E20100023B0000", &b);
+
+    shared_ptr<MeterManager> manager = createMeterManager(false);
+    string json;
+    manager->whenMeterUpdated([&](Telegram *t, Meter *m)
+    {
+        string hr, fields;
+        vector<string> envs, more_json, selected_fields;
+        m->printMeter(t, &hr, &fields, ';', &json, &envs, &more_json, &selected_fields, false);
+    });
+    manager->setMaxMeters(1);
+    MeterInfo mi;
+    mi.parse("water", "auto", "*", "");
+    manager->addMeterTemplate(mi);
+
+    auto send = [&](vector<uchar> &bytes)
+    {
+        AboutTelegram about("test", 0, FrameType::WMBUS);
+        vector<uchar> frame = bytes;
+        manager->handleTelegram(make_shared<ReceivedFrame>(about, frame), true);
+    };
+
+    // The second meter evicts the first meter, which is created again by its next telegram.
+    send(a);
+    send(b);
+    checkStatistics(manager, "meters 1 (1 from templates, 1 removed", "evicting a meter");
+    json = "";
+    send(a);
+    checkStatistics(manager, "meters 1 (1 from templates, 2 removed", "creating an evicted meter again");
+    manager->forEachMeter([](Meter *m)
+    {
+        if (m->idsc() != "12345699" || m->numUpdates() != 1)
+        {
+            printf("ERROR expected the evicted meter 12345699 to be created again, but found %s with %d updates\n",
+                   m->idsc().c_str(), m->numUpdates());
+        }
+    });
+    if (json.find("\"id\":\"12345699\"") == string::npos || json.find("\"total_m3\":7.704") == string::npos)
+    {
+        printf("ERROR the meter created again printed %s\n", json.c_str());
+    }
+
+    // Meters not updated within the idle timeout are removed.
+    manager->setMaxMeters(0);
+    manager->setMeterIdleTimeout(60);
+    send(b);
+    time_t now = time(NULL);
+    manager->removeIdleMeters(now);
+    checkStatistics(manager, "meters 2 (2 from templates, 2 removed", "keeping the recently updated meters");
+    manager->removeIdleMeters(now+61);
+    checkStatistics(manager, "meters 0 (0 from templates, 4 removed", "removing the idle meters");
+    json = "";
+    send(b);
+    checkStatistics(manager, "meters 1 (1 from templates, 4 removed", "creating an idle meter again");
+    if (json.find("\"id\":\"33225544\"") == string::npos || json.find("\"total_m3\":123.529") == string::npos)
+    {
+        printf("ERROR the idle meter created again printed %s\n", json.c_str());
+    }
+}
+
+void test_extraction_plans()
+{
+    vector<uchar> a, b, swapped;
+    hex2bin("1E44AE4C9956341268077A360010002F2F0413181E0000023B00002F2F2F2F", &a);
+    hex2bin("1E44AE4C9956341268077A370010002F2F0413191E0000023B00002F2F2F2F", &b);
+    // The same records in the opposite order, thus another dif/vif layout.
+    hex2bin("1E44AE4C9956341268077A380010002F2F023B10000413201E00002F2F2F2F", &swapped);
+
+    shared_ptr<MeterManager> manager = createMeterManager(false);
+    string json;
+    manager->whenMeterUpdated([&](Telegram *t, Meter *m)
+    {
+        string hr, fields;
+        vector<string> envs, more_json, selected_fields;
+        m->printMeter(t, &hr, &fields, ';', &json, &envs, &more_json, &selected_fields, false);
+    });
+    MeterInfo mi;
+    mi.parse("water", "iperl", "12345699", "");
+    shared_ptr<Meter> meter = createMeter(&mi);
+    manager->addMeter(meter);
+    MeterCommonImplementation *mci = dynamic_cast<MeterCommonImplementation*>(meter.get());
+
+    auto send = [&](vector<uchar> &bytes, int expected_resolved, const char *expected_json, const char *when)
+    {
+        AboutTelegram about("test", 0, FrameType::WMBUS);
+        vector<uchar> frame = bytes;
+        json = "";
+        manager->handleTelegram(make_shared<ReceivedFrame>(about, frame), true);
+        if (mci->numExtractionPlansResolved() != expected_resolved)
+        {
+            printf("ERROR %s expected %d resolved extraction plans but got %d\n",
+                   when, expected_resolved, mci->numExtractionPlansResolved());
+        }
+        if (json.find(expected_json) == string::npos)
+        {
+            printf("ERROR %s expected %s in %s\n", when, expected_json, json.c_str());
+        }
+    };
+
+    send(a, 1, "\"total_m3\":7.704,\"max_flow_m3h\":0,", "resolving the first layout");
+    send(b, 1, "\"total_m3\":7.705,\"max_flow_m3h\":0,", "reusing the plan");
+    send(swapped, 2, "\"total_m3\":7.712,\"max_flow_m3h\":0.016,", "resolving a changed layout");
+    send(a, 2, "\"total_m3\":7.704,\"max_flow_m3h\":0,", "reusing the plan of the first layout");
+}
+
+void test_run_in_parallel()
+{
+    // The helper threads are reused, every call must still do each piece of work exactly once.
+    for (int round = 0; round < 100; ++round)
+    {
+        size_t n = round % 10;
+        vector<int> done(n);
+        runInParallel(n, 1 + round % 4, [&](size_t i) { done[i]++; });
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (done[i] != 1)
+            {
+                printf("ERROR round %d work %zu was done %d times\n", round, i, done[i]);
+            }
+        }
+    }
+}
+
+void test_decode_shards()
+{
+    // Kamstrup meters (mfct 2D2C) with consecutive ids must not all be decoded by the same worker.
+    startDecodeWorkerThreads(4, 0);
+    set<size_t> workers;
+    for (int id = 0; id < 32; ++id)
+    {
+        vector<uchar> bytes;
+        string hex = tostrprintf("1E442D2C%02X8734761B168D20", id);
+        hex2bin(hex, &bytes);
+        AboutTelegram about("test", 0, FrameType::WMBUS);
+        ReceivedFrame frame(about, bytes);
+        uint64_t shard = decodeShard(frame);
+        if (shard != decodeShard(frame))
+        {
+            printf("ERROR the decode shard of the same dll address differs\n");
+        }
+        workers.insert(decodeWorkerIndex(shard));
+    }
+    stopDecodeWorkerThreads();
+    if (workers.size() != 4)
+    {
+        printf("ERROR expected the meters of one manufacturer to use all 4 decode workers, but they used %zu\n",
+               workers.size());
+    }
+}
+
+void test_meter_dispatch()
+{
+    vector<uchar> a, b;
+    hex2bin("1E44AE4C9956341268077A360010002F2F0413181E0000023B00002F2F2F2F", &a);
+    hex2bin("1844AE4C4455223368077A55000000041389E20100023B0000", &b);
+
+    shared_ptr<MeterManager> manager = createMeterManager(false);
+    string updated;
+    manager->whenMeterUpdated([&](Telegram *t, Meter *m)
+    {
+        if (updated != "") updated += " ";
+        updated += m->name();
+    });
+    auto add = [&](const char *name, const char *ids)
+    {
+        MeterInfo mi;
+        mi.parse(name, "iperl", ids, "");
+        manager->addMeter(createMeter(&mi));
+    };
+    auto send = [&](vector<uchar> &bytes, const char *expected, const char *when)
+    {
+        AboutTelegram about("test", 0, FrameType::WMBUS);
+        vector<uchar> frame = bytes;
+        updated = "";
+        manager->handleTelegram(make_shared<ReceivedFrame>(about, frame), true);
+        if (updated != expected)
+        {
+            printf("ERROR %s expected the meters \"%s\" to be updated, but got \"%s\"\n", when, expected, updated.c_str());
+        }
+        // The same meters as a linear scan over all meters would find.
+        Telegram t;
+        t.parseHeader(bytes);
+        string scanned;
+        manager->forEachMeter([&](Meter *m)
+        {
+            bool used_wildcard = false;
+            if (!doesIdsMatchExpressions(t.ids, m->ids(), &used_wildcard)) return;
+            if (scanned != "") scanned += " ";
+            scanned += m->name();
+        });
+        if (updated != scanned)
+        {
+            printf("ERROR %s the linear scan found the meters \"%s\", but \"%s\" were updated\n", when, scanned.c_str(), updated.c_str());
+        }
+    };
+
+    // Exact, wildcard and negated meters get the telegrams in the order they were added.
+    add("exact", "12345699");
+    add("wildcard", "*");
+    add("negated", "*,!12345699");
+    add("other", "33225544");
+    add("exact_again", "12345699");
+    send(a, "exact wildcard exact_again", "dispatching to exact and wildcard meters");
+    send(b, "wildcard negated other", "dispatching to wildcard and negated meters");
+
+    // Removing all meters leaves neither the index nor the matcher with old meters.
+    manager->removeAllMeters();
+    send(a, "", "dispatching without meters");
+    add("other", "33225544");
+    add("negated", "*,!33225544");
+    send(a, "negated", "dispatching to re-added meters");
+    send(b, "other", "dispatching to re-added meters");
+}
@@ -17,9 +17,13 @@
 
 #include "threads.h"
 
+#include <algorithm>
+#include <deque>
+#include <memory>
 #include <unistd.h>
 #include <sys/resource.h>
 #include <stdio.h>
+#include <vector>
 
 #if defined(__APPLE__) && defined(__MACH__)
 #include <mach/mach.h>
@@ -35,6 +39,11 @@ function<void()> event_loop_entry_point_;
 pthread_t timer_loop_thread_ {};
 function<void()> timer_loop_entry_point_;
 
+pthread_t ingest_thread_ {};
+function<void()> ingest_entry_point_;
+pthread_t merge_thread_ {};
+function<void()> merge_entry_point_;
+
 pthread_t getMainThread()
 {
     return main_thread_;
@@ -74,6 +83,223 @@ void startTimerLoopThread(function<void()> cb)
     pthread_create(&timer_loop_thread_, NULL, dispatch, &timer_loop_entry_point_);
 }
 
+pthread_t getIngestThread()
+{
+    return ingest_thread_;
+}
+
+void startIngestThread(function<void()> cb)
+{
+    ingest_entry_point_ = cb;
+    pthread_create(&ingest_thread_, NULL, dispatch, &ingest_entry_point_);
+}
+
+pthread_t getMergeThread()
+{
+    return merge_thread_;
+}
+
+void startMergeThread(function<void()> cb)
+{
+    merge_entry_point_ = cb;
+    pthread_create(&merge_thread_, NULL, dispatch, &merge_entry_point_);
+}
+
+struct DecodeWorker
+{
+    pthread_t thread {};
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+    pthread_cond_t space_available = PTHREAD_COND_INITIALIZER;
+    deque<function<void()>> queue;
+    bool stop {};
+};
+
+vector<unique_ptr<DecodeWorker>> decode_workers_;
+size_t decode_workers_max_queued_ {};
+
+void *decodeWorkerLoop(void *ptr)
+{
+    DecodeWorker *w = static_cast<DecodeWorker*>(ptr);
+    for (;;)
+    {
+        pthread_mutex_lock(&w->mutex);
+        while (w->queue.size() == 0 && !w->stop)
+        {
+            pthread_cond_wait(&w->work_available, &w->mutex);
+        }
+        if (w->queue.size() == 0)
+        {
+            // Stop requested and all work is done.
+            pthread_mutex_unlock(&w->mutex);
+            return NULL;
+        }
+        function<void()> work = std::move(w->queue.front());
+        w->queue.pop_front();
+        pthread_cond_signal(&w->space_available);
+        pthread_mutex_unlock(&w->mutex);
+        work();
+    }
+}
+
+void startDecodeWorkerThreads(int n, size_t max_queued)
+{
+    decode_workers_max_queued_ = max_queued;
+    for (int i = 0; i < n; ++i)
+    {
+        decode_workers_.push_back(unique_ptr<DecodeWorker>(new DecodeWorker()));
+        DecodeWorker *w = decode_workers_.back().get();
+        pthread_create(&w->thread, NULL, decodeWorkerLoop, w);
+    }
+}
+
+int numDecodeWorkerThreads()
+{
+    return decode_workers_.size();
+}
+
+size_t decodeWorkerIndex(uint64_t shard)
+{
+    return shard % decode_workers_.size();
+}
+
+void queueDecodeWork(uint64_t shard, function<void()> work)
+{
+    DecodeWorker *w = decode_workers_[decodeWorkerIndex(shard)].get();
+    pthread_mutex_lock(&w->mutex);
+    while (decode_workers_max_queued_ > 0 && w->queue.size() >= decode_workers_max_queued_)
+    {
+        pthread_cond_wait(&w->space_available, &w->mutex);
+    }
+    w->queue.push_back(std::move(work));
+    pthread_cond_signal(&w->work_available);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+void stopDecodeWorkerThreads()
+{
+    for (auto &w : decode_workers_)
+    {
+        pthread_mutex_lock(&w->mutex);
+        w->stop = true;
+        pthread_cond_signal(&w->work_available);
+        pthread_mutex_unlock(&w->mutex);
+    }
+    for (auto &w : decode_workers_)
+    {
+        pthread_join(w->thread, NULL);
+    }
+    decode_workers_.clear();
+}
+
+struct ParallelHelper
+{
+    pthread_t thread {};
+    bool has_work {};
+};
+
+// The helper threads of runInParallel are started when first needed and then kept,
+// waiting for the next work.
+struct ParallelPool
+{
+    pthread_mutex_t run_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+    pthread_cond_t helpers_done = PTHREAD_COND_INITIALIZER;
+    vector<unique_ptr<ParallelHelper>> helpers;
+    size_t busy_helpers {};
+    size_t next {};
+    size_t n {};
+    function<void(size_t)> *work {};
+};
+
+ParallelPool parallel_pool_;
+
+void doParallelWork(ParallelPool *pp)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&pp->mutex);
+        size_t i = pp->next++;
+        pthread_mutex_unlock(&pp->mutex);
+        if (i >= pp->n) return;
+        (*pp->work)(i);
+    }
+}
+
+void *parallelHelperLoop(void *ptr)
+{
+    ParallelHelper *h = static_cast<ParallelHelper*>(ptr);
+    ParallelPool *pp = &parallel_pool_;
+    pthread_mutex_lock(&pp->mutex);
+    for (;;)
+    {
+        while (!h->has_work)
+        {
+            pthread_cond_wait(&pp->work_available, &pp->mutex);
+        }
+        pthread_mutex_unlock(&pp->mutex);
+        doParallelWork(pp);
+        pthread_mutex_lock(&pp->mutex);
+        h->has_work = false;
+        pp->busy_helpers--;
+        if (pp->busy_helpers == 0) pthread_cond_signal(&pp->helpers_done);
+    }
+    return NULL;
+}
+
+void runInParallel(size_t n, int num_threads, function<void(size_t)> work)
+{
+    size_t num_helpers = 0;
+    if (num_threads > 1 && n > 1) num_helpers = min((size_t)num_threads, n)-1;
+
+    if (num_helpers == 0)
+    {
+        for (size_t i = 0; i < n; ++i) work(i);
+        return;
+    }
+
+    ParallelPool *pp = &parallel_pool_;
+    // Only one caller at a time uses the helpers.
+    pthread_mutex_lock(&pp->run_mutex);
+    pthread_mutex_lock(&pp->mutex);
+    while (pp->helpers.size() < num_helpers)
+    {
+        pp->helpers.push_back(unique_ptr<ParallelHelper>(new ParallelHelper()));
+        ParallelHelper *h = pp->helpers.back().get();
+        pthread_create(&h->thread, NULL, parallelHelperLoop, h);
+    }
+    pp->next = 0;
+    pp->n = n;
+    pp->work = &work;
+    pp->busy_helpers = num_helpers;
+    for (size_t i = 0; i < num_helpers; ++i)
+    {
+        pp->helpers[i]->has_work = true;
+    }
+    pthread_cond_broadcast(&pp->work_available);
+    pthread_mutex_unlock(&pp->mutex);
+
+    doParallelWork(pp);
+
+    // The work lives on this stack, wait until no helper can touch it.
+    pthread_mutex_lock(&pp->mutex);
+    while (pp->busy_helpers > 0)
+    {
+        pthread_cond_wait(&pp->helpers_done, &pp->mutex);
+    }
+    pp->work = NULL;
+    pthread_mutex_unlock(&pp->mutex);
+    pthread_mutex_unlock(&pp->run_mutex);
+}
+
+int numCpus()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) return 1;
+    return (int)n;
+}
+
 pthread_mutex_t wmbus_devices_lock_ = PTHREAD_MUTEX_INITIALIZER;
 const char *wmbus_devices_lock_func_ = "";
 pid_t       wmbus_devices_lock_pid_;
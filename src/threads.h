@@ -52,6 +52,43 @@ void startEventLoopThread(std::function<void()> cb);
 pthread_t getTimerLoopThread();
 void startTimerLoopThread(std::function<void()> cb);
 
+// The ingest thread is optional. When started, the event loop thread puts the
+// received telegrams into the bounded ingest queues of the bus manager, and this
+// thread hands them over to the meter manager. A slow shell or meter file then
+// stalls this thread instead of the reception of telegrams.
+pthread_t getIngestThread();
+void startIngestThread(std::function<void()> cb);
+
+// The merge thread is optional. When started, the telegrams received by several
+// bus devices are held for a few milliseconds by the bus manager, and this thread
+// forwards the best copy of each telegram when its merge window has passed.
+pthread_t getMergeThread();
+void startMergeThread(std::function<void()> cb);
+
+// The decode worker threads are optional. When started, the event loop thread
+// only receives and frames the telegrams, then the parsing, decryption, field
+// extraction and printing is queued to the decode workers. All work queued with
+// the same shard (the dll address) is executed in order by the same worker thread.
+// A meter can still receive telegrams from several shards, thus the meters lock
+// themselves while they are updated.
+// If max_queued is non-zero, then queueDecodeWork waits while the worker
+// already has max_queued pieces of work queued.
+void startDecodeWorkerThreads(int n, size_t max_queued);
+int numDecodeWorkerThreads();
+// The index of the decode worker thread that executes the work queued with this shard.
+size_t decodeWorkerIndex(uint64_t shard);
+void queueDecodeWork(uint64_t shard, std::function<void()> work);
+// Wait for all queued work to be done, then stop the worker threads.
+void stopDecodeWorkerThreads();
+
+// Invoke work(0) to work(n-1) using at most num_threads threads, where the
+// calling thread is one of them. Returns when all work is done.
+// The other threads are kept in a pool and reused by the next call.
+// Concurrent calls wait for each other, thus the work must not call runInParallel.
+void runInParallel(size_t n, int num_threads, std::function<void(size_t)> work);
+// Number of online cpus, at least 1.
+int numCpus();
+
 
 size_t getPeakRSS();
 size_t getCurrentRSS();
@@ -38,6 +38,16 @@
 #include<sys/types.h>
 #include<fcntl.h>
 
+#if defined(__SSE2__)
+#include<emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include<immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include<arm_neon.h>
+#endif
+
 #if defined(__APPLE__) && defined(__MACH__)
 #include <mach-o/dyld.h>
 #endif
@@ -209,24 +219,285 @@ bool isHexStringStrict(const std::string &txt, bool *invalid)
     return isHexString(txt.c_str(), invalid, true);
 }
 
-bool hex2bin(const char* src, vector<uchar> *target)
+char const hex[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A','B','C','D','E','F'};
+
+// The hex kernels decode and encode runs of hex digits. A decode kernel decodes
+// pairs of hex digits until it finds a pair with a non hex digit, it returns the
+// number of decoded pairs. The vectorized kernels handle 16 or 32 bytes at a time
+// and leave the remaining bytes, or a block with a non hex digit, to the scalar code.
+
+static size_t decodeHexScalar(const char *src, size_t pairs, uchar *dst)
 {
-    if (!src) return false;
-    while(*src && src[1]) {
-        if (*src == ' ' || *src == '#' || *src == '|') {
-            // Ignore space and hashes and pipes.
-            src++;
-        } else {
-            int hi = char2int(*src);
-            int lo = char2int(src[1]);
-            if (hi<0 || lo<0) return false;
-            target->push_back(hi*16 + lo);
-            src += 2;
-        }
+    size_t i = 0;
+    for (; i < pairs; ++i)
+    {
+        int hi = char2int(src[2*i]);
+        int lo = char2int(src[2*i+1]);
+        if (hi < 0 || lo < 0) break;
+        dst[i] = hi*16 + lo;
+    }
+    return i;
+}
+
+static void encodeHexScalar(const uchar *src, size_t len, char *dst)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        dst[2*i] = hex[src[i] >> 4];
+        dst[2*i+1] = hex[src[i] & 0xf];
+    }
+}
+
+#if defined(__SSE2__)
+
+// Translate 16 hex digits into their values, returns false if any char is not a hex digit.
+static inline bool hexValuesSSE2(__m128i c, __m128i *v)
+{
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0'-1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9'+1)));
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a'-1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f'+1)));
+    if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff) return false;
+    *v = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                      _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a'-10))));
+    return true;
+}
+
+static size_t decodeHexSSE2(const char *src, size_t pairs, uchar *dst)
+{
+    size_t i = 0;
+    for (; i+16 <= pairs; i += 16)
+    {
+        __m128i a, b;
+        if (!hexValuesSSE2(_mm_loadu_si128((const __m128i*)(src+2*i)), &a)) break;
+        if (!hexValuesSSE2(_mm_loadu_si128((const __m128i*)(src+2*i+16)), &b)) break;
+        // The first digit of every pair is the high nibble.
+        __m128i mask = _mm_set1_epi16(0xff);
+        a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, mask), 4), _mm_srli_epi16(a, 8));
+        b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, mask), 4), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(a, b));
+    }
+    return i+decodeHexScalar(src+2*i, pairs-i, dst+i);
+}
+
+// Translate 16 nibbles into the hex digits 0-9A-F.
+static inline __m128i hexDigitsSSE2(__m128i n)
+{
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('A'-'0'-10));
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letter);
+}
+
+static void encodeHexSSE2(const uchar *src, size_t len, char *dst)
+{
+    size_t i = 0;
+    for (; i+16 <= len; i += 16)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i*)(src+i));
+        __m128i hi = hexDigitsSSE2(_mm_and_si128(_mm_srli_epi16(b, 4), _mm_set1_epi8(0xf)));
+        __m128i lo = hexDigitsSSE2(_mm_and_si128(b, _mm_set1_epi8(0xf)));
+        _mm_storeu_si128((__m128i*)(dst+2*i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(dst+2*i+16), _mm_unpackhi_epi8(hi, lo));
     }
+    encodeHexScalar(src+i, len-i, dst+2*i);
+}
+
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline bool hexValuesAVX2(__m256i c, __m256i *v)
+{
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0'-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9'+1), c));
+    __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a'-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f'+1), lower));
+    if (_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != -1) return false;
+    *v = _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+                         _mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a'-10))));
     return true;
 }
 
+AVX2 static size_t decodeHexAVX2(const char *src, size_t pairs, uchar *dst)
+{
+    size_t i = 0;
+    for (; i+32 <= pairs; i += 32)
+    {
+        __m256i a, b;
+        if (!hexValuesAVX2(_mm256_loadu_si256((const __m256i*)(src+2*i)), &a)) break;
+        if (!hexValuesAVX2(_mm256_loadu_si256((const __m256i*)(src+2*i+32)), &b)) break;
+        __m256i mask = _mm256_set1_epi16(0xff);
+        a = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(a, mask), 4), _mm256_srli_epi16(a, 8));
+        b = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b, mask), 4), _mm256_srli_epi16(b, 8));
+        // The pack works within each 128 bit lane, put the quadwords back in order.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+        _mm256_storeu_si256((__m256i*)(dst+i), packed);
+    }
+    return i+decodeHexSSE2(src+2*i, pairs-i, dst+i);
+}
+
+AVX2 static inline __m256i hexDigitsAVX2(__m256i n)
+{
+    __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)), _mm256_set1_epi8('A'-'0'-10));
+    return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), letter);
+}
+
+AVX2 static void encodeHexAVX2(const uchar *src, size_t len, char *dst)
+{
+    size_t i = 0;
+    for (; i+32 <= len; i += 32)
+    {
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src+i));
+        __m256i hi = hexDigitsAVX2(_mm256_and_si256(_mm256_srli_epi16(b, 4), _mm256_set1_epi8(0xf)));
+        __m256i lo = hexDigitsAVX2(_mm256_and_si256(b, _mm256_set1_epi8(0xf)));
+        // The unpack works within each 128 bit lane, the lanes are swapped back in order.
+        __m256i first = _mm256_unpacklo_epi8(hi, lo);
+        __m256i second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*)(dst+2*i), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst+2*i+32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    encodeHexSSE2(src+i, len-i, dst+2*i);
+}
+
+#undef AVX2
+
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+
+
+// Translate 16 hex digits into their values, returns false if any char is not a hex digit.
+static inline bool hexValuesNEON(uint8x16_t c, uint8x16_t *v)
+{
+    uint8x16_t d = vsubq_u8(c, vdupq_n_u8('0'));
+    uint8x16_t digit = vcleq_u8(d, vdupq_n_u8(9));
+    uint8x16_t a = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t alpha = vcleq_u8(a, vdupq_n_u8(5));
+    uint64x2_t valid = vreinterpretq_u64_u8(vorrq_u8(digit, alpha));
+    if ((vgetq_lane_u64(valid, 0) & vgetq_lane_u64(valid, 1)) != ~(uint64_t)0) return false;
+    *v = vbslq_u8(digit, d, vaddq_u8(a, vdupq_n_u8(10)));
+    return true;
+}
+
+static size_t decodeHexNEON(const char *src, size_t pairs, uchar *dst)
+{
+    size_t i = 0;
+    for (; i+16 <= pairs; i += 16)
+    {
+        // Load the high and the low digits of 16 pairs into separate vectors.
+        uint8x16x2_t c = vld2q_u8((const uint8_t*)(src+2*i));
+        uint8x16_t hi, lo;
+        if (!hexValuesNEON(c.val[0], &hi) || !hexValuesNEON(c.val[1], &lo)) break;
+        vst1q_u8(dst+i, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+    }
+    return i+decodeHexScalar(src+2*i, pairs-i, dst+i);
+}
+
+static inline uint8x16_t hexDigitsNEON(uint8x16_t n)
+{
+    uint8x16_t letter = vandq_u8(vcgtq_u8(n, vdupq_n_u8(9)), vdupq_n_u8('A'-'0'-10));
+    return vaddq_u8(vaddq_u8(n, vdupq_n_u8('0')), letter);
+}
+
+static void encodeHexNEON(const uchar *src, size_t len, char *dst)
+{
+    size_t i = 0;
+    for (; i+16 <= len; i += 16)
+    {
+        uint8x16_t b = vld1q_u8(src+i);
+        uint8x16x2_t out;
+        out.val[0] = hexDigitsNEON(vshrq_n_u8(b, 4));
+        out.val[1] = hexDigitsNEON(vandq_u8(b, vdupq_n_u8(0xf)));
+        // Store the high and the low digits interleaved.
+        vst2q_u8((uint8_t*)(dst+2*i), out);
+    }
+    encodeHexScalar(src+i, len-i, dst+2*i);
+}
+
+#endif
+
+struct HexKernels
+{
+    const char *name;
+    size_t (*decode)(const char *src, size_t pairs, uchar *dst);
+    void (*encode)(const uchar *src, size_t len, char *dst);
+};
+
+static HexKernels scalar_hex_kernels_ = { "scalar", decodeHexScalar, encodeHexScalar };
+
+static HexKernels pickHexKernels()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    // The hex functions might be called by static initializers, before the cpu features are known.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return { "avx2", decodeHexAVX2, encodeHexAVX2 };
+#endif
+#if defined(__SSE2__)
+    return { "sse2", decodeHexSSE2, encodeHexSSE2 };
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+    return { "neon", decodeHexNEON, encodeHexNEON };
+#else
+    return scalar_hex_kernels_;
+#endif
+}
+
+static bool use_scalar_hex_kernels_ = false;
+
+static const HexKernels &hexKernels()
+{
+    static HexKernels picked = pickHexKernels();
+    return use_scalar_hex_kernels_ ? scalar_hex_kernels_ : picked;
+}
+
+const char *hexKernelsName()
+{
+    return hexKernels().name;
+}
+
+void useScalarHexKernels(bool b)
+{
+    use_scalar_hex_kernels_ = b;
+}
+
+// Decode the pairs of hex digits in src. A separator found where a pair should
+// start is skipped, together with skip-1 more chars. Returns false if a pair contains
+// a non hex digit, the bytes decoded before that pair are still added to the target.
+static bool decodeHex(const char *src, size_t len, const char *separators, size_t skip, vector<uchar> *target)
+{
+    const HexKernels &kernels = hexKernels();
+    const char *end = src+len;
+    size_t start = target->size();
+    target->resize(start+len/2);
+    uchar *dst = target->data()+start;
+    uchar *dst_start = dst;
+    bool ok = true;
+
+    while (end-src >= 2)
+    {
+        size_t n = kernels.decode(src, (end-src)/2, dst);
+        src += 2*n;
+        dst += n;
+        if (end-src < 2) break;
+        // The pair at src is not a pair of hex digits.
+        if (*src != 0 && strchr(separators, *src) != NULL)
+        {
+            src += skip;
+            continue;
+        }
+        ok = false;
+        break;
+    }
+    target->resize(start+(dst-dst_start));
+    return ok;
+}
+
+bool hex2bin(const char* src, vector<uchar> *target)
+{
+    if (!src) return false;
+    // Ignore space and hashes and pipes.
+    return decodeHex(src, strlen(src), " #|", 1, target);
+}
+
 bool hex2bin(string &src, vector<uchar> *target)
 {
     return hex2bin(src.c_str(), target);
@@ -235,51 +506,29 @@ bool hex2bin(string &src, vector<uchar> *target)
 bool hex2bin(vector<uchar> &src, vector<uchar> *target)
 {
     if (src.size() % 2 == 1) return false;
-    for (size_t i=0; i<src.size(); i+=2) {
-        if (src[i] != ' ') {
-            int hi = char2int(src[i]);
-            int lo = char2int(src[i+1]);
-            if (hi<0 || lo<0) return false;
-            target->push_back(hi*16 + lo);
-        }
-    }
-    return true;
+    // Ignore pairs starting with a space.
+    return decodeHex((const char*)src.data(), src.size(), " ", 2, target);
 }
 
-char const hex[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A','B','C','D','E','F'};
+static std::string encodeHex(const uchar *data, size_t len)
+{
+    std::string str(2*len, 0);
+    if (len > 0) hexKernels().encode(data, len, &str[0]);
+    return str;
+}
 
 std::string bin2hex(const vector<uchar> &target) {
-    std::string str;
-    for (size_t i = 0; i < target.size(); ++i) {
-        const char ch = target[i];
-        str.append(&hex[(ch  & 0xF0) >> 4], 1);
-        str.append(&hex[ch & 0xF], 1);
-    }
-    return str;
+    return encodeHex(target.data(), target.size());
 }
 
 std::string bin2hex(vector<uchar>::iterator data, vector<uchar>::iterator end, int len) {
-    std::string str;
-    while (data != end && len-- > 0) {
-        const char ch = *data;
-        data++;
-        str.append(&hex[(ch  & 0xF0) >> 4], 1);
-        str.append(&hex[ch & 0xF], 1);
-    }
-    return str;
+    if (len <= 0 || data == end) return "";
+    return encodeHex(&*data, min((size_t)len, (size_t)(end-data)));
 }
 
 std::string bin2hex(vector<uchar> &data, int offset, int len) {
-    std::string str;
-    vector<uchar>::iterator i = data.begin();
-    i += offset;
-    while (i != data.end() && len-- > 0) {
-        const char ch = *i;
-        i++;
-        str.append(&hex[(ch  & 0xF0) >> 4], 1);
-        str.append(&hex[ch & 0xF], 1);
-    }
-    return str;
+    if (len <= 0 || offset >= (int)data.size()) return "";
+    return encodeHex(&data[offset], min((size_t)len, data.size()-offset));
 }
 
 std::string safeString(vector<uchar> &target) {
@@ -847,6 +1096,189 @@ string toIdsCommaSeparated(std::vector<std::string> &ids)
     return cs;
 }
 
+static int hexDigitIndex(char c)
+{
+    if (c >= '0' && c <= '9') return c-'0';
+    if (c >= 'a' && c <= 'f') return 10+c-'a';
+    return -1;
+}
+
+// Only expressions like 1234* !1234* 12345678 !12345678 can be stored in the trie.
+static bool isCompilableMatchExpression(const string &me)
+{
+    size_t i = 0;
+    size_t len = me.length();
+    if (i < len && me[i] == '!') i++;
+    if (i == len) return false;
+    while (i < len && hexDigitIndex(me[i]) != -1) i++;
+    if (i < len && me[i] == '*') i++;
+    return i == len;
+}
+
+int IdMatcher::addNode()
+{
+    Node n;
+    for (int i=0; i<16; ++i) n.children[i] = -1;
+    nodes_.push_back(n);
+    return nodes_.size()-1;
+}
+
+void IdMatcher::addRule(int owner, const string &me)
+{
+    if (nodes_.size() == 0) addNode();
+
+    Rule r;
+    r.owner = owner;
+    r.negative = false;
+
+    size_t i = 0;
+    if (me[i] == '!')
+    {
+        r.negative = true;
+        i++;
+    }
+
+    int n = 0;
+    for (; i < me.length() && me[i] != '*'; ++i)
+    {
+        int d = hexDigitIndex(me[i]);
+        if (nodes_[n].children[d] == -1)
+        {
+            int c = addNode();
+            nodes_[n].children[d] = c;
+        }
+        n = nodes_[n].children[d];
+    }
+
+    if (i < me.length())
+    {
+        nodes_[n].prefix_rules.push_back(r);
+    }
+    else
+    {
+        nodes_[n].exact_rules.push_back(r);
+    }
+}
+
+void IdMatcher::add(int owner, vector<string> &match_rules)
+{
+    num_owners_++;
+    for (const string &me : match_rules)
+    {
+        if (!isCompilableMatchExpression(me))
+        {
+            Fallback f;
+            f.owner = owner;
+            f.match_rules = match_rules;
+            fallbacks_.push_back(f);
+            return;
+        }
+    }
+    for (const string &me : match_rules)
+    {
+        addRule(owner, me);
+    }
+}
+
+void IdMatcher::clear()
+{
+    nodes_.clear();
+    fallbacks_.clear();
+    num_owners_ = 0;
+}
+
+void IdMatcher::collect(vector<Rule> &rules, int id_index, bool wildcard, vector<Hit> *hits)
+{
+    for (Rule &r : rules)
+    {
+        Hit h;
+        h.owner = r.owner;
+        h.id_index = id_index;
+        h.kind = r.negative ? 2 : (wildcard ? 1 : 0);
+        hits->push_back(h);
+    }
+}
+
+void IdMatcher::match(vector<string> &ids, vector<IdMatch> *matches)
+{
+    vector<Hit> hits;
+    int last = ids.size()-1;
+
+    if (nodes_.size() > 0)
+    {
+        for (int k = 0; k <= last; ++k)
+        {
+            string &id = ids[k];
+            // An empty id never matches.
+            if (id.length() == 0) continue;
+
+            int n = 0;
+            size_t i = 0;
+            for (;;)
+            {
+                // A prefix rule matches the remaining digits of the id, even when there are none left.
+                collect(nodes_[n].prefix_rules, k, true, &hits);
+                if (i == id.length())
+                {
+                    collect(nodes_[n].exact_rules, k, false, &hits);
+                    break;
+                }
+                int d = hexDigitIndex(id[i]);
+                if (d == -1 || nodes_[n].children[d] == -1) break;
+                n = nodes_[n].children[d];
+                i++;
+            }
+        }
+    }
+
+    // Group the hits per owner and per id, the owner order is kept since
+    // owners are added in increasing order.
+    sort(hits.begin(), hits.end(),
+         [](const Hit &a, const Hit &b) { return a.owner < b.owner || (a.owner == b.owner && a.id_index < b.id_index); });
+
+    size_t f = 0;
+    size_t i = 0;
+    while (i < hits.size() || f < fallbacks_.size())
+    {
+        if (f < fallbacks_.size() && (i == hits.size() || fallbacks_[f].owner < hits[i].owner))
+        {
+            bool used_wildcard = false;
+            if (doesIdsMatchExpressions(ids, fallbacks_[f].match_rules, &used_wildcard))
+            {
+                matches->push_back({ fallbacks_[f].owner, used_wildcard });
+            }
+            f++;
+            continue;
+        }
+
+        int owner = hits[i].owner;
+        bool owner_match = false;
+        bool used_wildcard = false;
+        while (i < hits.size() && hits[i].owner == owner)
+        {
+            int id_index = hits[i].id_index;
+            bool found_match = false;
+            bool found_negative_match = false;
+            bool exact_match = false;
+            while (i < hits.size() && hits[i].owner == owner && hits[i].id_index == id_index)
+            {
+                if (hits[i].kind == 2) found_negative_match = true;
+                else found_match = true;
+                if (hits[i].kind == 0) exact_match = true;
+                i++;
+            }
+            bool m = found_match && !found_negative_match;
+            if (m) owner_match = true;
+            // Just like doesIdsMatchExpressions, the wildcard flag is decided by the last id.
+            if (id_index == last) used_wildcard = m && !exact_match;
+        }
+        if (owner_match)
+        {
+            matches->push_back({ owner, used_wildcard });
+        }
+    }
+}
+
 bool isFrequency(std::string& fq)
 {
     int len = fq.length();
@@ -976,21 +1408,21 @@ bool checkIfDirExists(const char *dir)
     return false;
 }
 
-void debugPayload(string intro, vector<uchar> &payload)
+void debugPayload(const char *intro, vector<uchar> &payload)
 {
     if (isDebugEnabled())
     {
         string msg = bin2hex(payload);
-        debug("%s \"%s\"\n", intro.c_str(), msg.c_str());
+        debug("%s \"%s\"\n", intro, msg.c_str());
     }
 }
 
-void debugPayload(string intro, vector<uchar> &payload, vector<uchar>::iterator &pos)
+void debugPayload(const char *intro, vector<uchar> &payload, vector<uchar>::iterator &pos)
 {
     if (isDebugEnabled())
     {
         string msg = bin2hex(pos, payload.end(), 1024);
-        debug("%s \"%s\"\n", intro.c_str(), msg.c_str());
+        debug("%s \"%s\"\n", intro, msg.c_str());
     }
 }
 
@@ -1095,60 +1527,116 @@ int parseTime(string time) {
 
 #define CRC16_EN_13757 0x3D65
 
-uint16_t crc16_EN13757_per_byte(uint16_t crc, uchar b)
-{
-    unsigned char i;
+#define CRC16_INIT_VALUE 0xFFFF
+#define CRC16_GOOD_VALUE 0x0F47
+#define CRC16_POLYNOM    0x8408
 
-    for (i = 0; i < 8; i++) {
+// Slicing-by-8 tables, table[k][b] is the crc of the byte b followed by k zero bytes.
+// The EN13757 crc is shifted msb first, the CCITT crc (reflected) is shifted lsb first.
+struct CRC16Tables
+{
+    uint16_t en13757[8][256];
+    uint16_t ccitt[8][256];
 
-        if (((crc & 0x8000) >> 8) ^ (b & 0x80)){
-            crc = (crc << 1)  ^ CRC16_EN_13757;
-        }else{
-            crc = (crc << 1);
+    CRC16Tables()
+    {
+        for (int b = 0; b < 256; ++b)
+        {
+            uint16_t en = b << 8;
+            uint16_t cc = b;
+            for (int i = 0; i < 8; ++i)
+            {
+                en = (en & 0x8000) ? (en << 1) ^ CRC16_EN_13757 : (en << 1);
+                cc = (cc & 1) ? (cc >> 1) ^ CRC16_POLYNOM : (cc >> 1);
+            }
+            en13757[0][b] = en;
+            ccitt[0][b] = cc;
+        }
+        for (int k = 1; k < 8; ++k)
+        {
+            for (int b = 0; b < 256; ++b)
+            {
+                uint16_t en = en13757[k-1][b];
+                en13757[k][b] = (en << 8) ^ en13757[0][en >> 8];
+                uint16_t cc = ccitt[k-1][b];
+                ccitt[k][b] = (cc >> 8) ^ ccitt[0][cc & 0xff];
+            }
         }
-
-        b <<= 1;
     }
+};
 
-    return crc;
+static const CRC16Tables &crc16Tables()
+{
+    static CRC16Tables tables;
+    return tables;
 }
 
-uint16_t crc16_EN13757(uchar *data, size_t len)
+uint16_t crc16_EN13757(const uchar *data, size_t len)
 {
+    const uint16_t (*t)[256] = crc16Tables().en13757;
     uint16_t crc = 0x0000;
 
     assert(len == 0 || data != NULL);
 
-    for (size_t i=0; i<len; ++i)
+    for (; len >= 8; len -= 8, data += 8)
+    {
+        crc = t[7][data[0] ^ (crc >> 8)] ^ t[6][data[1] ^ (crc & 0xff)] ^
+              t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    for (; len > 0; --len)
     {
-        crc = crc16_EN13757_per_byte(crc, data[i]);
+        crc = (crc << 8) ^ t[0][(crc >> 8) ^ *data++];
     }
 
     return (~crc);
 }
 
-#define CRC16_INIT_VALUE 0xFFFF
-#define CRC16_GOOD_VALUE 0x0F47
-#define CRC16_POLYNOM    0x8408
-
-uint16_t crc16_CCITT(uchar *data, uint16_t length)
+uint64_t hash64(const uchar *data, size_t len)
 {
-    uint16_t initVal = CRC16_INIT_VALUE;
-    uint16_t crc = initVal;
-    while(length--)
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0x5bd1e9955bd1e995ULL ^ (len * m);
+
+    assert(len == 0 || data != NULL);
+
+    for (; len >= 8; len -= 8, data += 8)
+    {
+        uint64_t k;
+        memcpy(&k, data, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if (len > 0)
     {
-        int bits = 8;
-        uchar byte = *data++;
-        while(bits--)
+        for (size_t i = len; i > 0; --i)
         {
-            if((byte & 1) ^ (crc & 1))
-            {
-                crc = (crc >> 1) ^ CRC16_POLYNOM;
-            }
-            else
-                crc >>= 1;
-            byte >>= 1;
+            h ^= ((uint64_t)data[i-1]) << (8*(i-1));
         }
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+uint16_t crc16_CCITT(uchar *data, uint16_t length)
+{
+    const uint16_t (*t)[256] = crc16Tables().ccitt;
+    uint16_t crc = CRC16_INIT_VALUE;
+
+    for (; length >= 8; length -= 8, data += 8)
+    {
+        crc = t[7][data[0] ^ (crc & 0xff)] ^ t[6][data[1] ^ (crc >> 8)] ^
+              t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    for (; length > 0; --length)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
     }
     return crc;
 }
@@ -52,12 +52,18 @@ bool isHexStringFlex(const std::string &txt, bool *invalid);
 // Strict strings contain only hexadecimal digits.
 bool isHexStringStrict(const char* txt, bool *invalid);
 bool isHexStringStrict(const std::string &txt, bool *invalid);
+// Returns the value of a hex digit or -1.
+int char2int(char input);
 bool hex2bin(const char* src, std::vector<uchar> *target);
 bool hex2bin(std::string &src, std::vector<uchar> *target);
 bool hex2bin(std::vector<uchar> &src, std::vector<uchar> *target);
 std::string bin2hex(const std::vector<uchar> &target);
 std::string bin2hex(std::vector<uchar>::iterator data, std::vector<uchar>::iterator end, int len);
 std::string bin2hex(std::vector<uchar> &data, int offset, int len);
+// The name of the hex kernels (avx2, sse2, neon or scalar) used by hex2bin and bin2hex,
+// picked for the cpu at startup. The scalar kernels can be forced, for testing.
+const char *hexKernelsName();
+void useScalarHexKernels(bool b);
 std::string safeString(std::vector<uchar> &target);
 void strprintf(std::string &s, const char* fmt, ...);
 std::string tostrprintf(const char* fmt, ...);
@@ -107,8 +113,8 @@ bool isVerboseEnabled();
 bool isDebugEnabled();
 bool isLogTelegramsEnabled();
 
-void debugPayload(std::string intro, std::vector<uchar> &payload);
-void debugPayload(std::string intro, std::vector<uchar> &payload, std::vector<uchar>::iterator &pos);
+void debugPayload(const char *intro, std::vector<uchar> &payload);
+void debugPayload(const char *intro, std::vector<uchar> &payload, std::vector<uchar>::iterator &pos);
 void logTelegram(std::vector<uchar> &original, std::vector<uchar> &parsed, int header_size, int suffix_size);
 
 enum class Alarm
@@ -132,6 +138,60 @@ bool doesIdMatchExpressions(std::string id, std::vector<std::string>& match_rule
 bool doesIdsMatchExpressions(std::vector<std::string> &ids, std::vector<std::string>& match_rules, bool *used_wildcard);
 std::string toIdsCommaSeparated(std::vector<std::string> &ids);
 
+struct IdMatch
+{
+    int owner;
+    bool used_wildcard;
+};
+
+// The match expressions of many owners (meters, templates) compiled into
+// a single trie over the id digits. Matching the ids of a telegram walks the
+// trie once per id and gives the same result as doesIdsMatchExpressions
+// for each owner, but without looking at the expressions that cannot match.
+struct IdMatcher
+{
+    // Add the match expressions for the owner, owners must be added in increasing order.
+    void add(int owner, std::vector<std::string> &match_rules);
+    // Owners are returned in increasing order.
+    void match(std::vector<std::string> &ids, std::vector<IdMatch> *matches);
+    void clear();
+    size_t numOwners() { return num_owners_; }
+
+private:
+
+    struct Rule
+    {
+        int owner;
+        bool negative;
+    };
+    struct Node
+    {
+        int children[16];
+        std::vector<Rule> prefix_rules; // Expressions ending with * at this node.
+        std::vector<Rule> exact_rules; // Expressions ending at this node without *.
+    };
+    struct Hit
+    {
+        int owner;
+        int id_index;
+        uchar kind; // 0 = exact, 1 = wildcard, 2 = negative
+    };
+    struct Fallback
+    {
+        int owner;
+        std::vector<std::string> match_rules;
+    };
+
+    int addNode();
+    void addRule(int owner, const std::string &me);
+    void collect(std::vector<Rule> &rules, int id_index, bool wildcard, std::vector<Hit> *hits);
+
+    std::vector<Node> nodes_;
+    // Owners with expressions using other characters than 0-9a-f are tested the slow way.
+    std::vector<Fallback> fallbacks_;
+    size_t num_owners_ {};
+};
+
 bool isValidId(std::string id, bool accept_non_compliant);
 
 bool isFrequency(std::string& fq);
@@ -165,7 +225,10 @@ int parseTime(std::string time);
 bool isInsideTimePeriod(time_t now, std::string periods);
 bool isValidTimePeriod(std::string periods);
 
-uint16_t crc16_EN13757(uchar *data, size_t len);
+uint16_t crc16_EN13757(const uchar *data, size_t len);
+
+// A fast non-cryptographic 64 bit hash (MurmurHash64A), eight bytes at a time.
+uint64_t hash64(const uchar *data, size_t len);
 
 // This crc is used by im871a for its serial communication.
 uint16_t crc16_CCITT(uchar *data, uint16_t length);
@@ -16,7 +16,6 @@
 */
 
 #include"aescmac.h"
-#include"sha256.h"
 #include"timings.h"
 #include"wmbus.h"
 #include"wmbus_common_implementation.h"
@@ -207,6 +206,11 @@ struct Manufacturer {
 
 vector<Manufacturer> manufacturers_;
 
+// The m-field packs three 5 bit letters into 15 bits, thus every
+// manufacturer can be found directly by its m-field. A slot stores the
+// position in manufacturers_ plus one, zero means unknown manufacturer.
+static uint16_t manufacturer_lookup_[1 << 15];
+
 struct Initializer { Initializer(); };
 
 static Initializer initializser_;
@@ -217,6 +221,98 @@ Initializer::Initializer() {
 LIST_OF_MANUFACTURERS
 #undef X
 
+    for (size_t i = 0; i < manufacturers_.size(); ++i)
+    {
+        int m_field = manufacturers_[i].m_field;
+        if (m_field < 0 || m_field >= (1 << 15)) continue;
+        // The first entry wins, just like the linear search used to.
+        if (manufacturer_lookup_[m_field] == 0) manufacturer_lookup_[m_field] = i + 1;
+    }
+
+}
+
+void MeterKeys::setConfidentialityKey(const vector<uchar> &key)
+{
+    confidentiality_key = key;
+    confidentialityKeyCtx();
+}
+
+const AES_ctx *MeterKeys::confidentialityKeyCtx()
+{
+    const AES_CMAC_ctx *ctx = confidentialityKeyCMACCtx();
+    if (ctx == NULL) return NULL;
+    return &ctx->aes;
+}
+
+const AES_CMAC_ctx *MeterKeys::confidentialityKeyCMACCtx()
+{
+    if (confidentiality_key.size() != 16) return NULL;
+    if (confidentiality_ctx_key_ != confidentiality_key)
+    {
+        AES_CMAC_init_ctx(&confidentiality_ctx_, &confidentiality_key[0]);
+        confidentiality_ctx_key_ = confidentiality_key;
+    }
+    return &confidentiality_ctx_;
+}
+
+template<typename T>
+static void reuseBuffer(T *fresh, T *used)
+{
+    fresh->swap(*used);
+    fresh->clear();
+}
+
+void Telegram::reset()
+{
+    // Every field gets its default value from a fresh telegram,
+    // the emptied buffers of this telegram are moved over to it.
+    Telegram fresh;
+    reuseBuffer(&fresh.about.device, &about.device);
+    reuseBuffer(&fresh.about.devices, &about.devices);
+    reuseBuffer(&fresh.ids, &ids);
+    reuseBuffer(&fresh.idsc, &idsc);
+    reuseBuffer(&fresh.dll_a, &dll_a);
+    reuseBuffer(&fresh.dll_id, &dll_id);
+    reuseBuffer(&fresh.afl_mac_b, &afl_mac_b);
+    reuseBuffer(&fresh.tpl_generated_key, &tpl_generated_key);
+    reuseBuffer(&fresh.tpl_generated_mac_key, &tpl_generated_mac_key);
+    reuseBuffer(&fresh.tpl_a, &tpl_a);
+    reuseBuffer(&fresh.frame, &frame);
+    reuseBuffer(&fresh.parsed, &parsed);
+    reuseBuffer(&fresh.explanations, &explanations);
+    reuseBuffer(&fresh.values, &values);
+    reuseBuffer(&fresh.original, &original);
+    reuseBuffer(&fresh.dv_format_bytes, &dv_format_bytes);
+    reuseBuffer(&fresh.dv_id_bytes, &dv_id_bytes);
+    *this = std::move(fresh);
+}
+
+// Nested decoding, like analyzing, borrows more than one telegram at a time.
+#define MAX_POOLED_TELEGRAMS 4
+
+static thread_local vector<unique_ptr<Telegram>> telegram_pool_;
+
+PooledTelegram::PooledTelegram()
+{
+    if (telegram_pool_.size() == 0)
+    {
+        t_ = new Telegram();
+        return;
+    }
+    t_ = telegram_pool_.back().release();
+    telegram_pool_.pop_back();
+    t_->reset();
+}
+
+PooledTelegram::~PooledTelegram()
+{
+    if (telegram_pool_.size() >= MAX_POOLED_TELEGRAMS)
+    {
+        delete t_;
+        return;
+    }
+    if (telegram_pool_.capacity() == 0) telegram_pool_.reserve(MAX_POOLED_TELEGRAMS);
+    telegram_pool_.push_back(unique_ptr<Telegram>(t_));
 }
 
 void Telegram::print()
@@ -240,9 +336,9 @@ void Telegram::print()
     notice("Received telegram from: %02x%02x%02x%02x\n", a,b,c,d);
     notice("          manufacturer: (%s) %s (0x%02x)\n",
            manufacturerFlag(dll_mfct).c_str(),
-           manufacturer(dll_mfct).c_str(),
+           manufacturer(dll_mfct),
            dll_mfct);
-    notice("                  type: %s (0x%02x)%s\n", mediaType(dll_type, dll_mfct).c_str(), dll_type, enc);
+    notice("                  type: %s (0x%02x)%s\n", mediaType(dll_type, dll_mfct), dll_type, enc);
 
     notice("                   ver: 0x%02x\n", dll_version);
 
@@ -251,9 +347,9 @@ void Telegram::print()
         notice("      Concerning meter: %02x%02x%02x%02x\n", tpl_id_b[3],tpl_id_b[2],tpl_id_b[1],tpl_id_b[0]);
         notice("          manufacturer: (%s) %s (0x%02x)\n",
            manufacturerFlag(tpl_mfct).c_str(),
-           manufacturer(tpl_mfct).c_str(),
+           manufacturer(tpl_mfct),
            tpl_mfct);
-        notice("                  type: %s (0x%02x)%s\n", mediaType(tpl_type, dll_mfct).c_str(), tpl_type, enc);
+        notice("                  type: %s (0x%02x)%s\n", mediaType(tpl_type, dll_mfct), tpl_type, enc);
 
         notice("                   ver: 0x%02x\n", tpl_version);
     }
@@ -268,6 +364,9 @@ void Telegram::print()
 
 void Telegram::printDLL()
 {
+    // Do not render the descriptions unless they are printed.
+    if (!isVerboseEnabled()) return;
+
     if (about.type == FrameType::WMBUS)
     {
         string possible_drivers = autoDetectPossibleDrivers();
@@ -275,13 +374,13 @@ void Telegram::printDLL()
         string man = manufacturerFlag(dll_mfct);
         verbose("(telegram) DLL L=%02x C=%02x (%s) M=%04x (%s) A=%02x%02x%02x%02x VER=%02x TYPE=%02x (%s) (driver %s) DEV=%s RSSI=%d\n",
             dll_len,
-            dll_c, cType(dll_c).c_str(),
+            dll_c, cType(dll_c),
             dll_mfct,
             man.c_str(),
             dll_id[0], dll_id[1], dll_id[2], dll_id[3],
             dll_version,
             dll_type,
-            mediaType(dll_type, dll_mfct).c_str(),
+            mediaType(dll_type, dll_mfct),
             possible_drivers.c_str(),
             about.device.c_str(),
             about.rssi_dbm);
@@ -291,7 +390,7 @@ void Telegram::printDLL()
     {
         verbose("(telegram) DLL L=%02x C=%02x (%s) A=%02x\n",
                 dll_len,
-                dll_c, cType(dll_c).c_str(),
+                dll_c, cType(dll_c),
                 mbus_primary_address);
     }
 
@@ -299,11 +398,10 @@ void Telegram::printDLL()
 
 void Telegram::printELL()
 {
-    if (ell_ci == 0) return;
+    if (ell_ci == 0 || !isVerboseEnabled()) return;
 
-    string ell_cc_info = ccType(ell_cc);
     verbose("(telegram) ELL CI=%02x CC=%02x (%s) ACC=%02x",
-            ell_ci, ell_cc, ell_cc_info.c_str(), ell_acc);
+            ell_ci, ell_cc, ccType(ell_cc), ell_acc);
 
     if (ell_ci == 0x8d || ell_ci == 0x8f)
     {
@@ -342,7 +440,7 @@ void Telegram::printAFL()
 
 void Telegram::printTPL()
 {
-    if (tpl_ci == 0) return;
+    if (tpl_ci == 0 || !isVerboseEnabled()) return;
 
     verbose("(telegram) TPL CI=%02x", tpl_ci);
 
@@ -355,47 +453,154 @@ void Telegram::printTPL()
 
     if (tpl_ci == 0x72)
     {
-        string info = mediaType(tpl_type, tpl_mfct);
         verbose(" ID=%02x%02x%02x%02x MFT=%02x%02x VER=%02x TYPE=%02x (%s)",
                 tpl_id_b[0], tpl_id_b[1], tpl_id_b[2], tpl_id_b[3],
                 tpl_mfct_b[0], tpl_mfct_b[1],
-                tpl_version, tpl_type, info.c_str());
+                tpl_version, tpl_type, mediaType(tpl_type, tpl_mfct));
     }
 
     verbose("\n");
 }
 
-// Store the hashes of the last 10 telegrams here.
-deque<SHA256_HASH> seen_telegrams;
+static struct timeval timeNow()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv;
+}
 
-bool seen_this_telegram_before(vector<uchar> &frame)
+ReceivedFrame::ReceivedFrame(AboutTelegram &a, vector<uchar> &frame) :
+    about(a), bytes(std::move(frame)), received(timeNow())
 {
-    SHA256_HASH hash;
-    Sha256Calculate(&frame[0], frame.size(), &hash);
+}
 
-    auto i = std::find(seen_telegrams.begin(), seen_telegrams.end(), hash);
+ReceivedFrame::ReceivedFrame(AboutTelegram &a, const vector<uchar> &frame, struct timeval r) :
+    about(a), bytes(frame), received(r)
+{
+}
+
+DuplicateFilter::DuplicateFilter(uint64_t window_ms) :
+    window_ms_(window_ms), slots_(64), mask_(63)
+{
+}
+
+bool DuplicateFilter::seenBefore(uint64_t hash, uint64_t now_ms)
+{
+    // Zero marks an empty slot.
+    if (hash == 0) hash = 1;
+
+    checked_++;
+    expire(now_ms);
 
-    if (i != seen_telegrams.end())
+    size_t i = find(hash);
+    if (slots_[i].hash == hash)
     {
-        // Found it!
+        duplicates_++;
         return true;
     }
 
-    if (seen_telegrams.size() >= 10)
+    if ((count_+1)*2 > slots_.size())
     {
-        seen_telegrams.pop_front();
+        grow();
     }
-    seen_telegrams.push_back(hash);
+    insert(hash, now_ms);
+    added_.push_back(hash);
 
     return false;
 }
 
+void DuplicateFilter::expire(uint64_t now_ms)
+{
+    while (added_.size() > 0)
+    {
+        size_t i = find(added_.front());
+        if (now_ms < slots_[i].added_ms + window_ms_) break;
+        erase(i);
+        added_.pop_front();
+    }
+}
+
+size_t DuplicateFilter::find(uint64_t hash)
+{
+    // Returns the slot with the hash, or the empty slot where it would be inserted.
+    size_t i = hash & mask_;
+    while (slots_[i].hash != 0 && slots_[i].hash != hash)
+    {
+        i = (i+1) & mask_;
+    }
+    return i;
+}
+
+void DuplicateFilter::insert(uint64_t hash, uint64_t added_ms)
+{
+    size_t i = find(hash);
+    slots_[i].hash = hash;
+    slots_[i].added_ms = added_ms;
+    count_++;
+}
+
+void DuplicateFilter::erase(size_t i)
+{
+    // Move the following slots of the probe sequence back into the hole,
+    // so that no tombstones are needed.
+    size_t j = i;
+    for (;;)
+    {
+        j = (j+1) & mask_;
+        if (slots_[j].hash == 0) break;
+        size_t home = slots_[j].hash & mask_;
+        // Slot j can be moved to i, unless its home lies cyclically in (i,j].
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays)
+        {
+            slots_[i] = slots_[j];
+            i = j;
+        }
+    }
+    slots_[i].hash = 0;
+    count_--;
+}
+
+void DuplicateFilter::grow()
+{
+    vector<Slot> old;
+    old.swap(slots_);
+    slots_.resize(old.size()*2);
+    mask_ = slots_.size()-1;
+    count_ = 0;
+    for (Slot &s : old)
+    {
+        if (s.hash != 0) insert(s.hash, s.added_ms);
+    }
+}
+
+static DuplicateFilter *duplicate_filter_ = NULL;
+RecursiveMutex duplicate_filter_mutex_ = { "duplicate_filter_mutex" };
+#define LOCK_DUPLICATE_FILTER(where) WITH(duplicate_filter_mutex_, duplicate_filter_mutex, where)
+
+bool seen_this_telegram_before(shared_ptr<ReceivedFrame> &frame)
+{
+    uint64_t hash = hash64(frame->bytes.data(), frame->bytes.size());
+
+    // The frames from the bus threads and the merge stage are not checked in the order
+    // of their received timestamps. Stamp them with a monotonic clock read under the
+    // lock instead, so that the hashes are added in time order.
+    LOCK_DUPLICATE_FILTER(seen_this_telegram_before);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now_ms = ((uint64_t)ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+    return duplicate_filter_->seenBefore(hash, now_ms);
+}
+
 // Store the dll_a (6 bytes composed of 4 id + 1 ver + 1 media )
 // for telegrams that has been warned about!
 deque<vector<uchar>> warning_printed_for_telegrams;
+RecursiveMutex warning_printed_for_telegrams_mutex_ = { "warning_printed_for_telegrams_mutex" };
+#define LOCK_WARNING_PRINTED(where) WITH(warning_printed_for_telegrams_mutex_, warning_printed_for_telegrams_mutex, where)
 
 bool warned_for_telegram_before(Telegram *t, vector<uchar> &dll_a)
 {
+    LOCK_WARNING_PRINTED(warned_for_telegram_before);
     auto i = std::find(warning_printed_for_telegrams.begin(), warning_printed_for_telegrams.end(), dll_a);
 
     if (i != warning_printed_for_telegrams.end())
@@ -423,11 +628,11 @@ bool warned_for_telegram_before(Telegram *t, vector<uchar> &dll_a)
     return false;
 }
 
-string manufacturer(int m_field) {
-    for (auto &m : manufacturers_) {
-	if (m.m_field == m_field) return m.name;
-    }
-    return "Unknown";
+const char *manufacturer(int m_field) {
+    if (m_field < 0 || m_field >= (1 << 15)) return "Unknown";
+    int i = manufacturer_lookup_[m_field];
+    if (i == 0) return "Unknown";
+    return manufacturers_[i-1].name;
 }
 
 string manufacturerFlag(int m_field) {
@@ -442,66 +647,78 @@ string manufacturerFlag(int m_field) {
     return flag;
 }
 
-string mediaType(int a_field_device_type, int m_field) {
-    switch (a_field_device_type) {
-    case 0: return "Other";
-    case 1: return "Oil meter";
-    case 2: return "Electricity meter";
-    case 3: return "Gas meter";
-    case 4: return "Heat meter";
-    case 5: return "Steam meter";
-    case 6: return "Warm Water (30°C-90°C) meter";
-    case 7: return "Water meter";
-    case 8: return "Heat Cost Allocator";
-    case 9: return "Compressed air meter";
-    case 0x0a: return "Cooling load volume at outlet meter";
-    case 0x0b: return "Cooling load volume at inlet meter";
-    case 0x0c: return "Heat volume at inlet meter";
-    case 0x0d: return "Heat/Cooling load meter";
-    case 0x0e: return "Bus/System component";
-    case 0x0f: return "Unknown";
-    case 0x15: return "Hot water (>=90°C) meter";
-    case 0x16: return "Cold water meter";
-    case 0x17: return "Hot/Cold water meter";
-    case 0x18: return "Pressure meter";
-    case 0x19: return "A/D converter";
-    case 0x1A: return "Smoke detector";
-    case 0x1B: return "Room sensor (eg temperature or humidity)";
-    case 0x1C: return "Gas detector";
-    case 0x1D: return "Reserved for sensors";
-    case 0x1F: return "Reserved for sensors";
-    case 0x20: return "Breaker (electricity)";
-    case 0x21: return "Valve (gas or water)";
-    case 0x22: return "Reserved for switching devices";
-    case 0x23: return "Reserved for switching devices";
-    case 0x24: return "Reserved for switching devices";
-    case 0x25: return "Customer unit (display device)";
-    case 0x26: return "Reserved for customer units";
-    case 0x27: return "Reserved for customer units";
-    case 0x28: return "Waste water";
-    case 0x29: return "Garbage";
-    case 0x2A: return "Reserved for Carbon dioxide";
-    case 0x2B: return "Reserved for environmental meter";
-    case 0x2C: return "Reserved for environmental meter";
-    case 0x2D: return "Reserved for environmental meter";
-    case 0x2E: return "Reserved for environmental meter";
-    case 0x2F: return "Reserved for environmental meter";
-    case 0x30: return "Reserved for system devices";
-    case 0x31: return "Reserved for communication controller";
-    case 0x32: return "Reserved for unidirectional repeater";
-    case 0x33: return "Reserved for bidirectional repeater";
-    case 0x34: return "Reserved for system devices";
-    case 0x35: return "Reserved for system devices";
-    case 0x36: return "Radio converter (system side)";
-    case 0x37: return "Radio converter (meter side)";
-    case 0x38: return "Reserved for system devices";
-    case 0x39: return "Reserved for system devices";
-    case 0x3A: return "Reserved for system devices";
-    case 0x3B: return "Reserved for system devices";
-    case 0x3C: return "Reserved for system devices";
-    case 0x3D: return "Reserved for system devices";
-    case 0x3E: return "Reserved for system devices";
-    case 0x3F: return "Reserved for system devices";
+static const char *media_types_[0x40] =
+{
+    /* 00 */ "Other",
+    /* 01 */ "Oil meter",
+    /* 02 */ "Electricity meter",
+    /* 03 */ "Gas meter",
+    /* 04 */ "Heat meter",
+    /* 05 */ "Steam meter",
+    /* 06 */ "Warm Water (30°C-90°C) meter",
+    /* 07 */ "Water meter",
+    /* 08 */ "Heat Cost Allocator",
+    /* 09 */ "Compressed air meter",
+    /* 0a */ "Cooling load volume at outlet meter",
+    /* 0b */ "Cooling load volume at inlet meter",
+    /* 0c */ "Heat volume at inlet meter",
+    /* 0d */ "Heat/Cooling load meter",
+    /* 0e */ "Bus/System component",
+    /* 0f */ "Unknown",
+    /* 10 */ NULL,
+    /* 11 */ NULL,
+    /* 12 */ NULL,
+    /* 13 */ NULL,
+    /* 14 */ NULL,
+    /* 15 */ "Hot water (>=90°C) meter",
+    /* 16 */ "Cold water meter",
+    /* 17 */ "Hot/Cold water meter",
+    /* 18 */ "Pressure meter",
+    /* 19 */ "A/D converter",
+    /* 1a */ "Smoke detector",
+    /* 1b */ "Room sensor (eg temperature or humidity)",
+    /* 1c */ "Gas detector",
+    /* 1d */ "Reserved for sensors",
+    /* 1e */ NULL,
+    /* 1f */ "Reserved for sensors",
+    /* 20 */ "Breaker (electricity)",
+    /* 21 */ "Valve (gas or water)",
+    /* 22 */ "Reserved for switching devices",
+    /* 23 */ "Reserved for switching devices",
+    /* 24 */ "Reserved for switching devices",
+    /* 25 */ "Customer unit (display device)",
+    /* 26 */ "Reserved for customer units",
+    /* 27 */ "Reserved for customer units",
+    /* 28 */ "Waste water",
+    /* 29 */ "Garbage",
+    /* 2a */ "Reserved for Carbon dioxide",
+    /* 2b */ "Reserved for environmental meter",
+    /* 2c */ "Reserved for environmental meter",
+    /* 2d */ "Reserved for environmental meter",
+    /* 2e */ "Reserved for environmental meter",
+    /* 2f */ "Reserved for environmental meter",
+    /* 30 */ "Reserved for system devices",
+    /* 31 */ "Reserved for communication controller",
+    /* 32 */ "Reserved for unidirectional repeater",
+    /* 33 */ "Reserved for bidirectional repeater",
+    /* 34 */ "Reserved for system devices",
+    /* 35 */ "Reserved for system devices",
+    /* 36 */ "Radio converter (system side)",
+    /* 37 */ "Radio converter (meter side)",
+    /* 38 */ "Reserved for system devices",
+    /* 39 */ "Reserved for system devices",
+    /* 3a */ "Reserved for system devices",
+    /* 3b */ "Reserved for system devices",
+    /* 3c */ "Reserved for system devices",
+    /* 3d */ "Reserved for system devices",
+    /* 3e */ "Reserved for system devices",
+    /* 3f */ "Reserved for system devices",
+};
+
+const char *mediaType(int a_field_device_type, int m_field) {
+    if (a_field_device_type >= 0 && a_field_device_type < 0x40 && media_types_[a_field_device_type])
+    {
+        return media_types_[a_field_device_type];
     }
 
     if (m_field == MANUFACTURER_TCH)
@@ -522,67 +739,79 @@ string mediaType(int a_field_device_type, int m_field) {
     return "Unknown";
 }
 
-string mediaTypeJSON(int a_field_device_type, int m_field)
-{
-    switch (a_field_device_type) {
-    case 0: return "other";
-    case 1: return "oil";
-    case 2: return "electricity";
-    case 3: return "gas";
-    case 4: return "heat";
-    case 5: return "steam";
-    case 6: return "warm water";
-    case 7: return "water";
-    case 8: return "heat cost allocation";
-    case 9: return "compressed air";
-    case 0x0a: return "cooling load volume at outlet";
-    case 0x0b: return "cooling load volume at inlet";
-    case 0x0c: return "heat volume at inlet";
-    case 0x0d: return "heat/cooling load";
-    case 0x0e: return "bus/system component";
-    case 0x0f: return "unknown";
-    case 0x15: return "hot water";
-    case 0x16: return "cold water";
-    case 0x17: return "hot/cold water";
-    case 0x18: return "pressure";
-    case 0x19: return "a/d converter";
-    case 0x1A: return "smoke detector";
-    case 0x1B: return "room sensor";
-    case 0x1C: return "gas detector";
-    case 0x1D: return "reserved";
-    case 0x1F: return "reserved";
-    case 0x20: return "breaker";
-    case 0x21: return "valve";
-    case 0x22: return "reserved";
-    case 0x23: return "reserved";
-    case 0x24: return "reserved";
-    case 0x25: return "customer unit (display device)";
-    case 0x26: return "reserved";
-    case 0x27: return "reserved";
-    case 0x28: return "waste water";
-    case 0x29: return "garbage";
-    case 0x2A: return "reserved";
-    case 0x2B: return "reserved";
-    case 0x2C: return "reserved";
-    case 0x2D: return "reserved";
-    case 0x2E: return "reserved";
-    case 0x2F: return "reserved";
-    case 0x30: return "reserved";
-    case 0x31: return "reserved";
-    case 0x32: return "reserved";
-    case 0x33: return "reserved";
-    case 0x34: return "reserved";
-    case 0x35: return "reserved";
-    case 0x36: return "radio converter (system side)";
-    case 0x37: return "radio converter (meter side)";
-    case 0x38: return "reserved";
-    case 0x39: return "reserved";
-    case 0x3A: return "reserved";
-    case 0x3B: return "reserved";
-    case 0x3C: return "reserved";
-    case 0x3D: return "reserved";
-    case 0x3E: return "reserved";
-    case 0x3F: return "reserved";
+static const char *media_types_json_[0x40] =
+{
+    /* 00 */ "other",
+    /* 01 */ "oil",
+    /* 02 */ "electricity",
+    /* 03 */ "gas",
+    /* 04 */ "heat",
+    /* 05 */ "steam",
+    /* 06 */ "warm water",
+    /* 07 */ "water",
+    /* 08 */ "heat cost allocation",
+    /* 09 */ "compressed air",
+    /* 0a */ "cooling load volume at outlet",
+    /* 0b */ "cooling load volume at inlet",
+    /* 0c */ "heat volume at inlet",
+    /* 0d */ "heat/cooling load",
+    /* 0e */ "bus/system component",
+    /* 0f */ "unknown",
+    /* 10 */ NULL,
+    /* 11 */ NULL,
+    /* 12 */ NULL,
+    /* 13 */ NULL,
+    /* 14 */ NULL,
+    /* 15 */ "hot water",
+    /* 16 */ "cold water",
+    /* 17 */ "hot/cold water",
+    /* 18 */ "pressure",
+    /* 19 */ "a/d converter",
+    /* 1a */ "smoke detector",
+    /* 1b */ "room sensor",
+    /* 1c */ "gas detector",
+    /* 1d */ "reserved",
+    /* 1e */ NULL,
+    /* 1f */ "reserved",
+    /* 20 */ "breaker",
+    /* 21 */ "valve",
+    /* 22 */ "reserved",
+    /* 23 */ "reserved",
+    /* 24 */ "reserved",
+    /* 25 */ "customer unit (display device)",
+    /* 26 */ "reserved",
+    /* 27 */ "reserved",
+    /* 28 */ "waste water",
+    /* 29 */ "garbage",
+    /* 2a */ "reserved",
+    /* 2b */ "reserved",
+    /* 2c */ "reserved",
+    /* 2d */ "reserved",
+    /* 2e */ "reserved",
+    /* 2f */ "reserved",
+    /* 30 */ "reserved",
+    /* 31 */ "reserved",
+    /* 32 */ "reserved",
+    /* 33 */ "reserved",
+    /* 34 */ "reserved",
+    /* 35 */ "reserved",
+    /* 36 */ "radio converter (system side)",
+    /* 37 */ "radio converter (meter side)",
+    /* 38 */ "reserved",
+    /* 39 */ "reserved",
+    /* 3a */ "reserved",
+    /* 3b */ "reserved",
+    /* 3c */ "reserved",
+    /* 3d */ "reserved",
+    /* 3e */ "reserved",
+    /* 3f */ "reserved",
+};
+
+const char *mediaTypeJSON(int a_field_device_type, int m_field)
+{
+    if (a_field_device_type >= 0 && a_field_device_type < 0x40 && media_types_json_[a_field_device_type])
+    {
+        return media_types_json_[a_field_device_type];
     }
 
     if (m_field == MANUFACTURER_TCH)
@@ -648,7 +877,7 @@ LIST_OF_CI_FIELDS
     return -2;
 }
 
-string ciType(int ci_field)
+const char *ciType(int ci_field)
 {
     if (ci_field >= 0xA0 && ci_field <= 0xB7) {
         return "Mfct specific";
@@ -760,6 +989,13 @@ string ciType(int ci_field)
 
 void Telegram::addExplanationAndIncrementPos(vector<uchar>::iterator &pos, int len, KindOfData k, Understanding u, const char* fmt, ...)
 {
+    if (!explaining())
+    {
+        parsed.insert(parsed.end(), pos, pos+len);
+        pos += len;
+        return;
+    }
+
     char buf[1024];
     buf[1023] = 0;
 
@@ -777,11 +1013,14 @@ void Telegram::addExplanationAndIncrementPos(vector<uchar>::iterator &pos, int l
 
 void Telegram::addMoreExplanation(int pos, string json)
 {
+    if (!explaining()) return;
     addMoreExplanation(pos, " (%s)", json.c_str());
 }
 
 void Telegram::addMoreExplanation(int pos, const char* fmt, ...)
 {
+    if (!explaining()) return;
+
     char buf[1024];
 
     buf[1023] = 0;
@@ -810,6 +1049,8 @@ void Telegram::addMoreExplanation(int pos, const char* fmt, ...)
 
 void Telegram::addSpecialExplanation(int offset, int len, KindOfData k, Understanding u, const char* fmt, ...)
 {
+    if (!explaining()) return;
+
     char buf[1024];
     buf[1023] = 0;
 
@@ -883,7 +1124,7 @@ bool Telegram::parseDLL(vector<uchar>::iterator &pos)
     addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x length (%d bytes)", dll_len, dll_len);
 
     dll_c = *pos;
-    addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x dll-c (%s)", dll_c, cType(dll_c).c_str());
+    addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x dll-c (%s)", dll_c, cType(dll_c));
 
     dll_mfct_b[0] = *(pos+0);
     dll_mfct_b[1] = *(pos+1);
@@ -914,7 +1155,7 @@ bool Telegram::parseDLL(vector<uchar>::iterator &pos)
     dll_type = *(pos+1);
     addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x dll-version", dll_version);
     addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x dll-type (%s)", dll_type,
-                                  mediaType(dll_type, dll_mfct).c_str());
+                                  mediaType(dll_type, dll_mfct));
 
     return true;
 }
@@ -943,7 +1184,7 @@ bool Telegram::parseELL(vector<uchar>::iterator &pos)
     int ci_field = *pos;
     if (!isCiFieldOfType(ci_field, CI_TYPE::ELL)) return true;
     addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x ell-ci-field (%s)",
-                                  ci_field, ciType(ci_field).c_str());
+                                  ci_field, ciType(ci_field));
     ell_ci = ci_field;
     int len = ciFieldLength(ell_ci);
 
@@ -952,7 +1193,7 @@ bool Telegram::parseELL(vector<uchar>::iterator &pos)
     // All ELL:s (including ELL I) start with cc,acc.
 
     ell_cc = *pos;
-    addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x ell-cc (%s)", ell_cc, ccType(ell_cc).c_str());
+    addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x ell-cc (%s)", ell_cc, ccType(ell_cc));
 
     ell_acc = *pos;
     addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x ell-acc", ell_acc);
@@ -998,7 +1239,7 @@ bool Telegram::parseELL(vector<uchar>::iterator &pos)
         // Add ell_id to ids.
         string id = tostrprintf("%02x%02x%02x%02x", *(pos+3), *(pos+2), *(pos+1), *(pos+0));
         ids.push_back(id);
-        idsc = idsc+","+id;
+        idsc += ","+id;
         addExplanationAndIncrementPos(pos, 4, KindOfData::PROTOCOL, Understanding::FULL, "%02x%02x%02x%02x ell-id",
                                       ell_id_b[0], ell_id_b[1], ell_id_b[2], ell_id_b[3]);
 
@@ -1030,7 +1271,7 @@ bool Telegram::parseELL(vector<uchar>::iterator &pos)
         {
             if (meter_keys)
             {
-                decrypt_ELL_AES_CTR(this, frame, pos, meter_keys->confidentiality_key);
+                decrypt_ELL_AES_CTR(this, frame, pos, meter_keys->confidentialityKeyCtx());
                 // Actually this ctr decryption always succeeds, if wrong key, it will decrypt to garbage.
             }
             // Now the frame from pos and onwards has been decrypted, perhaps.
@@ -1075,9 +1316,9 @@ bool Telegram::parseELL(vector<uchar>::iterator &pos)
                             check  & 0xff, check >> 8,
                             dll_id_b[3], dll_id_b[2], dll_id_b[1], dll_id_b[0],
                             manufacturerFlag(dll_mfct).c_str(),
-                            manufacturer(dll_mfct).c_str(),
+                            manufacturer(dll_mfct),
                             dll_mfct,
-                            mediaType(dll_type, dll_mfct).c_str(), dll_type,
+                            mediaType(dll_type, dll_mfct), dll_type,
                             dll_version);
                 }
             }
@@ -1096,7 +1337,7 @@ bool Telegram::parseNWL(vector<uchar>::iterator &pos)
     int ci_field = *pos;
     if (!isCiFieldOfType(ci_field, CI_TYPE::NWL)) return true;
     addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x nwl-ci-field (%s)",
-                                  ci_field, ciType(ci_field).c_str());
+                                  ci_field, ciType(ci_field));
     nwl_ci = ci_field;
     // We have only seen 0x81 0x1d so far.
     int len = 1; // ciFieldLength(nwl_ci);
@@ -1122,7 +1363,7 @@ bool Telegram::parseAFL(vector<uchar>::iterator &pos)
     int ci_field = *pos;
     if (!isCiFieldOfType(ci_field, CI_TYPE::AFL)) return true;
     addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x afl-ci-field (%s)",
-                                  ci_field, ciType(ci_field).c_str());
+                                  ci_field, ciType(ci_field));
     afl_ci = ci_field;
 
     afl_len = *pos;
@@ -1307,8 +1548,6 @@ bool Telegram::parseTPLConfig(std::vector<uchar>::iterator &pos)
         if (tpl_kdf_selection == 1)
         {
             vector<uchar> input;
-            vector<uchar> mac;
-            mac.resize(16);
 
             // DC C ID 0x07 0x07 0x07 0x07 0x07 0x07 0x07
             // Derivation Constant DC = 0x00 = encryption from meter.
@@ -1333,7 +1572,8 @@ bool Telegram::parseTPLConfig(std::vector<uchar>::iterator &pos)
 
             debugPayload("(wmbus) input to kdf for enc", input);
 
-            if (meter_keys == NULL || meter_keys->confidentiality_key.size() != 16)
+            const AES_CMAC_ctx *kdf = meter_keys ? meter_keys->confidentialityKeyCMACCtx() : NULL;
+            if (kdf == NULL)
             {
                 if (isSimulated())
                 {
@@ -1343,21 +1583,24 @@ bool Telegram::parseTPLConfig(std::vector<uchar>::iterator &pos)
                 debug("(wmbus) no key, thus cannot execute kdf.\n");
                 return false;
             }
-            AES_CMAC(&meter_keys->confidentiality_key[0], &input[0], 16, &mac[0]);
-            string s = bin2hex(mac);
-            debug("(wmbus) ephemereal Kenc %s\n", s.c_str());
-            tpl_generated_key.clear();
-            tpl_generated_key.insert(tpl_generated_key.end(), mac.begin(), mac.end());
+            // The kdf input is a single block, with the cached subkeys each key costs one aes block.
+            tpl_generated_key.resize(16);
+            AES_CMAC(kdf, &input[0], 16, &tpl_generated_key[0]);
+            if (isDebugEnabled())
+            {
+                string s = bin2hex(tpl_generated_key);
+                debug("(wmbus) ephemereal Kenc %s\n", s.c_str());
+            }
 
             input[0] = 0x01; // DC 01 = generate ephemereal mac key from meter.
-            mac.clear();
-            mac.resize(16);
             debugPayload("(wmbus) input to kdf for mac", input);
-            AES_CMAC(&meter_keys->confidentiality_key[0], &input[0], 16, &mac[0]);
-            s = bin2hex(mac);
-            debug("(wmbus) ephemereal Kmac %s\n", s.c_str());
-            tpl_generated_mac_key.clear();
-            tpl_generated_mac_key.insert(tpl_generated_mac_key.end(), mac.begin(), mac.end());
+            tpl_generated_mac_key.resize(16);
+            AES_CMAC(kdf, &input[0], 16, &tpl_generated_mac_key[0]);
+            if (isDebugEnabled())
+            {
+                string s = bin2hex(tpl_generated_mac_key);
+                debug("(wmbus) ephemereal Kmac %s\n", s.c_str());
+            }
         }
     }
 
@@ -1401,7 +1644,7 @@ bool Telegram::parseLongTPL(std::vector<uchar>::iterator &pos)
     // Add the tpl_id to ids.
     string id = tostrprintf("%02x%02x%02x%02x", *(pos+3), *(pos+2), *(pos+1), *(pos+0));
     ids.push_back(id);
-    idsc = idsc+","+id;
+    idsc += ","+id;
 
     addExplanationAndIncrementPos(pos, 4, KindOfData::PROTOCOL, Understanding::FULL,
                                   "%02x%02x%02x%02x tpl-id (%02x%02x%02x%02x)",
@@ -1423,8 +1666,8 @@ bool Telegram::parseLongTPL(std::vector<uchar>::iterator &pos)
     CHECK(1);
     tpl_type = *(pos+0);
     tpl_a[5] = *(pos+0);
-    string info = mediaType(tpl_type, tpl_mfct);
-    addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x tpl-type (%s)", tpl_type, info.c_str());
+    addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL, "%02x tpl-type (%s)", tpl_type,
+                                  mediaType(tpl_type, tpl_mfct));
 
     bool ok = parseShortTPL(pos);
 
@@ -1438,8 +1681,7 @@ bool Telegram::checkMAC(std::vector<uchar> &frame,
                         std::vector<uchar> &mackey)
 {
     vector<uchar> input;
-    vector<uchar> mac;
-    mac.resize(16);
+    uchar mac[16];
 
     if (mackey.size() != 16) return false;
     if (inmac.size() == 0) return false;
@@ -1450,15 +1692,23 @@ bool Telegram::checkMAC(std::vector<uchar> &frame,
     input.insert(input.end(), afl_mcl);
     input.insert(input.end(), afl_counter_b, afl_counter_b+4);
     input.insert(input.end(), from, to);
-    string s = bin2hex(input);
-    debug("(wmbus) input to mac %s\n", s.c_str());
-    AES_CMAC(&mackey[0], &input[0], input.size(), &mac[0]);
-    string calculated = bin2hex(mac);
-    debug("(wmbus) calculated mac %s\n", calculated.c_str());
-    string received = bin2hex(inmac);
-    debug("(wmbus) received   mac %s\n", received.c_str());
-    string truncated = calculated.substr(0, received.length());
-    bool ok = truncated == received;
+
+    // The ephemereal Kmac is new for every counter value, prepare it once for all data blocks.
+    AES_CMAC_ctx ctx;
+    AES_CMAC_init_ctx(&ctx, &mackey[0]);
+    AES_CMAC(&ctx, &input[0], input.size(), mac);
+
+    // The received mac is the calculated mac truncated.
+    bool ok = inmac.size() <= sizeof(mac) && memcmp(mac, &inmac[0], inmac.size()) == 0;
+    if (isDebugEnabled())
+    {
+        string s = bin2hex(input);
+        debug("(wmbus) input to mac %s\n", s.c_str());
+        string calculated = bin2hex(vector<uchar>(mac, mac+sizeof(mac)));
+        debug("(wmbus) calculated mac %s\n", calculated.c_str());
+        string received = bin2hex(inmac);
+        debug("(wmbus) received   mac %s\n", received.c_str());
+    }
     if (ok) debug("(wmbus) mac ok!\n");
     else {
         debug("(wmbus) mac NOT ok!\n");
@@ -1491,9 +1741,9 @@ bool Telegram::potentiallyDecrypt(vector<uchar>::iterator &pos)
                         "id: %02x%02x%02x%02x mfct: (%s) %s (0x%02x) type: %s (0x%02x) ver: 0x%02x\n",
                             dll_id_b[3], dll_id_b[2], dll_id_b[1], dll_id_b[0],
                             manufacturerFlag(dll_mfct).c_str(),
-                            manufacturer(dll_mfct).c_str(),
+                            manufacturer(dll_mfct),
                             dll_mfct,
-                            mediaType(dll_type, dll_mfct).c_str(), dll_type,
+                            mediaType(dll_type, dll_mfct), dll_type,
                             dll_version);
                 return false;
             }
@@ -1506,7 +1756,7 @@ bool Telegram::potentiallyDecrypt(vector<uchar>::iterator &pos)
         }
         int num_encrypted_bytes = 0;
         int num_not_encrypted_at_end = 0;
-        bool ok = decrypt_TPL_AES_CBC_IV(this, frame, pos, meter_keys->confidentiality_key,
+        bool ok = decrypt_TPL_AES_CBC_IV(this, frame, pos, meter_keys->confidentialityKeyCtx(),
                                          &num_encrypted_bytes, &num_not_encrypted_at_end);
         if (!ok)
         {
@@ -1533,9 +1783,9 @@ bool Telegram::potentiallyDecrypt(vector<uchar>::iterator &pos)
                             "Permanently ignoring telegrams from id: %02x%02x%02x%02x mfct: (%s) %s (0x%02x) type: %s (0x%02x) ver: 0x%02x\n",
                             dll_id_b[3], dll_id_b[2], dll_id_b[1], dll_id_b[0],
                             manufacturerFlag(dll_mfct).c_str(),
-                            manufacturer(dll_mfct).c_str(),
+                            manufacturer(dll_mfct),
                             dll_mfct,
-                            mediaType(dll_type, dll_mfct).c_str(), dll_type,
+                            mediaType(dll_type, dll_mfct), dll_type,
                             dll_version);
                 }
             }
@@ -1568,18 +1818,26 @@ bool Telegram::potentiallyDecrypt(vector<uchar>::iterator &pos)
                             "Permanently ignoring telegrams from id: %02x%02x%02x%02x mfct: (%s) %s (0x%02x) type: %s (0x%02x) ver: 0x%02x\n",
                             dll_id_b[3], dll_id_b[2], dll_id_b[1], dll_id_b[0],
                             manufacturerFlag(dll_mfct).c_str(),
-                            manufacturer(dll_mfct).c_str(),
+                            manufacturer(dll_mfct),
                             dll_mfct,
-                            mediaType(dll_type, dll_mfct).c_str(), dll_type,
+                            mediaType(dll_type, dll_mfct), dll_type,
                             dll_version);
                 }
             }
             return false;
         }
 
+        // The ephemereal key is generated for this telegram, expand it once for all blocks.
+        AES_ctx generated_key_ctx;
+        const AES_ctx *aes = NULL;
+        if (tpl_generated_key.size() == 16)
+        {
+            AES_init_ctx(&generated_key_ctx, &tpl_generated_key[0]);
+            aes = &generated_key_ctx;
+        }
         int num_encrypted_bytes = 0;
         int num_not_encrypted_at_end = 0;
-        bool ok = decrypt_TPL_AES_CBC_NO_IV(this, frame, pos, tpl_generated_key,
+        bool ok = decrypt_TPL_AES_CBC_NO_IV(this, frame, pos, aes,
                                             &num_encrypted_bytes,
                                             &num_not_encrypted_at_end);
         if (!ok)
@@ -1602,9 +1860,9 @@ bool Telegram::potentiallyDecrypt(vector<uchar>::iterator &pos)
                             "Permanently ignoring telegrams from id: %02x%02x%02x%02x mfct: (%s) %s (0x%02x) type: %s (0x%02x) ver: 0x%02x\n",
                             dll_id_b[3], dll_id_b[2], dll_id_b[1], dll_id_b[0],
                             manufacturerFlag(dll_mfct).c_str(),
-                            manufacturer(dll_mfct).c_str(),
+                            manufacturer(dll_mfct),
                             dll_mfct,
-                            mediaType(dll_type, dll_mfct).c_str(), dll_type,
+                            mediaType(dll_type, dll_mfct), dll_type,
                             dll_version);
                 }
             }
@@ -1638,9 +1896,9 @@ bool Telegram::potentiallyDecrypt(vector<uchar>::iterator &pos)
                 "id: %02x%02x%02x%02x mfct: (%s) %s (0x%02x) type: %s (0x%02x) ver: 0x%02x\n",
                 dll_id_b[3], dll_id_b[2], dll_id_b[1], dll_id_b[0],
                 manufacturerFlag(dll_mfct).c_str(),
-                manufacturer(dll_mfct).c_str(),
+                manufacturer(dll_mfct),
                 dll_mfct,
-                mediaType(dll_type, dll_mfct).c_str(), dll_type,
+                mediaType(dll_type, dll_mfct), dll_type,
                 dll_version);
         return false;
     }
@@ -1661,7 +1919,7 @@ bool Telegram::parse_TPL_72(vector<uchar>::iterator &pos)
 
     if (decrypt_ok)
     {
-        parseDV(this, frame, pos, remaining, &values);
+        parseDV(this, frame, pos, remaining, &values, NULL, 0, &dv_format_hash);
     }
     else
     {
@@ -1676,7 +1934,7 @@ bool Telegram::parse_TPL_78(vector<uchar>::iterator &pos)
     header_size = distance(frame.begin(), pos);
     int remaining = distance(pos, frame.end());
     suffix_size = 0;
-    parseDV(this, frame, pos, remaining, &values);
+    parseDV(this, frame, pos, remaining, &values, NULL, 0, &dv_format_hash);
 
     return true;
 }
@@ -1720,7 +1978,7 @@ bool Telegram::parse_TPL_79(vector<uchar>::iterator &pos)
     int remaining = distance(pos, frame.end());
     suffix_size = 0;
 
-    parseDV(this, frame, pos, remaining, &values, &format, format_bytes.size());
+    parseDV(this, frame, pos, remaining, &values, &format, format_bytes.size(), &dv_format_hash);
 
     return true;
 }
@@ -1738,7 +1996,7 @@ bool Telegram::parse_TPL_7A(vector<uchar>::iterator &pos)
 
     if (decrypt_ok)
     {
-        parseDV(this, frame, pos, remaining, &values);
+        parseDV(this, frame, pos, remaining, &values, NULL, 0, &dv_format_hash);
     }
     else
     {
@@ -1765,7 +2023,7 @@ bool Telegram::parseTPL(vector<uchar>::iterator &pos)
 
     addExplanationAndIncrementPos(pos, 1, KindOfData::PROTOCOL, Understanding::FULL,
                                   "%02x tpl-ci-field (%s)",
-                                  tpl_ci, ciType(tpl_ci).c_str());
+                                  tpl_ci, ciType(tpl_ci));
     int len = ciFieldLength(tpl_ci);
 
     if (remaining < len+1) return expectedMore(__LINE__);
@@ -1819,7 +2077,7 @@ void Telegram::preProcess()
     }
 }
 
-bool Telegram::parse(vector<uchar> &input_frame, MeterKeys *mk, bool warn)
+bool Telegram::parse(const vector<uchar> &input_frame, MeterKeys *mk, bool warn)
 {
     switch (about.type)
     {
@@ -1831,7 +2089,7 @@ bool Telegram::parse(vector<uchar> &input_frame, MeterKeys *mk, bool warn)
     return false;
 }
 
-bool Telegram::parseHeader(vector<uchar> &input_frame)
+bool Telegram::parseHeader(const vector<uchar> &input_frame)
 {
     switch (about.type)
     {
@@ -1843,7 +2101,182 @@ bool Telegram::parseHeader(vector<uchar> &input_frame)
     return false;
 }
 
-bool Telegram::parseWMBUSHeader(vector<uchar> &input_frame)
+uint64_t HeaderPeek::dllKey() const
+{
+    return ((uint64_t)dll_mfct) << 48 |
+        ((uint64_t)dll_id_b[3]) << 40 | ((uint64_t)dll_id_b[2]) << 32 |
+        ((uint64_t)dll_id_b[1]) << 24 | ((uint64_t)dll_id_b[0]) << 16 |
+        ((uint64_t)dll_version) << 8 | dll_type;
+}
+
+void HeaderPeek::ids(vector<string> *out) const
+{
+    char id[9];
+    if (mbus)
+    {
+        snprintf(id, sizeof(id), "%02x", mbus_primary_address);
+    }
+    else
+    {
+        snprintf(id, sizeof(id), "%02x%02x%02x%02x", dll_id_b[3], dll_id_b[2], dll_id_b[1], dll_id_b[0]);
+    }
+    out->push_back(id);
+    if (ell_id_found)
+    {
+        snprintf(id, sizeof(id), "%02x%02x%02x%02x", ell_id_b[3], ell_id_b[2], ell_id_b[1], ell_id_b[0]);
+        out->push_back(id);
+    }
+    if (tpl_id_found)
+    {
+        snprintf(id, sizeof(id), "%02x%02x%02x%02x", tpl_id_b[3], tpl_id_b[2], tpl_id_b[1], tpl_id_b[0]);
+        out->push_back(id);
+    }
+}
+
+// Read the tpl id, mfct, version and type of a long tpl header.
+static bool peekLongTPL(const uchar *p, size_t remaining, HeaderPeek *hp)
+{
+    if (remaining < 8) return false;
+    hp->tpl_id_found = true;
+    memcpy(hp->tpl_id_b, p, 4);
+    hp->tpl_mfct = p[5] << 8 | p[4];
+    hp->tpl_version = p[6];
+    hp->tpl_type = p[7];
+    return true;
+}
+
+// This follows the steps of parseWMBUSHeader, but only the fields needed for
+// routing are picked up and nothing is decrypted or explained.
+static bool peekWMBUSHeader(const vector<uchar> &frame, HeaderPeek *hp)
+{
+    size_t size = frame.size();
+    if (size < 10 || size < frame[0]) return false;
+
+    uchar a[10];
+    memcpy(a, &frame[0], 10);
+    DiehlAddressTransformMethod diehl_method = mustTransformDiehlAddress(frame);
+    if (diehl_method != DiehlAddressTransformMethod::NONE)
+    {
+        transformDiehlAddress(a, diehl_method);
+    }
+
+    hp->dll_mfct = a[3] << 8 | a[2];
+    memcpy(hp->dll_id_b, a+4, 4);
+    hp->dll_version = a[8];
+    hp->dll_type = a[9];
+
+    // From now on, at the worst only the dll is found. That is fine.
+    size_t pos = 10;
+
+    if (pos >= size) return true;
+    int ci = frame[pos];
+    if (isCiFieldOfType(ci, CI_TYPE::ELL))
+    {
+        if (size-pos < (size_t)ciFieldLength(ci)+1) return true;
+        pos += 3; // ci cc acc
+        bool has_target_mft_address = (ci == CI_Field_Values::ELL_III || ci == CI_Field_Values::ELL_IV);
+        bool has_session_number_pl_crc = (ci == CI_Field_Values::ELL_II || ci == CI_Field_Values::ELL_IV);
+        if (ci == CI_Field_Values::ELL_V) return true;
+
+        if (has_target_mft_address)
+        {
+            if (pos+8 > size) return true;
+            hp->ell_id_found = true;
+            hp->ell_mfct = frame[pos+1] << 8 | frame[pos];
+            memcpy(hp->ell_id_b, &frame[pos+2], 4);
+            hp->ell_version = frame[pos+6];
+            hp->ell_type = frame[pos+7];
+            pos += 8;
+        }
+        if (has_session_number_pl_crc)
+        {
+            // Without a key the payload crc only matches an unencrypted payload.
+            if (pos+6 > size) return true;
+            pos += 4;
+            uint16_t pl_crc = frame[pos+1] << 8 | frame[pos];
+            uint16_t check = crc16_EN13757(&frame[0]+pos+2, size-pos-2);
+            if (pl_crc != check && !FUZZING) return true;
+            pos += 2;
+        }
+    }
+
+    if (pos >= size) return true;
+    ci = frame[pos];
+    if (isCiFieldOfType(ci, CI_TYPE::NWL))
+    {
+        if (size-pos < 2) return true;
+        pos += 2;
+    }
+
+    if (pos >= size) return true;
+    ci = frame[pos];
+    if (isCiFieldOfType(ci, CI_TYPE::AFL))
+    {
+        if (size-pos < 4 || size-pos < (size_t)ciFieldLength(ci)) return true;
+        uint16_t fc = frame[pos+3] << 8 | frame[pos+2];
+        pos += 4; // ci len fc
+        uchar mcl = 0;
+        if (fc & 0x2000)
+        {
+            if (pos+1 > size) return true;
+            mcl = frame[pos];
+            pos += 1;
+        }
+        if (fc & 0x0200) pos += 2; // key info
+        if (fc & 0x0800) pos += 4; // counter
+        if (fc & 0x0400)
+        {
+            int len = toLen(fromIntToAFLAuthenticationType(mcl & 0x0f));
+            if (len != 2 && len != 4 && len != 8 && len != 12 && len != 16) return true;
+            pos += len;
+        }
+    }
+
+    if (pos >= size) return true;
+    ci = frame[pos];
+    if (!isCiFieldOfType(ci, CI_TYPE::TPL)) return true;
+    if (size-pos < (size_t)ciFieldLength(ci)+1) return true;
+    pos++;
+    if (ci == CI_Field_Values::TPL_72)
+    {
+        peekLongTPL(&frame[0]+pos, size-pos, hp);
+    }
+    return true;
+}
+
+static bool peekMBUSHeader(const vector<uchar> &frame, HeaderPeek *hp)
+{
+    size_t size = frame.size();
+    if (size < 7) return false;
+    if (frame[0] != 0x68 || frame[1] != frame[2] || frame[3] != 0x68) return false;
+    if (size < frame[1]) return false;
+
+    hp->mbus = true;
+    hp->mbus_primary_address = frame[5];
+    if (frame[6] != 0x72) return false;
+
+    // The long tpl header is followed by acc, sts and the configuration field.
+    if (!peekLongTPL(&frame[0]+7, size-7, hp)) return false;
+    if (size < 7+12) return false;
+    int cfg = frame[7+11] << 8 | frame[7+10];
+    if (((cfg >> 8) & 0x1f) == 7 && size < 7+13) return false;
+    return true;
+}
+
+bool peekHeader(FrameType type, const vector<uchar> &frame, HeaderPeek *hp)
+{
+    memset(hp, 0, sizeof(*hp));
+    switch (type)
+    {
+    case FrameType::WMBUS: return peekWMBUSHeader(frame, hp);
+    case FrameType::MBUS: return peekMBUSHeader(frame, hp);
+    case FrameType::HAN: return false;
+    }
+    assert(0);
+    return false;
+}
+
+bool Telegram::parseWMBUSHeader(const vector<uchar> &input_frame)
 {
     assert(about.type == FrameType::WMBUS);
 
@@ -1882,7 +2315,7 @@ bool Telegram::parseWMBUSHeader(vector<uchar> &input_frame)
     return true;
 }
 
-bool Telegram::parseWMBUS(vector<uchar> &input_frame, MeterKeys *mk, bool warn)
+bool Telegram::parseWMBUS(const vector<uchar> &input_frame, MeterKeys *mk, bool warn)
 {
     assert(about.type == FrameType::WMBUS);
 
@@ -1958,7 +2391,7 @@ bool Telegram::parseWMBUS(vector<uchar> &input_frame, MeterKeys *mk, bool warn)
     return true;
 }
 
-bool Telegram::parseMBUSHeader(vector<uchar> &input_frame)
+bool Telegram::parseMBUSHeader(const vector<uchar> &input_frame)
 {
     assert(about.type == FrameType::MBUS);
 
@@ -1980,7 +2413,7 @@ bool Telegram::parseMBUSHeader(vector<uchar> &input_frame)
     return true;
 }
 
-bool Telegram::parseMBUS(vector<uchar> &input_frame, MeterKeys *mk, bool warn)
+bool Telegram::parseMBUS(const vector<uchar> &input_frame, MeterKeys *mk, bool warn)
 {
     assert(about.type == FrameType::MBUS);
 
@@ -2007,14 +2440,14 @@ bool Telegram::parseMBUS(vector<uchar> &input_frame, MeterKeys *mk, bool warn)
     return true;
 }
 
-bool Telegram::parseHANHeader(vector<uchar> &input_frame)
+bool Telegram::parseHANHeader(const vector<uchar> &input_frame)
 {
     assert(about.type == FrameType::HAN);
 
     return false;
 }
 
-bool Telegram::parseHAN(vector<uchar> &input_frame, MeterKeys *mk, bool warn)
+bool Telegram::parseHAN(const vector<uchar> &input_frame, MeterKeys *mk, bool warn)
 {
     assert(about.type == FrameType::HAN);
 
@@ -2196,7 +2629,22 @@ const char *mbusCiField(uchar c_field)
     return "?";
 }
 
-string cType(int c_field)
+// Descriptions composed from the bits of a single byte are built once
+// for all 256 values, a lookup then only returns the cached text.
+struct ByteDescriptions
+{
+    explicit ByteDescriptions(string (*build)(int))
+    {
+        for (int i = 0; i < 256; ++i) texts_[i] = build(i);
+    }
+
+    const char *lookup(int b) const { return texts_[b & 0xff].c_str(); }
+
+private:
+    string texts_[256];
+};
+
+static string buildCType(int c_field)
 {
     string s;
     if (c_field & 0x80)
@@ -2230,6 +2678,12 @@ string cType(int c_field)
     return s;
 }
 
+const char *cType(int c_field)
+{
+    static const ByteDescriptions descriptions(buildCType);
+    return descriptions.lookup(c_field);
+}
+
 bool isValidWMBusCField(int c_field)
 {
     // These are the currently seen valid C fields for wmbus telegrams.
@@ -2246,7 +2700,7 @@ bool isValidMBusCField(int c_field)
     return false;
 }
 
-string ccType(int cc_field)
+static string buildCCType(int cc_field)
 {
     string s = "";
     if (cc_field & CC_B_BIDIRECTIONAL_BIT) s += "bidir ";
@@ -2260,6 +2714,12 @@ string ccType(int cc_field)
     return s;
 }
 
+const char *ccType(int cc_field)
+{
+    static const ByteDescriptions descriptions(buildCCType);
+    return descriptions.lookup(cc_field);
+}
+
 
 int difLenBytes(int dif)
 {
@@ -2288,7 +2748,7 @@ int difLenBytes(int dif)
     return -2;
 }
 
-string difType(int dif)
+static string buildDifType(int dif)
 {
     string s;
     int t = dif & 0x0f;
@@ -2332,6 +2792,12 @@ string difType(int dif)
     return s;
 }
 
+const char *difType(int dif)
+{
+    static const ByteDescriptions descriptions(buildDifType);
+    return descriptions.lookup(dif);
+}
+
 MeasurementType difMeasurementType(int dif)
 {
     int t = dif & 0x30;
@@ -2344,7 +2810,7 @@ MeasurementType difMeasurementType(int dif)
     assert(0);
 }
 
-string vifType(int vif)
+const char *vifType(int vif)
 {
     int extension = vif & 0x80;
     int t = vif & 0x7f;
@@ -2688,7 +3154,7 @@ double vifScale(int vif)
     }
 }
 
-string vifKey(int vif)
+const char *vifKey(int vif)
 {
     int t = vif & 0x7f;
 
@@ -3893,7 +4359,7 @@ string WMBusCommonImplementation::busAlias()
     return bus_alias_;
 }
 
-void WMBusCommonImplementation::onTelegram(function<bool(AboutTelegram&,vector<uchar>)> cb)
+void WMBusCommonImplementation::onTelegram(function<bool(shared_ptr<ReceivedFrame>)> cb)
 {
     telegram_listeners_.push_back(cb);
 }
@@ -3905,28 +4371,54 @@ bool WMBusCommonImplementation::sendTelegram(ContentStartsWith starts_with, vect
 }
 
 static bool ignore_duplicate_telegrams_ = false;
+static bool duplicates_checked_after_merge_ = false;
 
-void setIgnoreDuplicateTelegrams(bool idt)
+void setIgnoreDuplicateTelegrams(bool idt, int window_s)
 {
+    LOCK_DUPLICATE_FILTER(setIgnoreDuplicateTelegrams);
     ignore_duplicate_telegrams_ = idt;
+    delete duplicate_filter_;
+    duplicate_filter_ = idt ? new DuplicateFilter(((uint64_t)window_s)*1000) : NULL;
 }
 
-bool WMBusCommonImplementation::handleTelegram(AboutTelegram &about, vector<uchar> frame)
+void setDuplicatesCheckedAfterMerge(bool after_merge)
+{
+    duplicates_checked_after_merge_ = after_merge;
+}
+
+bool isDuplicateTelegram(shared_ptr<ReceivedFrame> &frame)
+{
+    return ignore_duplicate_telegrams_ && seen_this_telegram_before(frame);
+}
+
+string duplicateTelegramStatistics()
+{
+    LOCK_DUPLICATE_FILTER(duplicateTelegramStatistics);
+    if (duplicate_filter_ == NULL) return "";
+    return tostrprintf("checked %zu duplicates %zu remembered %zu (window %" PRIu64 "s)",
+                       duplicate_filter_->checked(), duplicate_filter_->duplicates(),
+                       duplicate_filter_->size(), duplicate_filter_->windowMs()/1000);
+}
+
+bool WMBusCommonImplementation::handleTelegram(AboutTelegram &about, vector<uchar> &frame)
 {
     bool handled = false;
     last_received_ = time(NULL);
 
-    if (ignore_duplicate_telegrams_ && seen_this_telegram_before(frame))
+    // From now on the frame bytes are shared, not copied.
+    shared_ptr<ReceivedFrame> received = make_shared<ReceivedFrame>(about, frame);
+
+    if (!duplicates_checked_after_merge_ && isDuplicateTelegram(received))
     {
         verbose("(wmbus) skipping already handled telegram.\n");
         return true;
     }
 
-    for (auto f : telegram_listeners_)
+    for (auto &f : telegram_listeners_)
     {
         if (f)
         {
-            bool h = f(about, frame);
+            bool h = f(received);
             if (h) handled = true;
         }
     }
@@ -4331,8 +4823,8 @@ bool trimCRCsFrameFormatAInternal(std::vector<uchar> &payload, bool fail_is_ok)
         debugPayload("(wmbus) trimming frame A", payload);
     }
 
-    vector<uchar> out;
-
+    // All crcs are checked before the payload is modified, since frame format B
+    // is tried on the same payload if frame format A fails.
     uint16_t calc_crc = crc16_EN13757(&payload[0], 10);
     uint16_t check_crc = payload[10] << 8 | payload[11];
 
@@ -4344,7 +4836,6 @@ bool trimCRCsFrameFormatAInternal(std::vector<uchar> &payload, bool fail_is_ok)
         }
         return false;
     }
-    out.insert(out.end(), payload.begin(), payload.begin()+10);
     if (!fail_is_ok)
     {
         debug("(wmbus) ff a dll crc 0-%zu %04x ok\n", 10-1, calc_crc);
@@ -4365,7 +4856,6 @@ bool trimCRCsFrameFormatAInternal(std::vector<uchar> &payload, bool fail_is_ok)
             }
             return false;
         }
-        out.insert(out.end(), payload.begin()+pos, payload.begin()+pos+16);
         if (!fail_is_ok)
         {
             debug("(wmbus) ff a dll crc mid %zu-%zu %04x ok\n", pos, to-1, calc_crc);
@@ -4387,7 +4877,6 @@ bool trimCRCsFrameFormatAInternal(std::vector<uchar> &payload, bool fail_is_ok)
             }
             return false;
         }
-        out.insert(out.end(), payload.begin()+pos, payload.begin()+tto);
         if (!fail_is_ok)
         {
             debug("(wmbus) ff a dll crc final %zu-%zu %04x ok\n", pos, tto-1, calc_crc);
@@ -4396,10 +4885,22 @@ bool trimCRCsFrameFormatAInternal(std::vector<uchar> &payload, bool fail_is_ok)
 
     debugPayload("(wmbus) trimming frame A", payload);
 
-    out[0] = out.size()-1;
-    size_t new_len = out[0]+1;
+    // Move the blocks down over the crcs, the payload is never reallocated.
+    size_t out = 10;
+    for (pos = 12; pos+18 <= len; pos += 18)
+    {
+        memmove(&payload[out], &payload[pos], 16);
+        out += 16;
+    }
+    if (pos < len-2)
+    {
+        memmove(&payload[out], &payload[pos], len-2-pos);
+        out += len-2-pos;
+    }
+    payload[0] = out-1;
+    size_t new_len = payload[0]+1;
     size_t old_size = payload.size();
-    payload = out;
+    payload.resize(out);
     size_t new_size = payload.size();
 
     debug("(wmbus) trimmed %zu dll crc bytes from frame a and ignored %zu suffix bytes.\n", (len-new_len), (old_size-new_size)-(len-new_len));
@@ -4423,7 +4924,6 @@ bool trimCRCsFrameFormatBInternal(std::vector<uchar> &payload, bool fail_is_ok)
         debugPayload("(wmbus) trimming frame B", payload);
     }
 
-    vector<uchar> out;
     size_t crc1_pos, crc2_pos;
     if (len <= 128)
     {
@@ -4448,7 +4948,6 @@ bool trimCRCsFrameFormatBInternal(std::vector<uchar> &payload, bool fail_is_ok)
         return false;
     }
 
-    out.insert(out.end(), payload.begin(), payload.begin()+crc1_pos);
     if (!fail_is_ok)
     {
         debug("(wmbus) ff b dll crc first 0-%zu %04x ok\n", crc1_pos, calc_crc);
@@ -4456,7 +4955,7 @@ bool trimCRCsFrameFormatBInternal(std::vector<uchar> &payload, bool fail_is_ok)
 
     if (crc2_pos > 0)
     {
-        calc_crc = crc16_EN13757(&payload[crc1_pos+2], crc2_pos);
+        calc_crc = crc16_EN13757(&payload[crc1_pos+2], crc2_pos-crc1_pos-2);
         check_crc = payload[crc2_pos] << 8 | payload[crc2_pos+1];
 
         if (calc_crc != check_crc && !FUZZING)
@@ -4469,7 +4968,6 @@ bool trimCRCsFrameFormatBInternal(std::vector<uchar> &payload, bool fail_is_ok)
             return false;
         }
 
-        out.insert(out.end(), payload.begin()+crc1_pos+2, payload.begin()+crc2_pos);
         if (!fail_is_ok)
         {
             debug("(wmbus) ff b dll crc final %zu-%zu %04x ok\n", crc1_pos+2, crc2_pos, calc_crc);
@@ -4478,10 +4976,17 @@ bool trimCRCsFrameFormatBInternal(std::vector<uchar> &payload, bool fail_is_ok)
 
     debugPayload("(wmbus) trimming frame B", payload);
 
-    out[0] = out.size()-1;
-    size_t new_len = out[0]+1;
+    // Move the second block down over the first crc.
+    size_t out = crc1_pos;
+    if (crc2_pos > 0)
+    {
+        memmove(&payload[out], &payload[crc1_pos+2], crc2_pos-crc1_pos-2);
+        out += crc2_pos-crc1_pos-2;
+    }
+    payload[0] = out-1;
+    size_t new_len = payload[0]+1;
     size_t old_size = payload.size();
-    payload = out;
+    payload.resize(out);
     size_t new_size = payload.size();
 
     debug("(wmbus) trimmed %zu dll crc bytes from frame b and ignored %zu suffix bytes.\n", (len-new_len), (old_size-new_size)-(len-new_len));
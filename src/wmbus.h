@@ -18,11 +18,14 @@
 #ifndef WMBUS_H
 #define WMBUS_H
 
+#include"aescmac.h"
 #include"manufacturers.h"
 #include"serial.h"
 #include"util.h"
 
 #include<inttypes.h>
+#include<sys/time.h>
+#include<deque>
 #include<map>
 #include<set>
 
@@ -63,7 +66,18 @@ const char *toString(WMBusDeviceType t);
 const char *toLowerCaseString(WMBusDeviceType t);
 WMBusDeviceType toWMBusDeviceType(string &t);
 
-void setIgnoreDuplicateTelegrams(bool idt);
+struct ReceivedFrame;
+
+// Skip the telegrams that have already been received within window_s seconds,
+// from the same bus device through a repeater or from another bus device.
+void setIgnoreDuplicateTelegrams(bool idt, int window_s);
+// The number of checked and skipped duplicate telegrams, empty if duplicates are not ignored.
+string duplicateTelegramStatistics();
+// When the bus manager merges the telegrams from several bus devices, the copies
+// must reach the merge stage, the duplicates are then checked after the merge.
+void setDuplicatesCheckedAfterMerge(bool after_merge);
+// Returns true if duplicates are ignored and the frame has been received before.
+bool isDuplicateTelegram(shared_ptr<ReceivedFrame> &frame);
 
 // In link mode S1, is used when both the transmitter and receiver are stationary.
 // It can be transmitted relatively seldom.
@@ -314,11 +328,85 @@ struct DVEntry
     int storagenr {};
     int tariff {};
     int subunit {};
-    string value;
 
     DVEntry() {}
-    DVEntry(MeasurementType mt, int vi, int st, int ta, int su, string &val) :
-    type(mt), value_information(vi), storagenr(st), tariff(ta), subunit(su), value(val) {}
+    DVEntry(MeasurementType mt, int vi, int st, int ta, int su, const uchar *data, size_t len) :
+    type(mt), value_information(vi), storagenr(st), tariff(ta), subunit(su) { setValue(data, len); }
+    // The value is given as a hex string.
+    DVEntry(MeasurementType mt, int vi, int st, int ta, int su, string &val);
+
+    // The raw data bytes of the value, as found in the telegram.
+    const uchar *value() const { return value_len_ <= (int)sizeof(short_value_) ? short_value_ : &long_value_[0]; }
+    int valueLength() const { return value_len_; }
+    // The data bytes as a hex string, only rendered when asked for.
+    string valueHex() const;
+
+private:
+
+    void setValue(const uchar *data, size_t len);
+
+    // All fixed size data fields (at most 8 bytes) are stored inline,
+    // only longer variable length values end up on the heap.
+    uchar short_value_[8] {};
+    vector<uchar> long_value_;
+    int value_len_ {};
+};
+
+// Identifies a value by the dif,dife,vif,vife bytes in front of it. The first 8 bytes
+// are packed into code with the first byte at the top, the (rare) remaining bytes are in rest.
+// The index is 2,3... for the second, third... occurrence of the same bytes in a telegram.
+struct DVKey
+{
+    uint64_t code {};
+    int len {};
+    int index = 1;
+    vector<uchar> rest;
+
+    uchar byte(int i) const { return i < 8 ? (code >> (56-8*i)) & 0xff : rest[i-8]; }
+    bool operator==(const DVKey &k) const { return code == k.code && len == k.len && index == k.index && rest == k.rest; }
+    // Parse a key written the way the drivers do: 0C13 or 02FF20_2
+    bool parse(const string &key);
+    string str() const;
+};
+
+// The data values of a telegram. A flat vector of entries with a small index sorted
+// in the same order as the string keys ("0C13" < "0C1300" < "0C13_2") used to sort.
+struct DVEntries
+{
+    // Add a value found in the telegram, a repeated dif/vif gets the next index.
+    void add(const vector<uchar> &difvif, int offset, const DVEntry &dve);
+    // Set the value for a driver string key, replacing any earlier value.
+    void set(const string &key, int offset, const DVEntry &dve);
+    // Returns NULL if there is no such key. The dif and the vif of the key are
+    // stored into dif and vif if found.
+    pair<int,DVEntry> *find(const string &key, uchar *dif = NULL, uchar *vif = NULL);
+    bool has(const string &key) { return find(key) != NULL; }
+
+    // Iterate over the values in key order.
+    size_t size() { return sorted_.size(); }
+    pair<int,DVEntry> &at(size_t i) { return entries_[sorted_[i]].value; }
+    string keyAt(size_t i) { return entries_[sorted_[i]].key.str(); }
+    // The keys in key order, two telegrams with the same keys have the same layout.
+    void layout(vector<DVKey> *keys);
+    bool hasLayout(const vector<DVKey> &keys);
+    void clear() { entries_.clear(); sorted_.clear(); }
+    void swap(DVEntries &o) { entries_.swap(o.entries_); sorted_.swap(o.sorted_); }
+
+private:
+
+    struct Entry
+    {
+        DVKey key;
+        uchar dif {};
+        uchar vif {};
+        pair<int,DVEntry> value;
+    };
+
+    void insert(Entry &&e);
+    int lookup(const DVKey &key);
+
+    vector<Entry> entries_;
+    vector<uint16_t> sorted_;
 };
 
 using namespace std;
@@ -330,6 +418,19 @@ struct MeterKeys
 
     bool hasConfidentialityKey() { return confidentiality_key.size() > 0; }
     bool hasAuthenticationKey() { return authentication_key.size() > 0; }
+
+    // Set the confidentiality key and prepare its aes and cmac contexts.
+    void setConfidentialityKey(const vector<uchar> &key);
+    // The expanded round keys of the confidentiality key, NULL if there is no 16 byte key.
+    // A confidentiality key that was assigned directly is prepared on first use.
+    const AES_ctx *confidentialityKeyCtx();
+    // The cmac context of the confidentiality key, used as the kdf key for mode 7/8.
+    const AES_CMAC_ctx *confidentialityKeyCMACCtx();
+
+private:
+    AES_CMAC_ctx confidentiality_ctx_ {};
+    // The key that confidentiality_ctx_ was prepared from.
+    vector<uchar> confidentiality_ctx_key_;
 };
 
 enum class FrameType
@@ -351,11 +452,105 @@ struct AboutTelegram
     int rssi_dbm {};
     // WMBus or MBus
     FrameType type {};
+    // When the same telegram was received by several bus devices within the merge window,
+    // all of them comma separated, the device with the best rssi first. Otherwise empty.
+    string devices;
 
     AboutTelegram(string dv, int rs, FrameType t) : device(dv), rssi_dbm(rs), type(t) {}
     AboutTelegram() {}
 };
 
+// A frame received by a bus device, together with how and when it was received.
+// The received frame is never modified, it is shared from the bus device through
+// the meter manager to the meters without copying the frame bytes.
+struct ReceivedFrame
+{
+    // The bytes are moved from frame into the received frame, frame is left empty.
+    ReceivedFrame(AboutTelegram &a, vector<uchar> &frame);
+    // The bytes are copied, used when the copies of a frame from several bus devices are merged.
+    ReceivedFrame(AboutTelegram &a, const vector<uchar> &frame, struct timeval received);
+
+    const AboutTelegram about;
+    const vector<uchar> bytes;
+    // The time when the frame was handed over from the bus device.
+    const struct timeval received;
+};
+
+// Remembers the 64 bit hashes of the frames received within a time window.
+// An open-addressed table with linear probing, the hashes are expired in the
+// order they were added, thus now_ms must never decrease between the calls.
+struct DuplicateFilter
+{
+    DuplicateFilter(uint64_t window_ms);
+
+    // Returns true if the hash has been added within the window before now_ms,
+    // otherwise the hash is added and false is returned.
+    bool seenBefore(uint64_t hash, uint64_t now_ms);
+
+    uint64_t windowMs() { return window_ms_; }
+    size_t size() { return count_; }
+    size_t checked() { return checked_; }
+    size_t duplicates() { return duplicates_; }
+
+private:
+
+    struct Slot
+    {
+        uint64_t hash; // Zero is an empty slot.
+        uint64_t added_ms;
+    };
+
+    void expire(uint64_t now_ms);
+    size_t find(uint64_t hash);
+    void insert(uint64_t hash, uint64_t added_ms);
+    void erase(size_t i);
+    void grow();
+
+    uint64_t window_ms_ {};
+    vector<Slot> slots_;
+    size_t mask_ {};
+    size_t count_ {};
+    deque<uint64_t> added_; // The hashes in the order they were added.
+    size_t checked_ {};
+    size_t duplicates_ {};
+};
+
+// The ids, mfct, type and version of the DLL and, if present, the ELL and TPL of a frame.
+// Read straight from the frame bytes without copying the frame or recording any explanations.
+// This is enough to route the frame to the meters, only the meters that match the ids
+// have to parse the frame into a Telegram.
+struct HeaderPeek
+{
+    uint16_t dll_mfct;
+    uchar dll_id_b[4];
+    uchar dll_version;
+    uchar dll_type;
+
+    bool ell_id_found;
+    uint16_t ell_mfct;
+    uchar ell_id_b[4];
+    uchar ell_version;
+    uchar ell_type;
+
+    bool tpl_id_found;
+    uint16_t tpl_mfct;
+    uchar tpl_id_b[4];
+    uchar tpl_version;
+    uchar tpl_type;
+
+    // An mbus frame has the primary address as its dll id.
+    bool mbus;
+    uchar mbus_primary_address;
+
+    // The dll mfct, id, version and type packed into a single number.
+    uint64_t dllKey() const;
+    // The ids in the same order and format as Telegram::ids.
+    void ids(vector<string> *out) const;
+};
+
+// Returns false when Telegram::parseHeader would fail, ie there is no proper dll.
+bool peekHeader(FrameType type, const vector<uchar> &frame, HeaderPeek *hp);
+
 // Mark understood bytes as either PROTOCOL, ie dif vif, acc and other header bytes.
 // Or CONTENT, ie the value fields found inside the transport layer.
 enum class KindOfData
@@ -484,6 +679,9 @@ struct Telegram
 
     // The format signature is used for compact frames.
     int format_signature {};
+    // The hash of the dif/vif format of the values, same as the format signature
+    // a compact frame with this format would have.
+    uint16_t dv_format_hash {};
 
     vector<uchar> frame; // Content of frame, potentially decrypted.
     vector<uchar> parsed;  // Parsed bytes with explanations.
@@ -496,23 +694,26 @@ struct Telegram
 
     bool handled {}; // Set to true, when a meter has accepted the telegram.
 
-    bool parseHeader(vector<uchar> &input_frame);
-    bool parse(vector<uchar> &input_frame, MeterKeys *mk, bool warn);
+    bool parseHeader(const vector<uchar> &input_frame);
+    bool parse(const vector<uchar> &input_frame, MeterKeys *mk, bool warn);
 
-    bool parseMBUSHeader(vector<uchar> &input_frame);
-    bool parseMBUS(vector<uchar> &input_frame, MeterKeys *mk, bool warn);
+    bool parseMBUSHeader(const vector<uchar> &input_frame);
+    bool parseMBUS(const vector<uchar> &input_frame, MeterKeys *mk, bool warn);
 
-    bool parseWMBUSHeader(vector<uchar> &input_frame);
-    bool parseWMBUS(vector<uchar> &input_frame, MeterKeys *mk, bool warn);
+    bool parseWMBUSHeader(const vector<uchar> &input_frame);
+    bool parseWMBUS(const vector<uchar> &input_frame, MeterKeys *mk, bool warn);
 
-    bool parseHANHeader(vector<uchar> &input_frame);
-    bool parseHAN(vector<uchar> &input_frame, MeterKeys *mk, bool warn);
+    bool parseHANHeader(const vector<uchar> &input_frame);
+    bool parseHAN(const vector<uchar> &input_frame, MeterKeys *mk, bool warn);
 
     void print();
 
     // A vector of indentations and explanations, to be printed
     // below the raw data bytes to explain the telegram content.
+    // Only recorded when somebody will look at them, i.e. when analyzing,
+    // debugging or logging telegrams. The parsed bytes are always recorded.
     vector<Explanation> explanations;
+    bool explaining() { return explaining_ || being_analyzed_; }
     void addExplanationAndIncrementPos(vector<uchar>::iterator &pos, int len, KindOfData k, Understanding u, const char* fmt, ...);
     void addMoreExplanation(int pos, const char* fmt, ...);
     void addMoreExplanation(int pos, string json);
@@ -528,17 +729,25 @@ struct Telegram
     void markAsBeingAnalyzed() { being_analyzed_ = true; }
 
     // Extracted mbus values.
-    std::map<std::string,std::pair<int,DVEntry>> values;
+    DVEntries values;
 
     string autoDetectPossibleDrivers();
 
     // part of original telegram bytes, only filled if pre-processing modifies it
     vector<uchar> original;
 
+    // Scratch buffers used by parseDV, kept here so that their capacity is reused.
+    vector<uchar> dv_format_bytes;
+    vector<uchar> dv_id_bytes;
+
+    // Forget the previous telegram, but keep the capacity of the buffers.
+    void reset();
+
 private:
 
     bool is_simulated_ {};
     bool being_analyzed_ {};
+    bool explaining_ = isDebugEnabled() || isLogTelegramsEnabled();
     bool parser_warns_ = true;
     MeterKeys *meter_keys {};
 
@@ -581,6 +790,27 @@ private:
     bool findFormatBytesFromKnownMeterSignatures(std::vector<uchar> *format_bytes);
 };
 
+// A telegram borrowed from the telegram pool of the current thread. The telegram is reset
+// when borrowed and returned to the pool when the pooled telegram goes out of scope.
+// Since the buffers keep their capacity, decoding a telegram does not allocate any
+// memory once the buffers have grown large enough.
+struct PooledTelegram
+{
+    PooledTelegram();
+    ~PooledTelegram();
+
+    Telegram *get() { return t_; }
+    Telegram *operator->() { return t_; }
+    Telegram &operator*() { return *t_; }
+
+private:
+
+    Telegram *t_ {};
+
+    PooledTelegram(const PooledTelegram&) = delete;
+    PooledTelegram &operator=(const PooledTelegram&) = delete;
+};
+
 struct SendBusContent
 {
     string bus;
@@ -623,7 +853,7 @@ struct WMBus
     virtual int numConcurrentLinkModes() = 0;
     virtual bool canSetLinkModes(LinkModeSet lms) = 0;
     virtual void setLinkModes(LinkModeSet lms) = 0;
-    virtual void onTelegram(function<bool(AboutTelegram&,vector<uchar>)> cb) = 0;
+    virtual void onTelegram(function<bool(shared_ptr<ReceivedFrame>)> cb) = 0;
     virtual bool sendTelegram(ContentStartsWith starts_with, vector<uchar> &content) = 0;
     virtual SerialDevice *serial() = 0;
     // Return true of the serial has been overridden, usually with stdin or a file.
@@ -700,22 +930,22 @@ shared_ptr<WMBus> openSimulator(Detected detected,
                                 shared_ptr<SerialCommunicationManager> manager,
                                 shared_ptr<SerialDevice> serial_override);
 
-string manufacturer(int m_field);
+const char *manufacturer(int m_field);
 string manufacturerFlag(int m_field);
-string mediaType(int a_field_device_type, int m_field);
-string mediaTypeJSON(int a_field_device_type, int m_field);
+const char *mediaType(int a_field_device_type, int m_field);
+const char *mediaTypeJSON(int a_field_device_type, int m_field);
 bool isCiFieldOfType(int ci_field, CI_TYPE type);
 int ciFieldLength(int ci_field);
-string ciType(int ci_field);
-string cType(int c_field);
+const char *ciType(int ci_field);
+const char *cType(int c_field);
 bool isValidWMBusCField(int c_field);
 bool isValidMBusCField(int c_field);
-string ccType(int cc_field);
-string difType(int dif);
+const char *ccType(int cc_field);
+const char *difType(int dif);
 double vifScale(int vif);
-string vifKey(int vif); // E.g. temperature energy power mass_flow volume_flow
+const char *vifKey(int vif); // E.g. temperature energy power mass_flow volume_flow
 string vifUnit(int vif); // E.g. m3 c kwh kw MJ MJh
-string vifType(int vif); // Long description
+const char *vifType(int vif); // Long description
 string vifeType(int dif, int vif, int vife); // Long description
 string formatData(int dif, int vif, int vife, string data);
 
@@ -35,9 +35,10 @@ struct WMBusCommonImplementation : public virtual WMBus
     string hr();
     bool isSerial();
     WMBusDeviceType type();
-    void onTelegram(function<bool(AboutTelegram&,vector<uchar>)> cb);
+    void onTelegram(function<bool(shared_ptr<ReceivedFrame>)> cb);
     bool sendTelegram(ContentStartsWith starts_with, vector<uchar> &content);
-    bool handleTelegram(AboutTelegram &about, vector<uchar> frame);
+    // The frame bytes are moved into a shared ReceivedFrame, frame is left empty.
+    bool handleTelegram(AboutTelegram &about, vector<uchar> &frame);
     void checkStatus();
     bool isWorking();
     string dongleId();
@@ -81,7 +82,7 @@ struct WMBusCommonImplementation : public virtual WMBus
     // Uses a serial tty?
     bool is_serial_ {};
     bool is_working_ {};
-    vector<function<bool(AboutTelegram&,vector<uchar>)>> telegram_listeners_;
+    vector<function<bool(shared_ptr<ReceivedFrame>)>> telegram_listeners_;
     WMBusDeviceType type_ {};
     int protocol_error_count_ {};
     time_t timeout_ {}; // If longer silence than timeout, then reset dongle! It might have hanged!
@@ -23,14 +23,11 @@
 #include<assert.h>
 #include<memory.h>
 
-bool decrypt_ELL_AES_CTR(Telegram *t, vector<uchar> &frame, vector<uchar>::iterator &pos, vector<uchar> &aeskey)
+bool decrypt_ELL_AES_CTR(Telegram *t, vector<uchar> &frame, vector<uchar>::iterator &pos, const AES_ctx *aes)
 {
-    if (aeskey.size() == 0) return true;
+    if (aes == NULL) return true;
 
-    vector<uchar> encrypted_bytes;
-    vector<uchar> decrypted_bytes;
-    encrypted_bytes.insert(encrypted_bytes.end(), pos, frame.end());
-    debugPayload("(ELL) decrypting", encrypted_bytes);
+    debugPayload("(ELL) decrypting", frame, pos);
 
     uchar iv[16];
     int i=0;
@@ -47,45 +44,20 @@ bool decrypt_ELL_AES_CTR(Telegram *t, vector<uchar> &frame, vector<uchar>::itera
     // BC
     iv[i++] = 0;
 
-    vector<uchar> ivv(iv, iv+16);
-    string s = bin2hex(ivv);
-    debug("(ELL) IV %s\n", s.c_str());
-
-    int block = 0;
-    for (size_t offset = 0; offset < encrypted_bytes.size(); offset += 16)
+    if (isDebugEnabled())
     {
-        size_t block_size = 16;
-        if (offset + block_size > encrypted_bytes.size())
-        {
-            block_size = encrypted_bytes.size() - offset;
-        }
-
-        assert(block_size > 0 && block_size <= 16);
-
-        // Generate the pseudo-random bits from the IV and the key.
-        uchar xordata[16];
-        AES_ECB_encrypt(iv, &aeskey[0], xordata, 16);
-
-        // Xor the data with the pseudo-random bits to decrypt into tmp.
-        uchar tmp[block_size];
-        xorit(xordata, &encrypted_bytes[offset], tmp, block_size);
-
-        debug("(ELL) block %d block_size %d offset %zu\n", block, block_size, offset);
-        block++;
-
-        vector<uchar> tmpv(tmp, tmp+block_size);
-        debugPayload("(ELL) decrypted", tmpv);
-
-        decrypted_bytes.insert(decrypted_bytes.end(), tmpv.begin(), tmpv.end());
-
-        incrementIV(iv, sizeof(iv));
+        vector<uchar> ivv(iv, iv+16);
+        string s = bin2hex(ivv);
+        debug("(ELL) IV %s\n", s.c_str());
     }
-    debugPayload("(ELL) decrypted", decrypted_bytes);
 
-    // Remove the encrypted bytes.
-    frame.erase(pos, frame.end());
-    // Insert the decrypted bytes.
-    frame.insert(frame.end(), decrypted_bytes.begin(), decrypted_bytes.end());
+    // Xor the keystream for all blocks into the encrypted bytes, the frame is decrypted in place.
+    size_t offset = pos-frame.begin();
+    if (offset < frame.size())
+    {
+        AES_CTR_xcrypt_buffer_ctx(aes, iv, &frame[offset], frame.size()-offset);
+    }
+    debugPayload("(ELL) decrypted", frame, pos);
 
     return true;
 }
@@ -99,7 +71,7 @@ string frameTypeKamstrupC1(int ft) {
 bool decrypt_TPL_AES_CBC_IV(Telegram *t,
                             vector<uchar> &frame,
                             vector<uchar>::iterator &pos,
-                            vector<uchar> &aeskey,
+                            const AES_ctx *aes,
                             int *num_encrypted_bytes,
                             int *num_not_encrypted_at_end)
 {
@@ -119,7 +91,7 @@ bool decrypt_TPL_AES_CBC_IV(Telegram *t,
     debug("(TPL) num encrypted blocks %zu (%d bytes and remaining unencrypted %zu bytes)\n",
           t->tpl_num_encr_blocks, num_bytes_to_decrypt, buffer.size()-num_bytes_to_decrypt);
 
-    if (aeskey.size() == 0) return false;
+    if (aes == NULL) return false;
 
     debugPayload("(TPL) AES CBC IV decrypting", buffer);
 
@@ -173,7 +145,7 @@ bool decrypt_TPL_AES_CBC_IV(Telegram *t,
     memcpy(buffer_data, &buffer[0], num_bytes_to_decrypt);
     uchar decrypted_data[num_bytes_to_decrypt];
 
-    AES_CBC_decrypt_buffer(decrypted_data, buffer_data, num_bytes_to_decrypt, &aeskey[0], iv);
+    AES_CBC_decrypt_buffer_ctx(aes, decrypted_data, buffer_data, num_bytes_to_decrypt, iv);
 
     // Remove the encrypted bytes.
     frame.erase(pos, frame.end());
@@ -191,11 +163,11 @@ bool decrypt_TPL_AES_CBC_IV(Telegram *t,
     return true;
 }
 
-bool decrypt_TPL_AES_CBC_NO_IV(Telegram *t, vector<uchar> &frame, vector<uchar>::iterator &pos, vector<uchar> &aeskey,
+bool decrypt_TPL_AES_CBC_NO_IV(Telegram *t, vector<uchar> &frame, vector<uchar>::iterator &pos, const AES_ctx *aes,
                                int *num_encrypted_bytes,
                                int *num_not_encrypted_at_end)
 {
-    if (aeskey.size() == 0) return true;
+    if (aes == NULL) return true;
 
     vector<uchar> buffer;
     buffer.insert(buffer.end(), pos, frame.end());
@@ -243,7 +215,7 @@ bool decrypt_TPL_AES_CBC_NO_IV(Telegram *t, vector<uchar> &frame, vector<uchar>:
     memcpy(buffer_data, &buffer[0], num_bytes_to_decrypt);
     uchar decrypted_data[num_bytes_to_decrypt];
 
-    AES_CBC_decrypt_buffer(decrypted_data, buffer_data, num_bytes_to_decrypt, &aeskey[0], iv);
+    AES_CBC_decrypt_buffer_ctx(aes, decrypted_data, buffer_data, num_bytes_to_decrypt, iv);
 
     // Remove the encrypted bytes and any potentially not decryptes bytes after.
     frame.erase(pos, frame.end());
@@ -111,6 +111,18 @@ if [ "$?" != "0" ]; then RC="1"; fi
 tests/test_ignore_duplicates.sh $PROG
 if [ "$?" != "0" ]; then RC="1"; fi
 
+tests/test_decode_threads.sh $PROG
+if [ "$?" != "0" ]; then RC="1"; fi
+
+tests/test_ingest_queue.sh $PROG
+if [ "$?" != "0" ]; then RC="1"; fi
+
+tests/test_merge_window.sh $PROG
+if [ "$?" != "0" ]; then RC="1"; fi
+
+tests/test_format_cache.sh $PROG
+if [ "$?" != "0" ]; then RC="1"; fi
+
 ./tests/test_match_dll_and_tpl_id.sh $PROG
 if [ "$?" != "0" ]; then RC="1"; fi
 
@@ -148,6 +160,9 @@ if [ "$?" != "0" ]; then RC="1"; fi
 ./tests/test_analyze.sh $PROG
 if [ "$?" != "0" ]; then RC="1"; fi
 
+tests/test_analyze_threads.sh $PROG
+if [ "$?" != "0" ]; then RC="1"; fi
+
 if [ -x ../additional_tests.sh ]
 then
     (cd ..; ./additional_tests.sh $PROG)
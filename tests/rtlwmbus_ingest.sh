@@ -0,0 +1,17 @@
+#!/bin/sh
+# The first telegram is handed over to the meters, whose shell then blocks
+# until tests/test_ingest_queue.sh releases it.
+echo "T1;1;1;2019-04-03 19:00:42.000;97;148;12345699;0x1E44AE4C9956341268077A360010002F2F0413181E0000023B00002F2F2F2F"
+while [ ! -f testoutput/ingest_blocked ]
+do
+    sleep 0.01
+done
+# While the shell is blocked, the next telegram fills up the ingest queue of size 1
+# and the three telegrams after it are dropped.
+echo "T1;1;1;2019-04-03 19:00:43.000;97;148;12345699;0x1E44AE4C9956341268077A370010002F2F0413191E0000023B00002F2F2F2F"
+echo "T1;1;1;2019-04-03 19:00:44.000;97;148;12345699;0x1E44AE4C9956341268077A380010002F2F04131A1E0000023B00002F2F2F2F"
+echo "T1;1;1;2019-04-03 19:00:45.000;97;148;12345699;0x1E44AE4C9956341268077A390010002F2F04131B1E0000023B00002F2F2F2F"
+echo "T1;1;1;2019-04-03 19:00:46.000;97;148;12345699;0x1E44AE4C9956341268077A3A0010002F2F04131C1E0000023B00002F2F2F2F"
+# A line with a failed crc is rejected by the event loop with a verbose message,
+# which tells the test that all telegrams above have been received.
+echo "T1;0;0;2019-04-03 19:00:47.000;97;148;12345699;0x1E44AE4C9956341268077A3B0010002F2F04131D1E0000023B00002F2F2F2F"
@@ -0,0 +1,35 @@
+#!/bin/sh
+
+PROG="$1"
+
+mkdir -p testoutput
+TEST=testoutput
+
+TESTNAME="Test analyze with parallel driver trials"
+TESTRESULT="ERROR"
+
+# Trying the drivers on several threads must give exactly the same
+# analyze output as trying them one after the other.
+rm -f $TEST/test_serial.txt $TEST/test_parallel.txt
+for TELEGRAM in $(cat simulations/simulation_t1.txt simulations/simulation_c1.txt | grep '^telegram=' | \
+                  sed 's/^telegram=//' | tr -d '|#' | sed 's/+[0-9]*$//')
+do
+    $PROG --analyze=verbose --analyzethreads=1 $TELEGRAM >> $TEST/test_serial.txt 2>&1
+    $PROG --analyze=verbose --analyzethreads=4 $TELEGRAM >> $TEST/test_parallel.txt 2>&1
+done
+
+cat $TEST/test_serial.txt | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_expected.txt
+cat $TEST/test_parallel.txt | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_response.txt
+diff $TEST/test_expected.txt $TEST/test_response.txt
+if [ "$?" = "0" ] && [ -s $TEST/test_expected.txt ]
+then
+    TESTRESULT="OK"
+fi
+
+if [ "$TESTRESULT" = "OK" ]
+then
+    echo OK: $TESTNAME
+else
+    echo ERROR: $TESTNAME
+    exit 1
+fi
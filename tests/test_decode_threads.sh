@@ -0,0 +1,44 @@
+#!/bin/sh
+
+PROG="$1"
+
+mkdir -p testoutput
+TEST=testoutput
+
+TESTNAME="Test decoding telegrams using worker threads"
+TESTRESULT="ERROR"
+
+# The telegrams from different meters can be printed in a different order
+# when decoded by several threads, but the telegrams from the same meter
+# must be printed in the order they were received.
+$PROG --format=json simulations/simulation_t1.txt Any auto '*' NOKEY 2>&1 \
+    | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_expected.txt
+$PROG --decodethreads=4 --format=json simulations/simulation_t1.txt Any auto '*' NOKEY 2>&1 \
+    | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_output.txt
+
+sort $TEST/test_expected.txt > $TEST/test_expected_sorted.txt
+sort $TEST/test_output.txt > $TEST/test_responses.txt
+diff $TEST/test_expected_sorted.txt $TEST/test_responses.txt
+if [ "$?" = "0" ]
+then
+    TESTRESULT="OK"
+    for ID in $(grep -o '"id":"[0-9a-f]*"' $TEST/test_expected.txt | sort -u)
+    do
+        grep -F "$ID" $TEST/test_expected.txt > $TEST/test_expected_meter.txt
+        grep -F "$ID" $TEST/test_output.txt > $TEST/test_output_meter.txt
+        diff $TEST/test_expected_meter.txt $TEST/test_output_meter.txt > /dev/null
+        if [ "$?" != "0" ]
+        then
+            echo "Telegrams from meter $ID printed out of order!"
+            TESTRESULT="ERROR"
+        fi
+    done
+fi
+
+if [ "$TESTRESULT" = "OK" ]
+then
+    echo OK: $TESTNAME
+else
+    echo ERROR: $TESTNAME
+    exit 1
+fi
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+PROG="$1"
+
+mkdir -p testoutput
+TEST=testoutput
+
+TESTNAME="Test format cache"
+TESTRESULT="ERROR"
+
+rm -f $TEST/formats.txt
+grep '^telegram=|27442D2C' simulations/simulation_format_cache.txt > $TEST/simulation_full.txt
+grep '^telegram=|22442D2C' simulations/simulation_format_cache.txt > $TEST/simulation_compact.txt
+grep -A1 '^telegram=|22442D2C' simulations/simulation_format_cache.txt | grep '^{' > $TEST/test_expected.txt
+
+# The full telegram teaches wmbusmeters the format, which is stored at shutdown.
+$PROG --formatcache=$TEST/formats.txt $TEST/simulation_full.txt MyTapWater multical21 76348799 NOKEY > /dev/null 2>&1
+
+if [ "$(grep -cv '^#' $TEST/formats.txt)" != "1" ]
+then
+    echo "Unexpected format cache: $(cat $TEST/formats.txt)"
+    echo ERROR: $TESTNAME
+    exit 1
+fi
+
+# Without the format cache the compact telegram cannot be decoded.
+$PROG --format=json $TEST/simulation_compact.txt MyTapWater multical21 76348799 NOKEY 2>/dev/null | grep -c '^{' > $TEST/test_output.txt
+if [ "$(cat $TEST/test_output.txt)" != "0" ]
+then
+    echo "Expected the compact telegram to need the format cache"
+    echo ERROR: $TESTNAME
+    exit 1
+fi
+
+# The compact telegram is decoded after the restart using the format loaded from the file.
+$PROG --debug --format=json --formatcache=$TEST/formats.txt $TEST/simulation_compact.txt \
+      MyTapWater multical21 76348799 NOKEY > $TEST/test_output.txt 2> $TEST/test_stderr.txt
+
+cat $TEST/test_output.txt | grep '^{' | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_response.txt
+diff $TEST/test_expected.txt $TEST/test_response.txt
+if [ "$?" = "0" ] && grep -q 'found remembered format' $TEST/test_stderr.txt
+then
+    TESTRESULT="OK"
+fi
+
+# Bad lines in the file are warned about and ignored, the good line is still used.
+echo "zzzz not a format" >> $TEST/formats.txt
+echo "1234 02FF2004134413615B" >> $TEST/formats.txt
+$PROG --format=json --formatcache=$TEST/formats.txt $TEST/simulation_compact.txt \
+      MyTapWater multical21 76348799 NOKEY > $TEST/test_output.txt 2> $TEST/test_stderr.txt
+
+cat $TEST/test_output.txt | grep '^{' | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_response.txt
+diff $TEST/test_expected.txt $TEST/test_response.txt
+if [ "$?" != "0" ]
+then
+    TESTRESULT="ERROR"
+fi
+if [ "$(grep -c 'ignoring bad line in format signatures file' $TEST/test_stderr.txt)" != "2" ]
+then
+    echo "Expected two bad lines to be ignored: $(cat $TEST/test_stderr.txt)"
+    TESTRESULT="ERROR"
+fi
+
+if [ "$TESTRESULT" = "OK" ]
+then
+    echo OK: $TESTNAME
+else
+    echo ERROR: $TESTNAME
+    exit 1
+fi
@@ -0,0 +1,54 @@
+#!/bin/sh
+
+PROG="$1"
+
+mkdir -p testoutput
+TEST=testoutput
+
+TESTNAME="Test ingest queue"
+TESTRESULT="ERROR"
+
+# A large enough ingest queue hands over all telegrams to the meters.
+$PROG --format=json simulations/simulation_t1.txt Any auto '*' NOKEY 2>&1 \
+    | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_expected.txt
+$PROG --ingestqueue=1000 --format=json simulations/simulation_t1.txt Any auto '*' NOKEY 2>&1 \
+    | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_responses.txt
+
+diff $TEST/test_expected.txt $TEST/test_responses.txt
+if [ "$?" = "0" ]
+then
+    TESTRESULT="OK"
+fi
+
+# A blocked shell fills up the ingest queue of size 1. The shell blocks until
+# all telegrams have been received, thus exactly two telegrams are enqueued
+# (the one handed over to the blocked shell and the one waiting in the queue)
+# and the other three are dropped.
+rm -f $TEST/ingest_blocked $TEST/ingest_release $TEST/test_stderr.txt
+$PROG --verbose --ingestqueue=1 --ingestqueuepolicy=dropnewest \
+      --shell="touch $TEST/ingest_blocked; while [ ! -f $TEST/ingest_release ]; do sleep 0.01; done" \
+      "rtlwmbus:CMD(tests/rtlwmbus_ingest.sh)" Any iperl '*' NOKEY > $TEST/test_output.txt 2> $TEST/test_stderr.txt &
+PID=$!
+
+WAITED=0
+while ! grep -q 'CRC checks failed' $TEST/test_stderr.txt 2> /dev/null && [ "$WAITED" -lt 1000 ]
+do
+    sleep 0.01
+    WAITED=$((WAITED+1))
+done
+touch $TEST/ingest_release
+wait $PID
+
+if ! grep -q '(ingest) .* enqueued 2 dropped 3 high water mark 1 (of 1)' $TEST/test_stderr.txt
+then
+    echo "Unexpected ingest counters: $(grep '(ingest)' $TEST/test_stderr.txt)"
+    TESTRESULT="ERROR"
+fi
+
+if [ "$TESTRESULT" = "OK" ]
+then
+    echo OK: $TESTNAME
+else
+    echo ERROR: $TESTNAME
+    exit 1
+fi
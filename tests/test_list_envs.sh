@@ -66,6 +66,7 @@ cat <<EOF > $TEST/test_expected.txt
                          timestamp_lt  Local time when wmbusmeters received the telegram.
                         timestamp_utc  UTC time when wmbusmeters received the telegram.
                                device  The wmbus device that received the telegram.
+                              devices  All wmbus devices that received the telegram, when merged from several devices.
                              rssi_dbm  The rssi for the received telegram as reported by the device.
          total_energy_consumption_kwh  The total energy consumption recorded by this meter.
          current_power_consumption_kw  Current power consumption.
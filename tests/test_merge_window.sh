@@ -0,0 +1,37 @@
+#!/bin/sh
+
+PROG="$1"
+
+mkdir -p testoutput
+TEST=testoutput
+
+TESTNAME="Test merge window"
+TESTRESULT="ERROR"
+
+# The copies of a telegram received within the merge window are merged,
+# only the copy with the best rssi is decoded.
+cat tests/rtlwmbus_merge.sh | grep '^#{' | tr -d '#' > $TEST/test_expected.txt
+$PROG --verbose --mergewindow=1000 --format=json "rtlwmbus:CMD(tests/rtlwmbus_merge.sh)" \
+      ApWater apator162 88888888 00000000000000000000000000000000 \
+      > $TEST/test_output.txt 2> $TEST/test_stderr.txt
+
+cat $TEST/test_output.txt | sed 's/"timestamp":"....-..-..T..:..:..Z"/"timestamp":"1111-11-11T11:11:11Z"/' > $TEST/test_response.txt
+diff $TEST/test_expected.txt $TEST/test_response.txt
+if [ "$?" = "0" ]
+then
+    TESTRESULT="OK"
+fi
+
+if ! grep -q '(merge) received 2 forwarded 1 ' $TEST/test_stderr.txt
+then
+    echo "Unexpected merge counters: $(grep '(merge)' $TEST/test_stderr.txt)"
+    TESTRESULT="ERROR"
+fi
+
+if [ "$TESTRESULT" = "OK" ]
+then
+    echo OK: $TESTNAME
+else
+    echo ERROR: $TESTNAME
+    exit 1
+fi